@@ -0,0 +1,257 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef COMMON_CHECKPOINT_HPP_
+#define COMMON_CHECKPOINT_HPP_
+
+#include <mpi.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Per rank binary checkpoints of the distributed NMF/NTF iterations.
+ * Every rank writes its own blocks of the factors and the auxiliary state
+ * of the algorithm, e.g. the ADMM duals, to prefix_<rank>. The state is
+ * copied in save() and written by a background thread, so that an
+ * iteration waits only for the copy and for the write of the previous
+ * checkpoint if it is still running. No MPI is called from the thread.
+ *
+ * A checkpoint is written to prefix_<rank>.tmp and renamed over
+ * prefix_<rank> after the older one is moved to prefix_<rank>.prev.
+ * save() is collective. Before a new write starts, all the ranks agree
+ * that every rank has finished the previous one, so no rank moves ahead
+ * by more than the checkpoint being written. A job killed in the middle
+ * of a write therefore leaves a common complete checkpoint on every rank
+ * and restore() agrees on the newest iteration that every rank has. If
+ * the previous write failed on any rank, the other ranks roll it back so
+ * that the common checkpoint survives the next write.
+ *
+ * File layout, all native endian.
+ *   "PLANCCKP" int64 iteration int64 count
+ *   count times: int64 n_rows int64 n_cols n_rows*n_cols doubles
+ *   "PLANCEND"
+ */
+class Checkpoint {
+ private:
+  std::string m_prefix;
+  int m_rank;
+  int m_every;
+  std::thread m_writer;
+  // copy of the state being written by m_writer
+  std::vector<MAT> m_snapshot;
+  int64_t m_snapshot_it;
+  // set by m_writer. read only after the join.
+  bool m_write_ok;
+
+  static const char *magic() { return "PLANCCKP"; }
+  static const char *endmagic() { return "PLANCEND"; }
+
+  std::string file_name() const {
+    return m_prefix + "_" + std::to_string(m_rank);
+  }
+
+  void write() {
+    m_write_ok = false;
+    std::string name = file_name();
+    std::string tmp_name = name + ".tmp";
+    FILE *fp = fopen(tmp_name.c_str(), "wb");
+    if (fp == NULL) {
+      WARN << "checkpoint::unable to open::" << tmp_name << std::endl;
+      return;
+    }
+    int64_t count = m_snapshot.size();
+    bool ok = fwrite(magic(), 1, 8, fp) == 8 &&
+              fwrite(&m_snapshot_it, sizeof(int64_t), 1, fp) == 1 &&
+              fwrite(&count, sizeof(int64_t), 1, fp) == 1;
+    for (int64_t i = 0; ok && i < count; i++) {
+      int64_t shape[2] = {static_cast<int64_t>(m_snapshot[i].n_rows),
+                          static_cast<int64_t>(m_snapshot[i].n_cols)};
+      ok = fwrite(shape, sizeof(int64_t), 2, fp) == 2 &&
+           fwrite(m_snapshot[i].memptr(), sizeof(double), m_snapshot[i].n_elem,
+                  fp) == m_snapshot[i].n_elem;
+    }
+    ok = ok && fwrite(endmagic(), 1, 8, fp) == 8;
+    ok = (fflush(fp) == 0) && ok;
+    ok = (fsync(fileno(fp)) == 0) && ok;
+    fclose(fp);
+    if (!ok) {
+      WARN << "checkpoint::write failed::" << tmp_name << std::endl;
+      remove(tmp_name.c_str());
+      return;
+    }
+    std::string prev_name = name + ".prev";
+    rename(name.c_str(), prev_name.c_str());
+    if (rename(tmp_name.c_str(), name.c_str()) != 0) {
+      WARN << "checkpoint::rename failed::" << name << std::endl;
+      return;
+    }
+    m_write_ok = true;
+  }
+
+  /// Moves prefix_<rank>.prev back over the checkpoint just written
+  void roll_back() {
+    std::string name = file_name();
+    std::string prev_name = name + ".prev";
+    if (rename(prev_name.c_str(), name.c_str()) != 0) remove(name.c_str());
+  }
+
+  /// Returns the iteration of the complete checkpoint in the file or -1
+  static int64_t peek(const std::string &name) {
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (fp == NULL) return -1;
+    char tag[8];
+    int64_t it = -1;
+    if (fread(tag, 1, 8, fp) != 8 || memcmp(tag, magic(), 8) != 0 ||
+        fread(&it, sizeof(int64_t), 1, fp) != 1 ||
+        fseek(fp, -8, SEEK_END) != 0 || fread(tag, 1, 8, fp) != 8 ||
+        memcmp(tag, endmagic(), 8) != 0) {
+      it = -1;
+    }
+    fclose(fp);
+    return it;
+  }
+
+  /// Reads the state into o_state. The shapes have to match.
+  static bool read(const std::string &name, const std::vector<MAT *> &o_state) {
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (fp == NULL) return false;
+    char tag[8];
+    int64_t it, count;
+    bool ok = fread(tag, 1, 8, fp) == 8 &&
+              fread(&it, sizeof(int64_t), 1, fp) == 1 &&
+              fread(&count, sizeof(int64_t), 1, fp) == 1 &&
+              count == static_cast<int64_t>(o_state.size());
+    for (int64_t i = 0; ok && i < count; i++) {
+      int64_t shape[2];
+      ok = fread(shape, sizeof(int64_t), 2, fp) == 2 &&
+           shape[0] == static_cast<int64_t>(o_state[i]->n_rows) &&
+           shape[1] == static_cast<int64_t>(o_state[i]->n_cols) &&
+           fread(o_state[i]->memptr(), sizeof(double), o_state[i]->n_elem,
+                 fp) == o_state[i]->n_elem;
+    }
+    fclose(fp);
+    return ok;
+  }
+
+ public:
+  /**
+   * @param[in] i_prefix of the checkpoint files. Empty disables them.
+   * @param[in] i_rank MPI rank of this process
+   * @param[in] i_every checkpoint after every i_every iterations
+   */
+  Checkpoint(const std::string &i_prefix = "", int i_rank = 0,
+             int i_every = 0)
+      : m_prefix(i_prefix),
+        m_rank(i_rank),
+        m_every(i_every),
+        m_snapshot_it(-1),
+        m_write_ok(true) {}
+  Checkpoint(const Checkpoint &) = delete;
+  Checkpoint &operator=(const Checkpoint &) = delete;
+  ~Checkpoint() { wait(); }
+
+  /// Returns true if the checkpoints have a file name
+  bool enabled() const { return !m_prefix.empty(); }
+  /// Returns true if a checkpoint is due after the zero based iteration it
+  bool due(unsigned int it) const {
+    return enabled() && m_every > 0 && ((it + 1) % m_every == 0);
+  }
+  /// Waits for the checkpoint being written
+  void wait() {
+    if (m_writer.joinable()) m_writer.join();
+  }
+  /**
+   * Collective. Waits until every rank has finished the previous
+   * checkpoint, then copies the state and writes it in the background.
+   * @param[in] it zero based iteration just completed
+   * @param[in] i_state factor blocks and auxiliary state of this rank
+   */
+  void save(unsigned int it, const std::vector<const MAT *> &i_state) {
+    wait();
+    int done = m_write_ok;
+    int all_done;
+    MPI_Allreduce(&done, &all_done, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!all_done) {
+      if (m_write_ok) roll_back();
+      if (m_rank == 0) {
+        WARN << "checkpoint::it::" << m_snapshot_it
+             << "::failed on some rank::rolled back" << std::endl;
+      }
+    }
+    m_snapshot_it = it;
+    m_snapshot.resize(i_state.size());
+    for (size_t i = 0; i < i_state.size(); i++) m_snapshot[i] = *i_state[i];
+    m_writer = std::thread(&Checkpoint::write, this);
+  }
+  /**
+   * Collective. Returns the iteration of the newest checkpoint that every
+   * rank has or -1 if there is none.
+   */
+  int64_t agreed_iteration() const {
+    std::string name = file_name();
+    int64_t newest = std::max(peek(name), peek(name + ".prev"));
+    int64_t agreed;
+    MPI_Allreduce(&newest, &agreed, 1, MPI_INT64_T, MPI_MIN, MPI_COMM_WORLD);
+    return agreed;
+  }
+  /// Collective. Returns true if there is a checkpoint to restart from.
+  bool available() const { return enabled() && agreed_iteration() >= 0; }
+  /**
+   * Collective. Loads the newest checkpoint that every rank has.
+   * @param[out] o_state same matrices as given to save, already of the
+   *             right shapes. Untouched if false is returned.
+   * @param[out] o_it iteration the checkpoint was saved after
+   * @return true if all the ranks restored the same iteration
+   */
+  bool restore(const std::vector<MAT *> &o_state, unsigned int *o_it) {
+    std::string name = file_name();
+    std::string prev_name = name + ".prev";
+    int64_t cur_it = peek(name);
+    int64_t prev_it = peek(prev_name);
+    int64_t agreed = agreed_iteration();
+    int ok = 0;
+    if (agreed >= 0) {
+      // read into copies so that a failed restore leaves the state alone
+      std::vector<MAT> copies(o_state.size());
+      std::vector<MAT *> targets(o_state.size());
+      for (size_t i = 0; i < o_state.size(); i++) {
+        copies[i].set_size(o_state[i]->n_rows, o_state[i]->n_cols);
+        targets[i] = &copies[i];
+      }
+      if (cur_it == agreed) {
+        ok = read(name, targets);
+      } else if (prev_it == agreed) {
+        ok = read(prev_name, targets);
+      }
+      int all_ok;
+      MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+      ok = all_ok;
+      if (ok) {
+        for (size_t i = 0; i < o_state.size(); i++) *o_state[i] = copies[i];
+        *o_it = agreed;
+      }
+    }
+    if (m_rank == 0) {
+      if (ok) {
+        INFO << "restored checkpoint::" << m_prefix << "::it::" << agreed
+             << std::endl;
+      } else {
+        WARN << "no usable checkpoint::" << m_prefix
+             << "::starting from the initial factors" << std::endl;
+      }
+    }
+    return ok;
+  }
+};
+
+}  // namespace planc
+
+#endif  // COMMON_CHECKPOINT_HPP_
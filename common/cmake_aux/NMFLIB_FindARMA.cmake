@@ -25,6 +25,26 @@ if(CMAKE_WITH_BARRIER_TIMING)
   add_definitions(-D__WITH__BARRIER__TIMING__=1)
 endif()
 
+#overlap the per k-block collectives with the local mm. needs MPI-3.
+OPTION(CMAKE_WITH_MPI_PIPELINE "Pipeline k-block allgather/reduce_scatter" OFF)
+if(CMAKE_WITH_MPI_PIPELINE)
+  add_definitions(-DMPI_PIPELINE=1)
+endif()
+
+#generate the krp in cache sized blocks inside the mttkrp instead of
+#materializing it. only for the non dimension tree path.
+OPTION(CMAKE_WITH_FUSED_MTTKRP "Blocked KRP fused into the MTTKRP" OFF)
+if(CMAKE_WITH_FUSED_MTTKRP)
+  add_definitions(-DFUSED_MTTKRP=1)
+endif()
+
+#single precision dense input and communication of distnmf. the
+#factors, grams and nnls solves stay in double. distntf is unaffected.
+OPTION(CMAKE_WITH_MIXED_PRECISION "Single precision input and collectives" OFF)
+if(CMAKE_WITH_MIXED_PRECISION)
+  add_definitions(-DMIXED_PRECISION=1)
+endif()
+
 #C++11 standard
 set (CMAKE_CXX_STANDARD 11)
 
@@ -65,6 +85,11 @@ endif()
 
 set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -fopenmp")
 
+#the checkpoints and the out of core slabs are written and read by a
+#background std::thread
+find_package(Threads REQUIRED)
+set(NMFLIB_LIBS ${NMFLIB_LIBS} ${CMAKE_THREAD_LIBS_INIT})
+
 #if(DEFINED CMAKE_CXX_COMPILER_ID AND DEFINED CMAKE_CXX_COMPILER_VERSION)
 #  if(CMAKE_CXX_COMPILER_ID STREQUAL "GNU" AND NOT ${CMAKE_CXX_COMPILER_VERSION} VERSION_LESS 4.8.3)
 #    set(NMFLIB_USE_EXTERN_CXX11_RNG true)
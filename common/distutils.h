@@ -20,6 +20,8 @@ enum iodistributions { ONED_ROW, ONED_COL, ONED_DOUBLE, TWOD };
 #define MPI_SLICE_RANK(i) this->m_mpicomm.slice_rank(i)
 #define NUMROWPROCS this->m_mpicomm.pr()
 #define NUMCOLPROCS this->m_mpicomm.pc()
+// processes in a pr x pc layer of the 3D grid. MPI_SIZE in 2D.
+#define LAYERSIZE (MPI_SIZE / this->m_mpicomm.pk())
 
 // #define MPITIC tic()
 // #define MPITOC toc()
@@ -3,6 +3,8 @@
 #define COMMON_DISTUTILS_HPP_
 
 #include <mpi.h>
+#include <cmath>
+#include <limits>
 #include <string>
 #include "common/distutils.h"
 #include "common/utils.h"
@@ -43,6 +45,21 @@ inline double mpitoc() {
   tictoc_stack.pop();
   return rc;
 }
+/**
+ * MPI datatype of the given element type. Used by the classes that are
+ * templated on the precision of the matrices they communicate.
+ */
+template <class eT>
+inline MPI_Datatype mpitype();
+template <>
+inline MPI_Datatype mpitype<double>() {
+  return MPI_DOUBLE;
+}
+template <>
+inline MPI_Datatype mpitype<float>() {
+  return MPI_FLOAT;
+}
+
 /**
  * Captures the memory usage of every mpi process
  */
@@ -93,4 +110,77 @@ inline int startidx(int n, int p, int r) {
       (r < rem) ? r * (n / p + 1) : (rem * (n / p + 1) + ((r - rem) * (n / p)));
   return idx;
 }
+
+// flops of the local mm/mttkrp that cost as much as one communicated word
+const double kGridFlopsPerWord = 64.0;
+// assumed size of the dimensions that are not known before the input is read
+const UWORD kGridUnknownDim = 1 << 20;
+
+/**
+ * Modeled cost in words of one outer iteration on the given processor
+ * grid. Every mode i allgathers its factor and reduce scatters its
+ * mttkrp (WtA/AH for a matrix) over the p/p_i processes of its slice.
+ * Each of them moves (dims_i/p_i) * k * (1 - p_i/p) words. The load
+ * imbalance is the largest local block over the average one at 2k
+ * flops per element and per mode.
+ * @param[in] grid number of processes per mode
+ * @param[in] dims global dimensions of the matrix or tensor
+ * @param[in] k low rank
+ */
+inline double grid_cost(const UVEC &grid, const UVEC &dims, UWORD k) {
+  double p = arma::prod(grid);
+  double words = 0.0;
+  double maxlocal = 1.0;
+  double avglocal = 1.0;
+  for (UWORD i = 0; i < grid.n_elem; i++) {
+    double pi = grid[i];
+    double di = dims[i];
+    words += 2.0 * k * (di / pi) * (1.0 - pi / p);
+    maxlocal *= std::ceil(di / pi);
+    avglocal *= di / pi;
+  }
+  double imbalance = 2.0 * k * grid.n_elem * (maxlocal - avglocal);
+  return words + imbalance / kGridFlopsPerWord;
+}
+
+/// enumerates the factorizations of p over the modes from mode onwards
+inline void search_grid(UWORD p, UWORD mode, const UVEC &dims, UWORD k,
+                        UVEC *grid, UVEC *best_grid, double *best_cost) {
+  if (mode == grid->n_elem - 1) {
+    if (p > dims[mode]) return;
+    (*grid)[mode] = p;
+    double cost = grid_cost(*grid, dims, k);
+    if (cost < *best_cost) {
+      *best_cost = cost;
+      *best_grid = *grid;
+    }
+    return;
+  }
+  for (UWORD d = 1; d <= p && d <= dims[mode]; d++) {
+    if (p % d != 0) continue;
+    (*grid)[mode] = d;
+    search_grid(p / d, mode + 1, dims, k, grid, best_grid, best_cost);
+  }
+}
+
+/**
+ * Picks the processor grid for p processes that minimizes grid_cost
+ * among all the factorizations of p into dims.n_elem modes with no
+ * more processes than rows in a mode.
+ * @param[in] p number of processes
+ * @param[in] dims global dimensions. 0 if not known yet.
+ * @param[in] k low rank
+ * @return grid of dims.n_elem entries whose product is p
+ */
+inline UVEC best_processor_grid(UWORD p, const UVEC &dims, UWORD k) {
+  UVEC known = dims;
+  known.elem(arma::find(known == 0)).fill(kGridUnknownDim);
+  UVEC grid = arma::ones<UVEC>(dims.n_elem);
+  UVEC best_grid = grid;
+  // nothing fits. Put every process on the first mode.
+  best_grid[0] = p;
+  double best_cost = std::numeric_limits<double>::max();
+  search_grid(p, 0, known, k, &grid, &best_grid, &best_cost);
+  return best_grid;
+}
 #endif  // COMMON_DISTUTILS_HPP_
@@ -3,7 +3,10 @@
 #ifndef COMMON_NCPFACTORS_HPP_
 #define COMMON_NCPFACTORS_HPP_
 
+#include <omp.h>
+#include <algorithm>
 #include <cassert>
+#include <vector>
 #include "common/tensor.hpp"
 #include "common/utils.h"
 #ifdef MPI_DISTNTF
@@ -19,6 +22,64 @@
 
 namespace planc {
 
+/**
+ * Hadamard products of all but one of N kxk grams. The prefix products
+ * P_i = G_0 % ... % G_{i-1} and the suffix products S_i = G_i % ... %
+ * G_{N-1} stay valid as long as the grams they cover don't change. The
+ * leave out of n is then P_n % S_{n+1}. In a sweep over the modes in
+ * order, where the gram of a mode changes right after its leave out,
+ * a leave out costs O(k^2) and the suffixes are rebuilt once per sweep.
+ */
+class GramHadamard {
+  std::vector<MAT> m_grams;
+  std::vector<MAT> m_prefix;
+  std::vector<MAT> m_suffix;
+  /// m_prefix[0..m_prefix_valid] are valid
+  unsigned int m_prefix_valid;
+  /// m_suffix[m_suffix_valid..N] are valid
+  unsigned int m_suffix_valid;
+
+ public:
+  GramHadamard(const unsigned int i_modes, const unsigned int i_k)
+      : m_grams(i_modes, arma::zeros<MAT>(i_k, i_k)),
+        m_prefix(i_modes + 1, arma::ones<MAT>(i_k, i_k)),
+        m_suffix(i_modes + 1, arma::ones<MAT>(i_k, i_k)),
+        m_prefix_valid(0),
+        m_suffix_valid(i_modes) {}
+  /// number of grams
+  unsigned int modes() const { return m_grams.size(); }
+  /// gram of the mode i_n
+  const MAT &gram(const unsigned int i_n) const { return m_grams[i_n]; }
+  /// Replaces the gram of the mode i_n
+  void set(const unsigned int i_n, const MAT &i_gram) {
+    m_grams[i_n] = i_gram;
+    m_prefix_valid = std::min(m_prefix_valid, i_n);
+    m_suffix_valid = std::max(m_suffix_valid, i_n + 1);
+  }
+  /**
+   * Hadamard of all the grams except i_n
+   * @param[in] i_n mode to leave out
+   * @param[out] o_UtU kxk
+   */
+  void leave_out_one(const unsigned int i_n, MAT *o_UtU) {
+    for (; m_prefix_valid < i_n; m_prefix_valid++) {
+      m_prefix[m_prefix_valid + 1] =
+          m_prefix[m_prefix_valid] % m_grams[m_prefix_valid];
+    }
+    for (; m_suffix_valid > i_n + 1; m_suffix_valid--) {
+      m_suffix[m_suffix_valid - 1] =
+          m_grams[m_suffix_valid - 1] % m_suffix[m_suffix_valid];
+    }
+    (*o_UtU) = m_prefix[i_n] % m_suffix[i_n + 1];
+  }
+  /// Hadamard of all the grams
+  void all(MAT *o_UtU) {
+    const unsigned int n = modes();
+    leave_out_one(n - 1, o_UtU);
+    (*o_UtU) %= m_grams[n - 1];
+  }
+};
+
 class NCPFactors {
   MAT *ncp_factors;   /// Array of factors .One factor for every mode.
   unsigned int m_modes;        /// Number of modes in tensor
@@ -28,6 +89,19 @@ class NCPFactors {
   VEC m_lambda;
   /// normalize the factors of a matrix
   bool freed_ncp_factors;
+  /// grams of the factors. m_gram_valid[i] is reset whenever the factor
+  /// of the mode i changes through this class.
+  GramHadamard m_grams;
+  std::vector<bool> m_gram_valid;
+
+  /// Computes the grams that are out of date
+  void update_grams() {
+    for (unsigned int i = 0; i < this->m_modes; i++) {
+      if (m_gram_valid[i]) continue;
+      m_grams.set(i, ncp_factors[i].t() * ncp_factors[i]);
+      m_gram_valid[i] = true;
+    }
+  }
 
  public:
   /**
@@ -38,7 +112,9 @@ class NCPFactors {
    * @param[in] trans. takes true or false. Transposes every factor.
    */
 
-  NCPFactors(const UVEC &i_dimensions, const int &i_k, bool trans) {
+  NCPFactors(const UVEC &i_dimensions, const int &i_k, bool trans)
+      : m_grams(i_dimensions.n_rows, i_k),
+        m_gram_valid(i_dimensions.n_rows, false) {
     this->m_dimensions = i_dimensions;
     this->m_modes = i_dimensions.n_rows;
     ncp_factors = new MAT[this->m_modes];
@@ -96,7 +172,8 @@ ncp_factors[i].clear();
   int rank() const { return m_k; }
   /// dimensions of every mode
   UVEC dimensions() const { return m_dimensions; }
-  /// factor matrix of a mode i_n
+  /// factor matrix of a mode i_n. Call invalidate_grams after changing
+  /// it in place.
   MAT &factor(const int i_n) const { return ncp_factors[i_n]; }
   /// returns number of modes
   int modes() const { return m_modes; }
@@ -112,6 +189,11 @@ ncp_factors[i].clear();
   void set(const int i_n, const MAT &i_factor) {
     assert(i_factor.size() == this->ncp_factors[i_n].size());
     this->ncp_factors[i_n] = i_factor;
+    m_gram_valid[i_n] = false;
+  }
+  /// Marks the cached grams of all the modes out of date
+  void invalidate_grams() {
+    std::fill(m_gram_valid.begin(), m_gram_valid.end(), false);
   }
   /// sets the lambda vector
   void set_lambda(const VEC &new_lambda) { m_lambda = new_lambda; }
@@ -121,11 +203,10 @@ ncp_factors[i].clear();
    * @param[out] UtU is a kxk matrix
    */
   void gram(MAT *o_UtU) {
-    MAT currentGram(this->m_k, this->m_k);
-    for (unsigned int i = 0; i < this->m_modes; i++) {
-      currentGram = ncp_factors[i].t() * ncp_factors[i];
-      (*o_UtU) = (*o_UtU) % currentGram;
-    }
+    update_grams();
+    MAT all_grams;
+    m_grams.all(&all_grams);
+    (*o_UtU) = (*o_UtU) % all_grams;
   }
 
   // find the hadamard product of all the factor grams
@@ -137,14 +218,8 @@ ncp_factors[i].clear();
    */
 
   void gram_leave_out_one(const unsigned int i_n, MAT *o_UtU) {
-    MAT currentGram(this->m_k, this->m_k);
-    (*o_UtU) = arma::ones<MAT>(this->m_k, this->m_k);
-    for (unsigned int i = 0; i < this->m_modes; i++) {
-      if (i != i_n) {
-        currentGram = ncp_factors[i].t() * ncp_factors[i];
-        (*o_UtU) = (*o_UtU) % currentGram;
-      }
-    }
+    update_grams();
+    m_grams.leave_out_one(i_n, o_UtU);
   }
   /**
    * KRP leaving out the mode i_n
@@ -160,107 +235,283 @@ ncp_factors[i].clear();
   }
   // construct low rank tensor using the factors
   /**
-   * khatrirao leaving out one. we are using the implementation
-   * from tensor toolbox. Always krp for mttkrp is computed in
-   * reverse. Hence assuming the same. The order of the computation
-   * is same a tensor tool box.
+   * khatrirao leaving out one. The row order is the same as the one of
+   * the tensor toolbox, that is, the krp is computed in reverse and the
+   * lowest mode varies fastest. See krp_modes.
    * size of krp must be product of all dimensions leaving out nxk
    * @param[in] i_n mode that will be excluded
    * @param[out] m_dimensions[i_n]xk
    */
-  void krp_leave_out_one(const unsigned int i_n, MAT *o_krp) {
-    // matorder = length(A):-1:1;
-    // Always krp for mttkrp is computed in
-    // reverse. Hence assuming the same.
-    UVEC matorder = arma::zeros<UVEC>(this->m_modes - 1);
-    int j = 0;
-    for (int i = this->m_modes - 1; i >= 0; i--) {
-      if (i != i_n) {
-        matorder(j++) = i;
-      }
+  void krp_leave_out_one(const unsigned int i_n, MAT *o_krp) const {
+    std::vector<unsigned int> othermodes;
+    for (unsigned int i = 0; i < this->m_modes; i++) {
+      if (i != i_n) othermodes.push_back(i);
     }
 #ifdef NTF_VERBOSE
     INFO << "::" << __PRETTY_FUNCTION__ << "::" << __LINE__
-         << "::matorder::" << matorder << std::endl;
+         << "::i_n::" << i_n << std::endl;
 #endif
-    o_krp->zeros();
-    // N = ncols(1);
-    // This is our k. So keep N = k in our case.
-    // P = A{matorder(1)};
-    // take the first factor of matorder
-    /*UWORD current_nrows = ncp_factors[matorder(0)].n_rows - 1;
-(*o_krp).rows(0, current_nrows) = ncp_factors[matorder(0)];
-// this is factor by factor
-for (int i = 1; i < this->m_modes - 1; i++) {
-// remember always krp in reverse order.
-// That is if A krp B krp C, we compute as
-// C krp B krp A.
-// prev_nrows = current_nrows;
-// rightkrp.n_rows;
-// we are populating column by column
-MAT& rightkrp = ncp_factors[matorder[i]];
-for (int j = 0; j < this->m_k; j++) {
-VEC krpcol = (*o_krp)(arma::span(0, current_nrows), j);
-// krpcol.each_rows*rightkrp.col(i);
-for (int k = 0; k < rightkrp.n_rows; k++) {
-    (*o_krp)(arma::span(k * krpcol.n_rows, (k + 1)*krpcol.n_rows -
-1), j) = krpcol * rightkrp(k, j);
-}
-}
-current_nrows *= rightkrp.n_rows;
-}*/
-    // Loop through all the columns
-    // for n = 1:N
-    //     % Loop through all the matrices
-    //     ab = A{matorder(1)}(:,n);
-    //     for i = matorder(2:end)
-    //        % Compute outer product of nth columns
-    //        ab = A{i}(:,n) * ab(:).';
-    //     end
-    //     % Fill nth column of P with reshaped result
-    //     P(:,n) = ab(:);
-    // end
-    for (unsigned int n = 0; n < this->m_k; n++) {
-      MAT ab = ncp_factors[matorder[0]].col(n);
-      for (unsigned int i = 1; i < this->m_modes - 1; i++) {
-        VEC oldabvec = arma::vectorise(ab);
-        VEC currentvec = ncp_factors[matorder[i]].col(n);
-        ab.clear();
-        ab = currentvec * oldabvec.t();
+    krp_modes(othermodes, o_krp);
+  }
+  /**
+   * KRP of the given modes, the first one varying fastest, written
+   * directly into o_krp. The rows are split into blocks over the OpenMP
+   * threads. Every block is generated by krp_rows into a small per thread
+   * buffer, where the hadamard of a row runs over the k contiguous
+   * entries, and then transposed into the columns of o_krp. Nothing is
+   * allocated per column or per mode besides the transposed factors.
+   * @param[in] i_modes modes of the KRP fastest first
+   * @param[out] o_krp of size product of the dimensions of i_modes x k
+   */
+  void krp_modes(const std::vector<unsigned int> &i_modes, MAT *o_krp) const {
+    // rows per block. The staging buffer stays within the L1 cache.
+    const UWORD kKRPBlockBytes = 1 << 15;
+    const UWORD k = this->m_k;
+    std::vector<MAT> factors_t(this->m_modes);
+    UWORD nrows = 1;
+    for (unsigned int l = 0; l < i_modes.size(); l++) {
+      factors_t[i_modes[l]] = ncp_factors[i_modes[l]].t();
+      nrows *= ncp_factors[i_modes[l]].n_rows;
+    }
+    assert(o_krp->n_rows == nrows && o_krp->n_cols == k);
+    const UWORD blk = std::max(static_cast<UWORD>(8),
+                               kKRPBlockBytes / (sizeof(double) * k));
+    const UWORD nblks = (nrows + blk - 1) / blk;
+#pragma omp parallel if (nblks > 1)
+    {
+      MAT stage(k, blk);
+#pragma omp for schedule(static)
+      for (UWORD b = 0; b < nblks; b++) {
+        const UWORD start = b * blk;
+        const UWORD nb = std::min(blk, nrows - start);
+        krp_rows(i_modes, factors_t, start, nb, &stage);
+        const double *src = stage.memptr();
+        for (UWORD c = 0; c < k; c++) {
+          double *dst = o_krp->colptr(c) + start;
+          for (UWORD j = 0; j < nb; j++) dst[j] = src[j * k + c];
+        }
       }
-      (*o_krp).col(n) = arma::vectorise(ab);
     }
   }
   /**
-   * KRP of the given vector of modes. It can be any subset of the modes.
-   * @param[in] Subset of modes
-   * @param[out] KRP of product of dimensions of the given modes by k
+   * Writes the rows [i_start, i_start + i_nrows) of the KRP of the given
+   * modes as the columns of o_blk. The modes are ordered fastest varying
+   * first, i.e. the same row order as krp_leave_out_one. The factors are
+   * transposed so that a row of every factor is contiguous. partial
+   * holds the running hadamard of the slower modes, so a new row costs
+   * one hadamard of length k unless a slower index rolls over.
+   * @param[in] i_modes modes of the KRP fastest first
+   * @param[in] i_factors_t transposed factors indexed by mode
+   * @param[in] i_start first row of the KRP
+   * @param[in] i_nrows number of rows
+   * @param[out] o_blk of size k x atleast i_nrows
    */
-  void krp(const UVEC i_modes, MAT *o_krp) {
-    // matorder = length(A):-1:1;
-    // Always krp for mttkrp is computed in
-    // reverse. Hence assuming the same.
-    UVEC matorder = arma::zeros<UVEC>(i_modes.n_rows - 1);    
-    int j = 0;
-    for (int i = i_modes.n_rows - 1; i >= 0; i--) {
-      matorder(j++) = i_modes[i];
+  static void krp_rows(const std::vector<unsigned int> &i_modes,
+                       const std::vector<MAT> &i_factors_t, UWORD i_start,
+                       UWORD i_nrows, MAT *o_blk) {
+    const unsigned int d = i_modes.size();
+    const UWORD k = o_blk->n_rows;
+    std::vector<UWORD> digits(d);
+    MAT partial = arma::ones<MAT>(k, d + 1);
+    UWORD rem = i_start;
+    for (unsigned int l = 0; l < d; l++) {
+      UWORD dim = i_factors_t[i_modes[l]].n_cols;
+      digits[l] = rem % dim;
+      rem /= dim;
     }
-#ifdef NTF_VERBOSE
-    INFO << "::" << __PRETTY_FUNCTION__ << "::" << __LINE__
-         << "::matorder::" << matorder << std::endl;
-#endif
-    (*o_krp).zeros();
-    for (unsigned int n = 0; n < this->m_k; n++) {
-      MAT ab = ncp_factors[matorder[0]].col(n);
-      for (unsigned int i = 1; i < i_modes.n_rows - 1; i++) {
-        VEC oldabvec = arma::vectorise(ab);
-        VEC currentvec = ncp_factors[matorder[i]].col(n);
-        ab.clear();
-        ab = currentvec * oldabvec.t();
+    for (int l = d - 1; l >= 1; l--) {
+      const double *f = i_factors_t[i_modes[l]].colptr(digits[l]);
+      const double *src = partial.colptr(l + 1);
+      double *dst = partial.colptr(l);
+      for (UWORD r = 0; r < k; r++) dst[r] = src[r] * f[r];
+    }
+    const UWORD fastdim = i_factors_t[i_modes[0]].n_cols;
+    for (UWORD j = 0; j < i_nrows; j++) {
+      const double *f = i_factors_t[i_modes[0]].colptr(digits[0]);
+      const double *src = partial.colptr(1);
+      double *dst = o_blk->colptr(j);
+      for (UWORD r = 0; r < k; r++) dst[r] = src[r] * f[r];
+      // advance the mixed radix row index
+      if (++digits[0] < fastdim || j + 1 == i_nrows) continue;
+      unsigned int l = 0;
+      while (l < d && digits[l] == i_factors_t[i_modes[l]].n_cols) {
+        digits[l] = 0;
+        if (++l < d) digits[l]++;
+      }
+      for (int m = std::min(l, d - 1); m >= 1; m--) {
+        const double *fm = i_factors_t[i_modes[m]].colptr(digits[m]);
+        const double *pm = partial.colptr(m + 1);
+        double *dm = partial.colptr(m);
+        for (UWORD r = 0; r < k; r++) dm[r] = pm[r] * fm[r];
+      }
+    }
+  }
+  /**
+   * MTTKRP of the given tensor with the KRP leaving out i_n, without
+   * materializing the KRP. Every OpenMP thread generates a block of KRP
+   * rows that fits in the cache and immediately multiplies it against
+   * the matching columns of the unfolding into a private accumulator.
+   * For i_n > 0 a block never crosses one of the row major slabs
+   * described in Tensor. The accumulators are summed at the end. The
+   * memory is O(threads * k * (block + dimension[i_n])) instead of the
+   * O(numel / dimension[i_n] * k) of krp_leave_out_one.
+   * Only the columns [i_kstart, i_kstart + o_mttkrp_t->n_rows) of the
+   * factors are used, so a k-block of the mttkrp can be computed alone.
+   * @param[in] i_n mode that will be excluded
+   * @param[in] i_tensor whose dimensions match the factors
+   * @param[out] o_mttkrp_t of size kb x dimension[i_n]
+   * @param[in] i_kstart first column of the factors
+   */
+  void fused_mttkrp(const unsigned int i_n, const Tensor &i_tensor,
+                    MAT *o_mttkrp_t, const unsigned int i_kstart = 0) const {
+    const int kb = o_mttkrp_t->n_rows;
+    std::vector<MAT> factors_t(this->m_modes);
+    for (unsigned int i = 0; i < this->m_modes; i++) {
+      if (i == i_n) continue;
+      factors_t[i] = ncp_factors[i].cols(i_kstart, i_kstart + kb - 1).t();
+    }
+    o_mttkrp_t->zeros();
+    fused_mttkrp_block(i_n, &i_tensor.m_data[0], i_tensor.dimensions(),
+                       factors_t, o_mttkrp_t);
+  }
+  /**
+   * Kernel of fused_mttkrp on raw tensor elements in the layout of
+   * Tensor. The result is added to o_mttkrp_t, so that the mttkrp of a
+   * tensor can be accumulated over several blocks of it.
+   * @param[in] i_n mode that will be excluded
+   * @param[in] i_X elements of the tensor
+   * @param[in] i_dims dimensions of the tensor
+   * @param[in] i_factors_t kb x i_dims[i] factors of the modes other
+   *            than i_n. The one of i_n is not used.
+   * @param[in,out] o_mttkrp_t of size kb x i_dims[i_n]
+   */
+  static void fused_mttkrp_block(const unsigned int i_n, const double *i_X,
+                                 const UVEC &i_dims,
+                                 const std::vector<MAT> &i_factors_t,
+                                 MAT *o_mttkrp_t) {
+    const UWORD kKRPBlockBytes = 1 << 18;
+    const int kb = o_mttkrp_t->n_rows;
+    const int dimn = i_dims[i_n];
+    std::vector<unsigned int> othermodes;
+    UWORD ncols = 1;
+    UWORD nmats = 1;
+    for (unsigned int i = 0; i < i_dims.n_elem; i++) {
+      if (i == i_n) continue;
+      othermodes.push_back(i);
+      if (i < i_n) {
+        ncols *= i_dims[i];
+      } else {
+        nmats *= i_dims[i];
+      }
+    }
+    const UWORD blk = std::max(static_cast<UWORD>(1),
+                               kKRPBlockBytes / (sizeof(double) * kb));
+    // mode 0 unfolding is one column major matrix
+    const UWORD nslabs = (i_n == 0) ? 1 : nmats;
+    const UWORD slablen = (i_n == 0) ? ncols * nmats : ncols;
+    const UWORD blks_per_slab = (slablen + blk - 1) / blk;
+    const UWORD nitems = nslabs * blks_per_slab;
+    const double *X = i_X;
+    // with too few blocks leave the threads to blas
+#pragma omp parallel if (nitems >= static_cast<UWORD>(omp_get_max_threads()))
+    {
+      MAT acc = arma::zeros<MAT>(kb, dimn);
+      MAT krpblk(kb, blk);
+#pragma omp for schedule(dynamic)
+      for (UWORD item = 0; item < nitems; item++) {
+        UWORD slab = item / blks_per_slab;
+        UWORD q0 = (item % blks_per_slab) * blk;
+        int qb = std::min(blk, slablen - q0);
+        krp_rows(othermodes, i_factors_t, slab * slablen + q0, qb, &krpblk);
+        // acc is row major dimn x kb
+        if (i_n == 0) {
+          cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, dimn, kb, qb,
+                      1.0, X + q0 * dimn, dimn, krpblk.memptr(), kb, 1.0,
+                      acc.memptr(), kb);
+        } else {
+          cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, dimn, kb, qb,
+                      1.0, X + slab * ncols * dimn + q0, ncols,
+                      krpblk.memptr(), kb, 1.0, acc.memptr(), kb);
+        }
       }
-      (*o_krp).col(n) = arma::vectorise(ab);
+#pragma omp critical
+      (*o_mttkrp_t) += acc;
     }
   }
+  /**
+   * Accumulates the mttkrps of one slab of a tensor, i.e. the
+   * elements of the indices [i_start, i_start + len) of the last mode.
+   * The mttkrps of the other modes are partial sums over the slab and
+   * the one of the last mode is complete for the columns of the slab.
+   * @param[in] i_X elements of the slab in the layout of Tensor
+   * @param[in] i_dims dimensions of the slab
+   * @param[in] i_start first index of the last mode in the slab
+   * @param[in] i_last_factor_t k x I_N transposed factor of the last mode
+   * @param[in,out] io_factors_t transposed factors of the other modes. The
+   *                one of the last mode is overwritten with the slab rows.
+   * @param[in,out] o_mttkrp_t k x I_n for the modes to compute or null
+   */
+  static void slab_mttkrp(const double *i_X, const UVEC &i_dims,
+                          UWORD i_start, const MAT &i_last_factor_t,
+                          std::vector<MAT> *io_factors_t,
+                          const std::vector<MAT *> &o_mttkrp_t) {
+    const unsigned int last = i_dims.n_elem - 1;
+    const UWORD len = i_dims[last];
+    (*io_factors_t)[last] = i_last_factor_t.cols(i_start, i_start + len - 1);
+    for (unsigned int i = 0; i < last; i++) {
+      if (o_mttkrp_t[i] == NULL) continue;
+      fused_mttkrp_block(i, i_X, i_dims, *io_factors_t, o_mttkrp_t[i]);
+    }
+    if (o_mttkrp_t[last] != NULL) {
+      MAT rows_t = arma::zeros<MAT>(o_mttkrp_t[last]->n_rows, len);
+      fused_mttkrp_block(last, i_X, i_dims, *io_factors_t, &rows_t);
+      o_mttkrp_t[last]->cols(i_start, i_start + len - 1) = rows_t;
+    }
+  }
+  /**
+   * mttkrps of all the modes with the non null outputs from a single
+   * traversal of the tensor, all with the current factors. The tensor is
+   * walked in slabs of the last mode that fit in the last level cache and
+   * every slab is used by all the modes before the next one is touched.
+   * Hence, the tensor is read from the memory once instead of once per
+   * mode as with fused_mttkrp.
+   * @param[in] i_tensor whose dimensions match the factors
+   * @param[out] o_mttkrp_t k x dimension[i] for the modes to compute
+   */
+  void mttkrp_all(const Tensor &i_tensor,
+                  const std::vector<MAT *> &o_mttkrp_t) const {
+    const UWORD kSlabBytes = 1 << 23;
+    const unsigned int last = this->m_modes - 1;
+    std::vector<MAT> factors_t(this->m_modes);
+    for (unsigned int i = 0; i < last; i++) {
+      factors_t[i] = ncp_factors[i].t();
+    }
+    MAT last_factor_t = ncp_factors[last].t();
+    for (unsigned int i = 0; i < this->m_modes; i++) {
+      if (o_mttkrp_t[i] != NULL) o_mttkrp_t[i]->zeros();
+    }
+    const UWORD dimlast = i_tensor.dimension(last);
+    const UWORD slice_numel = i_tensor.numel() / dimlast;
+    const UWORD slab_len = std::max(
+        static_cast<UWORD>(1), kSlabBytes / (sizeof(double) * slice_numel));
+    UVEC dims = i_tensor.dimensions();
+    for (UWORD start = 0; start < dimlast; start += slab_len) {
+      dims[last] = std::min(slab_len, dimlast - start);
+      slab_mttkrp(&i_tensor.m_data[0] + start * slice_numel, dims, start,
+                  last_factor_t, &factors_t, o_mttkrp_t);
+    }
+  }
+  /**
+   * KRP of the given vector of modes. It can be any subset of the modes.
+   * As krp_leave_out_one, the krp is in reverse, i.e. the first of the
+   * given modes varies fastest.
+   * @param[in] Subset of modes
+   * @param[out] KRP of product of dimensions of the given modes by k
+   */
+  void krp(const UVEC i_modes, MAT *o_krp) const {
+    std::vector<unsigned int> modes(i_modes.begin(), i_modes.end());
+    krp_modes(modes, o_krp);
+  }
 
   // caller must free
   // Tensor rankk_tensor() {
@@ -336,6 +587,7 @@ current_nrows *= rightkrp.n_rows;
         m_lambda(j) *= colNorm;
       }
     }
+    invalidate_grams();
   }
   // replaces the existing lambdas
   /**
@@ -348,6 +600,7 @@ current_nrows *= rightkrp.n_rows;
       m_lambda(i) = arma::norm(this->ncp_factors[mode].col(i));
       if (m_lambda(i) > 0) this->ncp_factors[mode].col(i) /= m_lambda(i);
     }
+    m_gram_valid[mode] = false;
   }
   // replaces the existing lambdas
   /**
@@ -360,6 +613,7 @@ current_nrows *= rightkrp.n_rows;
       m_lambda(i) = arma::norm(this->ncp_factors[mode].row(i));
       if (m_lambda(i) > 0) this->ncp_factors[mode].row(i) /= m_lambda(i);
     }
+    m_gram_valid[mode] = false;
   }
 
   /**
@@ -377,12 +631,14 @@ current_nrows *= rightkrp.n_rows;
         ncp_factors[i].zeros();
       }
     }
+    invalidate_grams();
   }
   /// this is for reinitializing zeros across different processors.
   void zeros() {
     for (unsigned int i = 0; i < this->m_modes; i++) {
       ncp_factors[i].zeros();
     }
+    invalidate_grams();
   }
 #ifdef MPI_DISTNTF
   // Distribution normalization of factor matrices
@@ -405,6 +661,7 @@ current_nrows *= rightkrp.n_rows;
         m_lambda(j) *= global_colnorm;
       }
     }
+    invalidate_grams();
   }
   /**
    * Distributed column normalize of a given mode
@@ -423,6 +680,7 @@ current_nrows *= rightkrp.n_rows;
       if (global_colnorm > 0) this->ncp_factors[mode].col(j) /= global_colnorm;
       m_lambda(j) = global_colnorm;
     }
+    m_gram_valid[mode] = false;
   }
   /**
    * Distributed row normalize of a given mode
@@ -441,6 +699,7 @@ current_nrows *= rightkrp.n_rows;
       if (global_rownorm > 0) this->ncp_factors[mode].row(j) /= global_rownorm;
       m_lambda(j) = global_rownorm;
     }
+    m_gram_valid[mode] = false;
   }
 #endif
 };  // NCPFactors
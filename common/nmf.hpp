@@ -2,7 +2,9 @@
 #ifndef COMMON_NMF_HPP_
 #define COMMON_NMF_HPP_
 #include <assert.h>
+#include <algorithm>
 #include <string>
+#include "common/stopcriterion.hpp"
 #include "common/utils.hpp"
 
 // #ifndef _VERBOSE
@@ -45,6 +47,27 @@ class NMF {
   /// L2 regularization values and the second is L1 regularization.
   FVEC m_regW;
   FVEC m_regH;
+  /// convergence based stopping. Default runs all the iterations.
+  StopCriterion m_stop;
+
+  /**
+   * Evaluates the stopping criterion at the end of an iteration
+   * that was started with m_stop.start(). Call it after the
+   * objective error of the iteration is computed.
+   * @param[in] iteration for logging
+   * @return true if the iterations can stop
+   */
+  bool converged(int iteration) {
+    this->m_stop.add_factor(0, this->W);
+    this->m_stop.add_factor(1, this->H);
+    bool done =
+        this->m_stop.converged(sqrt(this->objective_err) / this->normA);
+    if (done) {
+      INFO << "converged at it=" << iteration << " " << this->m_stop.name()
+           << "=" << this->m_stop.measure() << std::endl;
+    }
+    return done;
+  }
 
   void collectStats(int iteration) {
     this->normW = arma::norm(this->W, "fro");
@@ -179,61 +202,9 @@ class NMF {
    ||WH||_F^2 - over all nnz (w_i h_j)^2
    *
    */
-#if 0
-    void computeObjectiveError() {
-        // 1. over all nnz (a_ij - w_i h_j)^2
-        // 2. over all nnz (w_i h_j)^2
-        // 3. Compute R of W ahd L of H through QR
-        // 4. use sgemm to compute RL
-        // 5. use slange to compute ||RL||_F^2
-        // 6. return nnzsse+nnzwh-||RL||_F^2
-        tic();
-        float nnzsse = 0;
-        float nnzwh  = 0;
-        MAT  Rw(this->k, this->k);
-        MAT  Rh(this->k, this->k);
-        MAT  Qw(this->m, this->k);
-        MAT  Qh(this->n, this->k);
-        MAT  RwRh(this->k, this->k);
-
-        // #pragma omp parallel for reduction (+ : nnzsse,nnzwh)
-        for (UWORD jj = 1; jj <= this->A.n_cols; jj++) {
-            UWORD startIdx  = this->A.col_ptrs[jj - 1];
-            UWORD endIdx    = this->A.col_ptrs[jj];
-            UWORD col       = jj - 1;
-            float nnzssecol = 0;
-            float nnzwhcol  = 0;
-
-            for (UWORD ii = startIdx; ii < endIdx; ii++) {
-                UWORD row     = this->A.row_indices[ii];
-                float tempsum = 0;
-
-                for (UWORD kk = 0; kk < k; kk++) {
-                    tempsum += (this->W(row, kk) * this->H(col, kk));
-                }
-                nnzwhcol  += tempsum * tempsum;
-                nnzssecol += (this->A.values[ii] - tempsum)
-                             * (this->A.values[ii] - tempsum);
-            }
-            nnzsse += nnzssecol;
-            nnzwh  += nnzwhcol;
-        }
-        qr_econ(Qw, Rw, this->W);
-        qr_econ(Qh, Rh, this->H);
-        RwRh = Rw * Rh.t();
-        float normWH = arma::norm(RwRh, "fro");
-        Rw.clear();
-        Rh.clear();
-        Qw.clear();
-        Qh.clear();
-        RwRh.clear();
-        INFO << "error compute time " << toc() << std::endl;
-        float fastErr = sqrt(nnzsse + (normWH * normWH - nnzwh));
-        this->objective_err = fastErr;
-
-        // return (fastErr);
-    }
-
+#ifdef BUILD_SPARSE
+  /// For sparse A the error is computed over the nonzeros only.
+  void computeObjectiveError() { computeObjectiveErrorNNZ(); }
 #else  // ifdef BUILD_SPARSE
   void computeObjectiveError() {
     // (init.norm_A)^2 - 2*trace(H'*(A'*W))+trace((W'*W)*(H*H'))
@@ -327,6 +298,80 @@ class NMF {
   }
 
 #endif  // ifdef BUILD_SPARSE
+  /**
+   * Objective error of a sparse A over its nonzeros.
+   * ||A-WH^T||_F^2 = over all nnz (a_ij - w_i h_j)^2 +
+   *                  ||WH^T||_F^2 - over all nnz (w_i h_j)^2
+   * with ||WH^T||_F^2 = tr((W^TW)(H^TH)). It costs O(nnz k + (m+n)k^2)
+   * and unlike the gram based error below it does not subtract from
+   * ||A||_F^2, so it stays accurate at small relative errors.
+   * Only to be called for sparse T.
+   */
+  void computeObjectiveErrorNNZ() {
+    tic();
+    MAT Wt = this->W.t();
+    MAT Ht = this->H.t();
+    MAT WtW = Wt * this->W;
+    MAT HtH = Ht * this->H;
+    double nnzsse = 0;
+    double nnzwh = 0;
+    const UWORD lowrank = this->k;
+#pragma omp parallel for reduction(+ : nnzsse, nnzwh) schedule(dynamic, 64)
+    for (UWORD col = 0; col < this->A.n_cols; col++) {
+      const double *hcol = Ht.colptr(col);
+      for (UWORD ii = this->A.col_ptrs[col]; ii < this->A.col_ptrs[col + 1];
+           ii++) {
+        const double *wrow = Wt.colptr(this->A.row_indices[ii]);
+        double wh = 0;
+        for (UWORD kk = 0; kk < lowrank; kk++) wh += wrow[kk] * hcol[kk];
+        double diff = this->A.values[ii] - wh;
+        nnzwh += wh * wh;
+        nnzsse += diff * diff;
+      }
+    }
+    double normWH = arma::accu(WtW % HtH);
+    this->objective_err = nnzsse + normWH - nnzwh;
+    INFO << "error compute time " << toc() << std::endl;
+  }
+  /**
+   * Gram based objective error that reuses the products of the W update.
+   * ||A-WH^T||_F^2 = ||A||_F^2 - 2 tr(W^T(AH)) + tr((W^TW)(H^TH))
+   * Only W^TW is computed, which costs O(mk^2) instead of the O(mnk) of
+   * rebuilding WH^T. Call with the current W and the AH and HtH of the
+   * current H. With BUILD_SPARSE the error is computed over the nonzeros
+   * by computeObjectiveErrorNNZ instead.
+   * @param[in] AH is mxk
+   * @param[in] HtH is kxk
+   */
+  void computeObjectiveErrorFromAH(const MAT &AH, const MAT &HtH) {
+#ifdef BUILD_SPARSE
+    computeObjectiveErrorNNZ();
+#else
+    MAT WtW = this->W.t() * this->W;
+    double sqnormA = this->normA * this->normA;
+    double TrWtAH = arma::accu(this->W % AH);
+    double TrWtWHtH = arma::accu(WtW % HtH);
+    // cancellation can make it slightly negative at convergence
+    this->objective_err = std::max(sqnormA - (2 * TrWtAH) + TrWtWHtH, 0.0);
+#endif  // ifdef BUILD_SPARSE
+  }
+  /**
+   * Same as computeObjectiveErrorFromAH with the products of the H
+   * update. Call with the current H and the WtA and WtW of the current W.
+   * @param[in] WtA is kxn
+   * @param[in] WtW is kxk
+   */
+  void computeObjectiveErrorFromWtA(const MAT &WtA, const MAT &WtW) {
+#ifdef BUILD_SPARSE
+    computeObjectiveErrorNNZ();
+#else
+    MAT HtH = this->H.t() * this->H;
+    double sqnormA = this->normA * this->normA;
+    double TrWtAH = arma::accu(WtA % this->H.t());
+    double TrWtWHtH = arma::accu(WtW % HtH);
+    this->objective_err = std::max(sqnormA - (2 * TrWtAH) + TrWtWHtH, 0.0);
+#endif  // ifdef BUILD_SPARSE
+  }
   void computeObjectiveError(const T &At, const MAT &WtW, const MAT &HtH) {
     MAT AtW = At * this->W;
 
@@ -338,6 +383,8 @@ class NMF {
   }
   /// Sets number of iterations for the NMF algorithms
   void num_iterations(const int it) { this->m_num_iterations = it; }
+  /// Sets the convergence based stopping criterion
+  void stop_criterion(const StopCriterion &stop) { this->m_stop = stop; }
   /// Sets the regularization on left low rank factor W
   void regW(const FVEC &iregW) { this->m_regW = iregW; }
   /// Sets the regularization on right low rank H
@@ -88,7 +88,7 @@ class NumPyArray {
     parse_npy_header(fp);
     this->m_input_tensor = new Tensor(this->m_dims);
     int64_t nread = fread(&m_input_tensor->m_data[0],
-                          sizeof(std::vector<double>::value_type),
+                          sizeof(double),
                           m_input_tensor->numel(), fp);
     if (nread != m_input_tensor->numel()) {
       WARN << "something wrong ::read::" << nread
@@ -0,0 +1,206 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef COMMON_OOCTENSOR_HPP_
+#define COMMON_OOCTENSOR_HPP_
+
+#include <armadillo>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/ncpfactors.hpp"
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * A dense tensor that stays on disk and is streamed through memory in
+ * slabs. The file is the one written by Tensor::write: the
+ * binary elements with the .info file next to it. In that layout the
+ * last mode varies slowest, so a slab is a contiguous range of indices
+ * of the last mode and every slab is one sequential read.
+ *
+ * Two slab buffers are used. While the mttkrps consume one slab, a
+ * background thread reads the next one into the other buffer. The
+ * resident memory is two slabs regardless of the size of the tensor.
+ *
+ * For a slab with the indices [s, s + len) of the last mode, the mttkrp
+ * of every other mode is a partial sum over the slab and the mttkrp of
+ * the last mode is complete for the rows [s, s + len).
+ */
+class OutOfCoreTensor {
+ private:
+  std::string m_filename;
+  int m_modes;
+  UVEC m_dimensions;
+  UWORD m_numel;
+  // elements of one index of the last mode
+  UWORD m_slice_numel;
+  // indices of the last mode per slab
+  UWORD m_slab_len;
+  // squared frobenius norm. negative until the first pass.
+  double m_norm;
+  std::vector<double> m_buffers[2];
+
+  void read_info() {
+    std::string filename_no_extension =
+        m_filename.substr(0, m_filename.find_last_of("."));
+    filename_no_extension.append(".info");
+    std::ifstream ifs;
+    ifs.open(filename_no_extension, std::ios_base::in);
+    ifs >> this->m_modes;
+    if (!ifs || this->m_modes < 1) {
+      ERR << "unable to read the out of core tensor info::"
+          << filename_no_extension << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    this->m_dimensions = arma::zeros<UVEC>(this->m_modes);
+    for (int i = 0; i < this->m_modes; i++) {
+      ifs >> this->m_dimensions[i];
+    }
+    if (!ifs) {
+      ERR << "unable to read the dimensions::" << filename_no_extension
+          << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    ifs.close();
+    this->m_numel = arma::prod(this->m_dimensions);
+  }
+
+  UWORD num_slabs() const {
+    UWORD last = m_dimensions[m_modes - 1];
+    return (last + m_slab_len - 1) / m_slab_len;
+  }
+  UWORD slab_start(UWORD i) const { return i * m_slab_len; }
+  UWORD slab_len(UWORD i) const {
+    return std::min(m_slab_len, m_dimensions[m_modes - 1] - slab_start(i));
+  }
+
+  static void read_slab(FILE *fp, UWORD numel, double *out, bool *ok) {
+    *ok = (fp != NULL) && (fread(out, sizeof(double), numel, fp) == numel);
+  }
+
+ public:
+  /**
+   * Reads the dimensions from the .info file and sizes the slabs.
+   * @param[in] i_filename binary file written by Tensor::write
+   * @param[in] i_buffer_bytes memory for the two slab buffers. Every slab
+   *            has atleast one index of the last mode.
+   */
+  OutOfCoreTensor(const std::string &i_filename, UWORD i_buffer_bytes)
+      : m_filename(i_filename), m_norm(-1) {
+    read_info();
+    m_slice_numel = m_numel / m_dimensions[m_modes - 1];
+    UWORD slab_numel = i_buffer_bytes / (2 * sizeof(double));
+    m_slab_len = std::max(static_cast<UWORD>(1), slab_numel / m_slice_numel);
+    m_slab_len = std::min(m_slab_len, m_dimensions[m_modes - 1]);
+    INFO << "out of core tensor::" << m_filename << "::dims::"
+         << m_dimensions.t() << "::slabs::" << num_slabs()
+         << "::slab words::" << m_slab_len * m_slice_numel << std::endl;
+  }
+  int modes() const { return m_modes; }
+  UVEC dimensions() const { return m_dimensions; }
+  UWORD numel() const { return m_numel; }
+  /// words of the two resident slab buffers
+  UWORD buffer_words() const { return 2 * m_slab_len * m_slice_numel; }
+
+  /**
+   * Streams the whole tensor once. visit(X, dims, start) is called for
+   * every slab in order, where X holds the elements of the slab in the
+   * layout of Tensor, dims are the dimensions of the slab and start is
+   * its first index of the last mode. The next slab is read while visit
+   * runs. A file that cannot be opened or a short read is fatal, as a
+   * partial pass would give wrong mttkrps with no sign of it.
+   */
+  template <class Visitor>
+  void stream(Visitor visit) {
+    UWORD slab_numel = m_slab_len * m_slice_numel;
+    for (int b = 0; b < 2; b++) {
+      if (m_buffers[b].size() != slab_numel) m_buffers[b].resize(slab_numel);
+    }
+    FILE *fp = fopen(m_filename.c_str(), "rb");
+    if (fp == NULL) {
+      ERR << "unable to open the out of core tensor::" << m_filename
+          << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    UWORD nslabs = num_slabs();
+    bool ok[2];
+    read_slab(fp, slab_len(0) * m_slice_numel, &m_buffers[0][0], &ok[0]);
+    for (UWORD i = 0; i < nslabs; i++) {
+      int cur = i % 2;
+      std::thread reader;
+      if (i + 1 < nslabs) {
+        reader = std::thread(read_slab, fp, slab_len(i + 1) * m_slice_numel,
+                             &m_buffers[1 - cur][0], &ok[1 - cur]);
+      }
+      if (!ok[cur]) {
+        if (reader.joinable()) reader.join();
+        fclose(fp);
+        ERR << "short read::slab::" << i << "::of::" << m_filename
+            << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      UVEC dims = m_dimensions;
+      dims[m_modes - 1] = slab_len(i);
+      visit(&m_buffers[cur][0], dims, slab_start(i));
+      if (reader.joinable()) reader.join();
+    }
+    fclose(fp);
+  }
+
+  /// squared frobenius norm as Tensor::norm. One pass the first time.
+  double norm() {
+    if (m_norm < 0) {
+      double norm_fro = 0;
+      stream([&](const double *X, const UVEC &dims, UWORD) {
+        UWORD n = arma::prod(dims);
+#pragma omp parallel for reduction(+ : norm_fro)
+        for (UWORD i = 0; i < n; i++) norm_fro += X[i] * X[i];
+      });
+      m_norm = norm_fro;
+    }
+    return m_norm;
+  }
+
+  /**
+   * mttkrp of the mode i_n with one pass over the tensor.
+   * @param[in] i_n mode
+   * @param[in] i_factors whose dimensions match the tensor
+   * @param[out] o_mttkrp_t of size k x dimension[i_n]
+   */
+  void mttkrp(const int i_n, const NCPFactors &i_factors, MAT *o_mttkrp_t) {
+    std::vector<MAT *> out(m_modes, static_cast<MAT *>(NULL));
+    out[i_n] = o_mttkrp_t;
+    mttkrp(i_factors, out);
+  }
+  /**
+   * mttkrps of all the modes with the non null outputs from a single pass
+   * over the tensor. Every mttkrp uses the same i_factors. Every slab is
+   * read once and used by all the requested modes.
+   * @param[in] i_factors whose dimensions match the tensor
+   * @param[out] o_mttkrp_t k x dimension[i] for the modes to compute
+   */
+  void mttkrp(const NCPFactors &i_factors, const std::vector<MAT *> &o_mttkrp_t) {
+    int last = m_modes - 1;
+    std::vector<MAT> factors_t(m_modes);
+    MAT last_factor_t = i_factors.factor(last).t();
+    for (int i = 0; i < last; i++) {
+      factors_t[i] = i_factors.factor(i).t();
+    }
+    for (int i = 0; i < m_modes; i++) {
+      if (o_mttkrp_t[i] != NULL) o_mttkrp_t[i]->zeros();
+    }
+    stream([&](const double *X, const UVEC &dims, UWORD start) {
+      NCPFactors::slab_mttkrp(X, dims, start, last_factor_t, &factors_t,
+                              o_mttkrp_t);
+    });
+  }
+};  // class OutOfCoreTensor
+
+}  // namespace planc
+
+#endif  // COMMON_OOCTENSOR_HPP_
@@ -20,6 +20,16 @@
 #define NUMKBLOCKS 2004
 #define NORMALIZATION 2005
 #define DIMTREE 2006
+#define MMAPINPUT 2007
+#define STOPCRITERION 2008
+#define STOPTOL 2009
+#define CHECKEVERY 2010
+#define PROCLAYERS 2011
+#define CHECKPOINT 2012
+#define CHECKPOINTEVERY 2013
+#define RESTART 2014
+#define OUTOFCORE 2015
+#define JACOBI 2016
 
 // enum factorizationtype{FT_NMF, FT_DISTNMF, FT_NTF, FT_DISTNTF};
 
@@ -83,6 +93,16 @@ struct option plancopts[] = {
     {"numkblocks", optional_argument, 0, NUMKBLOCKS},
     {"normalization", optional_argument, 0, NORMALIZATION},
     {"dimtree", optional_argument, 0, DIMTREE},
+    {"mmap", optional_argument, 0, MMAPINPUT},
+    {"stop", optional_argument, 0, STOPCRITERION},
+    {"tol", optional_argument, 0, STOPTOL},
+    {"checkevery", optional_argument, 0, CHECKEVERY},
+    {"pk", optional_argument, 0, PROCLAYERS},
+    {"checkpoint", optional_argument, 0, CHECKPOINT},
+    {"checkpointevery", optional_argument, 0, CHECKPOINTEVERY},
+    {"restart", no_argument, 0, RESTART},
+    {"outofcore", optional_argument, 0, OUTOFCORE},
+    {"jacobi", no_argument, 0, JACOBI},
     {0, 0, 0, 0}};
 
 #endif  // COMMON_PARSECOMMANDLINE_H_
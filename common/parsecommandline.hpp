@@ -9,6 +9,7 @@
 #include <sstream>
 #include <string>
 #include "common/parsecommandline.h"
+#include "common/stopcriterion.hpp"
 
 namespace planc {
 class ParseCommandLine {
@@ -23,6 +24,21 @@ class ParseCommandLine {
   int m_num_it;
   int m_num_k_blocks;
   bool m_dim_tree;
+  int m_mmap_input;
+  // MB of slab buffers to stream the tensor from disk. 0 reads it all.
+  int m_out_of_core;
+  // ntf sweeps update all the modes from the same factors
+  bool m_jacobi;
+
+  // convergence based stopping
+  stoptype m_stop_type;
+  double m_stop_tol;
+  int m_check_every;
+
+  // checkpoint/restart
+  std::string m_checkpoint_prefix;
+  int m_checkpoint_every;
+  bool m_restart;
 
   // file names
   std::string m_Afile_name;
@@ -42,6 +58,9 @@ class ParseCommandLine {
   // distnmf related values
   int m_pr;
   int m_pc;
+  int m_pk;
+  // -p not given. The driver picks the grid.
+  bool m_auto_grid;
 
   // dist ntf
   int m_num_modes;
@@ -93,6 +112,10 @@ class ParseCommandLine {
     this->m_num_modes = 0;
     this->m_pr = 1;
     this->m_pc = 1;
+    this->m_pk = 1;
+    this->m_auto_grid = true;
+    this->m_globalm = 0;
+    this->m_globaln = 0;
     this->m_regW = arma::zeros<FVEC>(2);
     this->m_regH = arma::zeros<FVEC>(2);
     this->m_num_k_blocks = 1;
@@ -102,6 +125,14 @@ class ParseCommandLine {
     this->m_compute_error = 0;
     this->m_input_normalization = NONE;
     this->m_dim_tree = 1;
+    this->m_mmap_input = 0;
+    this->m_out_of_core = 0;
+    this->m_jacobi = false;
+    this->m_stop_type = STOP_RELERR;
+    this->m_stop_tol = 0;
+    this->m_check_every = 1;
+    this->m_checkpoint_every = 10;
+    this->m_restart = false;
   }
   /// parses the command line parameters
   void parseplancopts() {
@@ -131,7 +162,10 @@ class ParseCommandLine {
         }
         case 'd':
         case 'r':
+          parseArrayofString(opt, optarg);
+          break;
         case 'p':
+          this->m_auto_grid = false;
           parseArrayofString(opt, optarg);
           break;
         case 's':
@@ -155,6 +189,38 @@ class ParseCommandLine {
         case DIMTREE:
           this->m_dim_tree = atoi(optarg);
           break;
+        case MMAPINPUT:
+          this->m_mmap_input = atoi(optarg);
+          break;
+        case OUTOFCORE:
+          this->m_out_of_core = atoi(optarg);
+          break;
+        case JACOBI:
+          this->m_jacobi = true;
+          break;
+        case STOPCRITERION: {
+          std::string temp = std::string(optarg);
+          this->m_stop_type = StopCriterion::parse(temp);
+          break;
+        }
+        case STOPTOL:
+          this->m_stop_tol = atof(optarg);
+          break;
+        case CHECKEVERY:
+          this->m_check_every = atoi(optarg);
+          break;
+        case PROCLAYERS:
+          this->m_pk = atoi(optarg);
+          break;
+        case CHECKPOINT:
+          this->m_checkpoint_prefix = std::string(optarg);
+          break;
+        case CHECKPOINTEVERY:
+          this->m_checkpoint_every = atoi(optarg);
+          break;
+        case RESTART:
+          this->m_restart = true;
+          break;
         default:
           std::cout << "failed while processing argument:" << optarg
                     << std::endl;
@@ -182,7 +248,7 @@ class ParseCommandLine {
               << "::k::" << this->m_k << "::m::" << this->m_globalm
               << "::n::" << this->m_globaln << "::t::" << this->m_num_it
               << "::pr::" << this->m_pr << "::pc::" << this->m_pc
-              << "::error::" << this->m_compute_error << "::regW::"
+              << "::pk::" << this->m_pk << "::error::" << this->m_compute_error << "::regW::"
               << "l2::" << this->m_regW(0) << "::l1::" << this->m_regW(1)
               << "::regH::"
               << "l2::" << this->m_regH(0) << "::l1::" << this->m_regH(1)
@@ -191,7 +257,16 @@ class ParseCommandLine {
               << "::procs::" << this->m_proc_grids
               << "::regularizers::" << this->m_regularizers
               << "::input normalization::" << this->m_input_normalization
-              << "::dimtree::" << this->m_dim_tree << std::endl;
+              << "::dimtree::" << this->m_dim_tree
+              << "::mmap::" << this->m_mmap_input
+              << "::outofcore::" << this->m_out_of_core
+              << "::jacobi::" << this->m_jacobi
+              << "::stop::" << stop_criterion().name()
+              << "::tol::" << this->m_stop_tol
+              << "::checkevery::" << this->m_check_every
+              << "::checkpoint::" << this->m_checkpoint_prefix
+              << "::checkpointevery::" << this->m_checkpoint_every
+              << "::restart::" << this->m_restart << std::endl;
   }
 
   void print_usage() {
@@ -223,6 +298,17 @@ class ParseCommandLine {
     INFO << "Usage 4: mpirun -np 6 distnmf -a 0/1/2/3 -k 50 --dimtree 1"
          << "-i Ainput -o nmfoutput -t 10 -p \"3 2\" --sparsity=0.3"
          << "-r \"0.0001 0 0 0.0001\" " << std::endl;
+    // stop before -t iterations once converged
+    INFO << "Usage 5: mpirun -np 6 distnmf -a 0/1/2/3 -k 50 -i Ainput "
+         << "-t 1000 -p \"3 2\" --stop=relerr --tol=1e-5 --checkevery=5"
+         << std::endl;
+    // 3 x 2 x 2 grid. every layer works on k/2.
+    INFO << "Usage 6: mpirun -np 12 distnmf -a 0/1/2/3 -k 50 -i Ainput "
+         << "-t 10 -p \"3 2\" --pk 2" << std::endl;
+    // checkpoint every 50 iterations. rerun with --restart to continue.
+    INFO << "Usage 7: mpirun -np 6 distnmf -a 0/1/2/3 -k 50 -i Ainput "
+         << "-t 1000 -p \"3 2\" --checkpoint=ckpt/run1 --checkpointevery=50 "
+         << "[--restart]" << std::endl;
   }
   /// returns the low rank. Passed as parameter --lowrank or -k
   UWORD lowrankk() { return m_k; }
@@ -284,6 +370,16 @@ class ParseCommandLine {
    * Used for distributed NMF. The second parameter of -p. 
    */
   int pc() { return m_pc; }
+  /**
+   * Returns the number of layers of the pr x pc x pk grid of distributed
+   * NMF. Every layer works on k/pk of the rank. Passed as --pk
+   */
+  int pk() { return m_pk; }
+  /**
+   * True if -p was not passed. The distributed drivers then pick the
+   * processor grid with planc::best_processor_grid.
+   */
+  bool auto_grid() { return m_auto_grid; }
   /// Returns number of modes in tensors. For matrix it is two. 
   int num_modes() { return m_num_modes; }
   /**
@@ -291,6 +387,41 @@ class ParseCommandLine {
    * for more than three modes. Passed as parameter --dimtree 1
    */
   bool dim_tree() { return m_dim_tree; }
+  /**
+   * How the input tensor file is loaded. 0 - read into memory,
+   * 1 - map the file, 2 - map the file and prefault all pages.
+   * Passed as parameter --mmap 1
+   */
+  int mmap_input() { return m_mmap_input; }
+  /**
+   * MB of memory for the slabs of a tensor streamed from disk instead of
+   * being read. 0 if the tensor is read into memory.
+   * Passed as parameter --outofcore 1024
+   */
+  int out_of_core() { return m_out_of_core; }
+  /**
+   * Jacobi sweeps for ntf. The mttkrps of all the modes come from one
+   * pass over the tensor. Passed as parameter --jacobi
+   */
+  bool jacobi() { return m_jacobi; }
+  /**
+   * Returns the convergence based stopping criterion. Passed as
+   * --stop relerr/pgrad/factor, --tol for the tolerance and
+   * --checkevery for the number of iterations between the checks.
+   * Default is relerr. Without --tol all the -t iterations are run.
+   */
+  StopCriterion stop_criterion() {
+    return StopCriterion(m_stop_type, m_stop_tol, m_check_every);
+  }
+  /**
+   * Returns the prefix of the per rank checkpoint files. Passed as
+   * --checkpoint. Empty if the checkpoints are off.
+   */
+  std::string checkpoint_prefix() { return m_checkpoint_prefix; }
+  /// Iterations between two checkpoints. Passed as --checkpointevery
+  int checkpoint_every() { return m_checkpoint_every; }
+  /// Continue from the last checkpoint. Passed as --restart
+  bool restart() { return m_restart; }
   /// Returns whether to compute error not. Passed as parameter -e or --error
   bool compute_error() { return m_compute_error; }
   /// To column normalize the input matrix.
@@ -0,0 +1,357 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef COMMON_SPMATIO_HPP_
+#define COMMON_SPMATIO_HPP_
+
+#include <fcntl.h>
+#include <omp.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Loaders for the per process sparse blocks. Two formats are understood.
+ *
+ * Text : one "row col value" triplet per line with zero based indices.
+ *        This is the same as arma::coord_ascii and the raw ascii ijv
+ *        files. Lines starting with % or # are ignored. The file is
+ *        parsed in parallel chunks and the CSC is built directly.
+ *
+ * Binary CSC : all integers are uint64 and values are double.
+ *        char[8] "PLANCCSC"
+ *        n_rows, n_cols, nnz
+ *        col_ptrs[n_cols + 1]
+ *        row_indices[nnz]
+ *        values[nnz]
+ *
+ * load_sp_mat detects the format from the leading magic.
+ */
+static const char kSpMatMagic[8] = {'P', 'L', 'A', 'N', 'C', 'C', 'S', 'C'};
+
+namespace spmatio_detail {
+
+/// Reads n uint64 from the file into UWORD irrespective of sizeof(UWORD)
+inline bool read_uwords(FILE *fp, UWORD n, UWORD *out) {
+  if (sizeof(UWORD) == sizeof(uint64_t)) {
+    return fread(out, sizeof(uint64_t), n, fp) == n;
+  }
+  const UWORD kBatch = 1 << 20;
+  std::vector<uint64_t> buf(std::min(n, kBatch));
+  for (UWORD i = 0; i < n; i += kBatch) {
+    UWORD cnt = std::min(kBatch, n - i);
+    if (fread(&buf[0], sizeof(uint64_t), cnt, fp) != cnt) return false;
+    for (UWORD j = 0; j < cnt; j++) out[i + j] = buf[j];
+  }
+  return true;
+}
+
+/// Writes n UWORD into the file as uint64
+inline bool write_uwords(FILE *fp, UWORD n, const UWORD *in) {
+  if (sizeof(UWORD) == sizeof(uint64_t)) {
+    return fwrite(in, sizeof(uint64_t), n, fp) == n;
+  }
+  const UWORD kBatch = 1 << 20;
+  std::vector<uint64_t> buf(std::min(n, kBatch));
+  for (UWORD i = 0; i < n; i += kBatch) {
+    UWORD cnt = std::min(kBatch, n - i);
+    for (UWORD j = 0; j < cnt; j++) buf[j] = in[i + j];
+    if (fwrite(&buf[0], sizeof(uint64_t), cnt, fp) != cnt) return false;
+  }
+  return true;
+}
+
+/**
+ * Parses the triplets in [begin, end). Every line is copied into a small
+ * null terminated buffer so that strtoull/strtod never run past the end
+ * of the mapping.
+ */
+inline void parse_triplets(const char *begin, const char *end,
+                           std::vector<UWORD> *rows, std::vector<UWORD> *cols,
+                           std::vector<double> *vals) {
+  char line[256];
+  std::string longline;
+  const char *p = begin;
+  while (p < end) {
+    const char *eol =
+        reinterpret_cast<const char *>(memchr(p, '\n', end - p));
+    if (eol == NULL) eol = end;
+    size_t len = eol - p;
+    const char *s;
+    if (len < sizeof(line)) {
+      memcpy(line, p, len);
+      line[len] = '\0';
+      s = line;
+    } else {
+      longline.assign(p, len);
+      s = longline.c_str();
+    }
+    p = eol + 1;
+    while (*s == ' ' || *s == '\t' || *s == '\r') s++;
+    if (*s == '\0' || *s == '%' || *s == '#') continue;
+    char *next;
+    UWORD i = strtoull(s, &next, 10);
+    if (next == s) continue;
+    s = next;
+    UWORD j = strtoull(s, &next, 10);
+    if (next == s) continue;
+    s = next;
+    double v = strtod(s, &next);
+    if (next == s) continue;
+    rows->push_back(i);
+    cols->push_back(j);
+    vals->push_back(v);
+  }
+}
+
+}  // namespace spmatio_detail
+
+/// Returns true if the file starts with the binary CSC magic
+inline bool is_sp_mat_bin(const std::string &filename) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) return false;
+  char magic[sizeof(kSpMatMagic)];
+  bool rc = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+            memcmp(magic, kSpMatMagic, sizeof(magic)) == 0;
+  fclose(fp);
+  return rc;
+}
+
+/**
+ * Saves the sparse matrix in the binary CSC format.
+ * @param[in] A sparse matrix
+ * @param[in] filename of the output file
+ * @return false on any I/O error
+ */
+inline bool save_sp_mat_bin(const SP_MAT &A, const std::string &filename) {
+  A.sync();
+  FILE *fp = fopen(filename.c_str(), "wb");
+  if (fp == NULL) {
+    ERR << "could not open " << filename << " for writing" << std::endl;
+    return false;
+  }
+  uint64_t header[3] = {A.n_rows, A.n_cols, A.n_nonzero};
+  bool rc = fwrite(kSpMatMagic, 1, sizeof(kSpMatMagic), fp) ==
+                sizeof(kSpMatMagic) &&
+            fwrite(header, sizeof(uint64_t), 3, fp) == 3 &&
+            spmatio_detail::write_uwords(fp, A.n_cols + 1, A.col_ptrs) &&
+            spmatio_detail::write_uwords(fp, A.n_nonzero, A.row_indices) &&
+            fwrite(A.values, sizeof(double), A.n_nonzero, fp) == A.n_nonzero;
+  rc = (fclose(fp) == 0) && rc;
+  if (!rc) ERR << "write of " << filename << " failed" << std::endl;
+  return rc;
+}
+
+/**
+ * Loads a sparse matrix saved with save_sp_mat_bin. The arrays are read
+ * straight into the CSC vectors handed to the armadillo constructor.
+ * @param[in] filename of the binary CSC file
+ * @param[out] A sparse matrix
+ * @return false if the file is missing, not binary CSC or truncated
+ */
+inline bool load_sp_mat_bin(const std::string &filename, SP_MAT *A) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) {
+    ERR << "could not open " << filename << std::endl;
+    return false;
+  }
+  char magic[sizeof(kSpMatMagic)];
+  uint64_t header[3];
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      memcmp(magic, kSpMatMagic, sizeof(magic)) != 0 ||
+      fread(header, sizeof(uint64_t), 3, fp) != 3) {
+    ERR << filename << " is not a binary CSC file" << std::endl;
+    fclose(fp);
+    return false;
+  }
+  UWORD n_rows = header[0];
+  UWORD n_cols = header[1];
+  UWORD nnz = header[2];
+  UVEC colptr(n_cols + 1);
+  UVEC rowind(nnz);
+  VEC values(nnz);
+  bool rc = spmatio_detail::read_uwords(fp, n_cols + 1, colptr.memptr()) &&
+            spmatio_detail::read_uwords(fp, nnz, rowind.memptr()) &&
+            fread(values.memptr(), sizeof(double), nnz, fp) == nnz;
+  fclose(fp);
+  if (!rc || colptr[n_cols] != nnz) {
+    ERR << filename << " is truncated" << std::endl;
+    return false;
+  }
+  *A = SP_MAT(rowind, colptr, values, n_rows, n_cols);
+  return true;
+}
+
+/**
+ * Parses a "row col value" text file into a sparse matrix. The file is
+ * mapped and split into one chunk per OpenMP thread at line boundaries.
+ * Every thread parses its own chunk, the triplets are bucketed into the
+ * columns and every column is sorted by row in parallel. Duplicate
+ * entries are summed. The dimensions are the largest indices plus one.
+ * An empty file results in an empty 1x1 matrix.
+ * @param[in] filename of the text file
+ * @param[out] A sparse matrix
+ * @return false if the file cannot be opened or mapped
+ */
+inline bool load_sp_mat_text(const std::string &filename, SP_MAT *A) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ERR << "could not open " << filename << std::endl;
+    return false;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    close(fd);
+    return false;
+  }
+  size_t nbytes = sb.st_size;
+  const char *text = NULL;
+  if (nbytes > 0) {
+    void *addr = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      ERR << "mmap of " << filename << " failed" << std::endl;
+      close(fd);
+      return false;
+    }
+    madvise(addr, nbytes, MADV_SEQUENTIAL);
+    text = reinterpret_cast<const char *>(addr);
+  }
+  close(fd);
+
+  // split at line boundaries
+  int nthreads = omp_get_max_threads();
+  std::vector<size_t> bounds(nthreads + 1, nbytes);
+  bounds[0] = 0;
+  for (int t = 1; t < nthreads; t++) {
+    size_t pos = std::max(bounds[t - 1], nbytes / nthreads * t);
+    if (pos > 0 && pos < nbytes) {
+      const char *eol = reinterpret_cast<const char *>(
+          memchr(text + pos - 1, '\n', nbytes - pos + 1));
+      pos = (eol == NULL) ? nbytes : (eol - text) + 1;
+    }
+    bounds[t] = pos;
+  }
+  std::vector<std::vector<UWORD> > rows(nthreads), cols(nthreads);
+  std::vector<std::vector<double> > vals(nthreads);
+#pragma omp parallel num_threads(nthreads)
+  {
+    int t = omp_get_thread_num();
+    spmatio_detail::parse_triplets(text + bounds[t], text + bounds[t + 1],
+                                   &rows[t], &cols[t], &vals[t]);
+  }
+  if (text != NULL) munmap(const_cast<char *>(text), nbytes);
+
+  UWORD nnz = 0, n_rows = 0, n_cols = 0;
+  for (int t = 0; t < nthreads; t++) {
+    nnz += vals[t].size();
+    for (UWORD i = 0; i < rows[t].size(); i++) {
+      n_rows = std::max(n_rows, rows[t][i] + 1);
+      n_cols = std::max(n_cols, cols[t][i] + 1);
+    }
+  }
+  if (nnz == 0) {
+    *A = SP_MAT(1, 1);
+    return true;
+  }
+
+  // bucket the triplets into the columns
+  UVEC colptr = arma::zeros<UVEC>(n_cols + 1);
+  for (int t = 0; t < nthreads; t++) {
+    for (UWORD i = 0; i < cols[t].size(); i++) colptr[cols[t][i] + 1]++;
+  }
+  for (UWORD j = 0; j < n_cols; j++) colptr[j + 1] += colptr[j];
+  UVEC rowind(nnz);
+  VEC values(nnz);
+  {
+    UVEC next = colptr;
+    for (int t = 0; t < nthreads; t++) {
+      for (UWORD i = 0; i < cols[t].size(); i++) {
+        UWORD dst = next[cols[t][i]]++;
+        rowind[dst] = rows[t][i];
+        values[dst] = vals[t][i];
+      }
+      std::vector<UWORD>().swap(rows[t]);
+      std::vector<UWORD>().swap(cols[t]);
+      std::vector<double>().swap(vals[t]);
+    }
+  }
+
+  // sort every column by row and sum the duplicates
+  UVEC colnnz(n_cols);
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (UWORD j = 0; j < n_cols; j++) {
+    UWORD b = colptr[j], e = colptr[j + 1];
+    bool sorted = true;
+    for (UWORD i = b + 1; i < e && sorted; i++) {
+      sorted = rowind[i - 1] < rowind[i];
+    }
+    if (!sorted) {
+      std::vector<std::pair<UWORD, double> > entries(e - b);
+      for (UWORD i = b; i < e; i++) {
+        entries[i - b] = std::make_pair(rowind[i], values[i]);
+      }
+      std::sort(entries.begin(), entries.end());
+      UWORD last = b;
+      rowind[last] = entries[0].first;
+      values[last] = entries[0].second;
+      for (UWORD i = 1; i < entries.size(); i++) {
+        if (entries[i].first == rowind[last]) {
+          values[last] += entries[i].second;
+        } else {
+          last++;
+          rowind[last] = entries[i].first;
+          values[last] = entries[i].second;
+        }
+      }
+      colnnz[j] = (e > b) ? last - b + 1 : 0;
+    } else {
+      colnnz[j] = e - b;
+    }
+  }
+  // compact only if duplicates were merged
+  UWORD new_nnz = arma::accu(colnnz);
+  if (new_nnz != nnz) {
+    UWORD dst = 0;
+    for (UWORD j = 0; j < n_cols; j++) {
+      UWORD b = colptr[j];
+      colptr[j] = dst;
+      for (UWORD i = 0; i < colnnz[j]; i++, dst++) {
+        rowind[dst] = rowind[b + i];
+        values[dst] = values[b + i];
+      }
+    }
+    colptr[n_cols] = dst;
+    rowind.resize(new_nnz);
+    values.resize(new_nnz);
+  }
+  *A = SP_MAT(rowind, colptr, values, n_rows, n_cols);
+  return true;
+}
+
+/**
+ * Loads a per process sparse block either from the binary CSC format or
+ * from the "row col value" text format.
+ * @param[in] filename of the block
+ * @param[out] A sparse matrix
+ * @return false if the file cannot be loaded
+ */
+inline bool load_sp_mat(const std::string &filename, SP_MAT *A) {
+  if (is_sp_mat_bin(filename)) {
+    return load_sp_mat_bin(filename, A);
+  }
+  return load_sp_mat_text(filename, A);
+}
+
+}  // namespace planc
+
+#endif  // COMMON_SPMATIO_HPP_
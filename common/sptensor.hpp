@@ -0,0 +1,143 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef COMMON_SPTENSOR_HPP_
+#define COMMON_SPTENSOR_HPP_
+
+#include <omp.h>
+#include <armadillo>
+#include <utility>
+#include <vector>
+#include "common/ncpfactors.hpp"
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Sparse tensor in coordinate (COO) format with the local indices of
+ * every mode stored separately as 32 bit integers. For every mode n the
+ * nonzeros are additionally compressed by their mode n index.
+ * m_slice_ptr[n] of size I_n + 1 and m_slice_perm[n] of size nnz play
+ * the role of the column pointers and the row indices of a CSC. This is
+ * a single level CSF per mode that shares one copy of the indices and
+ * values. The mttkrp of a mode runs over its slices in parallel and a
+ * slice is written by one thread only, so no atomics or private copies
+ * of the output are needed.
+ */
+class SparseTensor {
+ private:
+  int m_modes;
+  UVEC m_dimensions;
+  UVEC m_global_idx;
+  UWORD m_nnz;
+  /// m_idx[n][e] is the local mode n index of the nonzero e
+  std::vector<std::vector<UINT> > m_idx;
+  std::vector<double> m_vals;
+  std::vector<std::vector<UWORD> > m_slice_ptr;
+  std::vector<std::vector<UINT> > m_slice_perm;
+  /// slices handed to a thread at a time
+  static const int kSliceChunk = 64;
+
+  /// counting sort of the nonzeros by the index of every mode
+  void compress() {
+    m_slice_ptr.assign(m_modes, std::vector<UWORD>());
+    m_slice_perm.assign(m_modes, std::vector<UINT>());
+    for (int n = 0; n < m_modes; n++) {
+      std::vector<UWORD> &ptr = m_slice_ptr[n];
+      std::vector<UINT> &perm = m_slice_perm[n];
+      ptr.assign(m_dimensions[n] + 1, 0);
+      for (UWORD e = 0; e < m_nnz; e++) ptr[m_idx[n][e] + 1]++;
+      for (UWORD i = 0; i < m_dimensions[n]; i++) ptr[i + 1] += ptr[i];
+      perm.resize(m_nnz);
+      std::vector<UWORD> next(ptr.begin(), ptr.end() - 1);
+      for (UWORD e = 0; e < m_nnz; e++) perm[next[m_idx[n][e]]++] = e;
+    }
+  }
+
+ public:
+  SparseTensor() : m_modes(0), m_nnz(0) {}
+  /**
+   * Takes over the nonzeros given in local indices.
+   * @param[in] i_dimensions local dimensions of every mode
+   * @param[in] i_start_idx global index of the first local index
+   * @param[in] i_idx local indices of every mode. Swapped out.
+   * @param[in] i_vals values of the nonzeros. Swapped out.
+   */
+  SparseTensor(const UVEC &i_dimensions, const UVEC &i_start_idx,
+               std::vector<std::vector<UINT> > *i_idx,
+               std::vector<double> *i_vals)
+      : m_modes(i_dimensions.n_rows),
+        m_dimensions(i_dimensions),
+        m_global_idx(i_start_idx),
+        m_nnz(i_vals->size()) {
+    m_idx.swap(*i_idx);
+    m_vals.swap(*i_vals);
+    compress();
+  }
+
+  /// Return the number of modes
+  int modes() const { return m_modes; }
+  /// Returns the local dimensions of every mode
+  UVEC dimensions() const { return m_dimensions; }
+  UVEC global_idx() const { return m_global_idx; }
+  /// Returns the number of nonzeros
+  UWORD nnz() const { return m_nnz; }
+  /// returns the squared frobenius norm as Tensor::norm
+  double norm() const {
+    double norm_fro = 0;
+#pragma omp parallel for reduction(+ : norm_fro)
+    for (UWORD e = 0; e < m_nnz; e++) norm_fro += m_vals[e] * m_vals[e];
+    return norm_fro;
+  }
+  /// Releases the nonzeros
+  void clear() {
+    m_nnz = 0;
+    std::vector<std::vector<UINT> >().swap(m_idx);
+    std::vector<double>().swap(m_vals);
+    std::vector<std::vector<UWORD> >().swap(m_slice_ptr);
+    std::vector<std::vector<UINT> >().swap(m_slice_perm);
+  }
+
+  /**
+   * Sparse mttkrp of the mode i_n. Every nonzero x(i_0,...,i_N-1) adds
+   * x * hadamard of the columns i_j of all the other transposed factors
+   * to the column i_n of the output.
+   * @param[in] i_n mode
+   * @param[in] i_factors_t k x I_j transposed factors of every mode
+   * @param[out] o_mttkrp_t k x I_n mttkrp
+   */
+  void mttkrp(const int i_n, const NCPFactors &i_factors_t,
+              MAT *o_mttkrp_t) const {
+    const int k = i_factors_t.rank();
+    o_mttkrp_t->zeros(k, m_dimensions[i_n]);
+    std::vector<const double *> factor(m_modes);
+    for (int j = 0; j < m_modes; j++) {
+      factor[j] = i_factors_t.factor(j).memptr();
+    }
+    const std::vector<UWORD> &ptr = m_slice_ptr[i_n];
+    const std::vector<UINT> &perm = m_slice_perm[i_n];
+    const UWORD nslices = m_dimensions[i_n];
+#pragma omp parallel
+    {
+      std::vector<double> had(k);
+#pragma omp for schedule(dynamic, kSliceChunk)
+      for (UWORD i = 0; i < nslices; i++) {
+        double *out = o_mttkrp_t->colptr(i);
+        for (UWORD s = ptr[i]; s < ptr[i + 1]; s++) {
+          UINT e = perm[s];
+          double val = m_vals[e];
+          for (int r = 0; r < k; r++) had[r] = val;
+          for (int j = 0; j < m_modes; j++) {
+            if (j == i_n) continue;
+            const double *f = factor[j] + static_cast<UWORD>(m_idx[j][e]) * k;
+            for (int r = 0; r < k; r++) had[r] *= f[r];
+          }
+          for (int r = 0; r < k; r++) out[r] += had[r];
+        }
+      }
+    }
+  }
+};
+
+}  // namespace planc
+
+#endif  // COMMON_SPTENSOR_HPP_
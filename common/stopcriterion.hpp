@@ -0,0 +1,185 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef COMMON_STOPCRITERION_HPP_
+#define COMMON_STOPCRITERION_HPP_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Convergence based stopping of the NMF/NTF iterations. The criterion
+ * is evaluated only at the end of every check_every-th iteration, so a
+ * check costs nothing in the other iterations.
+ *
+ * STOP_RELERR  - change of the relative error between two checks.
+ * STOP_PGRAD   - norm of the projected gradient relative to the one of
+ *                the first check. Every block adds the projected gradient
+ *                of its subproblem just before it is solved, using the
+ *                gram and the rhs the solver got anyway.
+ * STOP_FACTOR  - relative change of the factors since the last check.
+ * STOP_ITER    - run all the iterations. Default.
+ *
+ * Usage inside an iteration loop.
+ *   stop.start(it);
+ *   stop.add_pgrad(H, WtW, WtA, true);  // before every block solve
+ *   ...
+ *   stop.add_factor(0, W);              // end of the iteration
+ *   if (stop.converged(relerr)) break;
+ * In the distributed case the local sums() are allreduced before
+ * converged() whenever checking() is true.
+ */
+class StopCriterion {
+ private:
+  stoptype m_type;
+  double m_tol;
+  int m_check_every;
+  bool m_checking;
+  bool m_has_prev;
+  double m_prev;     // relative error of the last check
+  double m_ref;      // projected gradient norm of the first check
+  double m_measure;  // measured value of the last check
+  double m_sums[2];  // local sums of the current check
+  std::vector<MAT> m_snapshot;  // factors of the last check
+
+ public:
+  StopCriterion(stoptype i_type = STOP_ITER, double i_tol = 0,
+                int i_check_every = 1)
+      : m_type(i_type), m_tol(i_tol) {
+    this->m_check_every = (i_check_every > 0) ? i_check_every : 1;
+    reset();
+  }
+  /// Forgets all the previous checks
+  void reset() {
+    this->m_checking = false;
+    this->m_has_prev = false;
+    this->m_prev = 0;
+    this->m_ref = 0;
+    this->m_measure = 0;
+    this->m_sums[0] = 0;
+    this->m_sums[1] = 0;
+    this->m_snapshot.clear();
+  }
+  /// Returns the criterion from its command line name
+  static stoptype parse(const std::string &name) {
+    if (name.compare("relerr") == 0) return STOP_RELERR;
+    if (name.compare("pgrad") == 0) return STOP_PGRAD;
+    if (name.compare("factor") == 0) return STOP_FACTOR;
+    return STOP_ITER;
+  }
+  /// Returns the command line name of the criterion
+  const char *name() const {
+    switch (this->m_type) {
+      case STOP_RELERR:
+        return "relerr";
+      case STOP_PGRAD:
+        return "pgrad";
+      case STOP_FACTOR:
+        return "factor";
+      default:
+        return "iter";
+    }
+  }
+  stoptype type() const { return m_type; }
+  double tolerance() const { return m_tol; }
+  int check_every() const { return m_check_every; }
+  /// Returns the measured value of the last check
+  double measure() const { return m_measure; }
+  /// Returns false if all the iterations have to run
+  bool enabled() const { return m_type != STOP_ITER && m_tol > 0; }
+  /// Returns true if the relative error is needed by the check
+  bool needs_error() const { return enabled() && m_type == STOP_RELERR; }
+  /**
+   * Marks the beginning of the iteration it. The following add_* and
+   * converged calls are no-ops unless it is a check iteration.
+   * @param[in] it zero based iteration
+   */
+  void start(unsigned int it) {
+    this->m_checking = enabled() && ((it + 1) % this->m_check_every == 0);
+    this->m_sums[0] = 0;
+    this->m_sums[1] = 0;
+  }
+  /// Returns true if the current iteration is a check iteration
+  bool checking() const { return m_checking; }
+  /// Returns the local sums to be allreduced in the distributed case
+  double *sums() { return m_sums; }
+  /**
+   * Adds the squared norm of the projected gradient X*gram - B of the
+   * subproblem min ||.|| s.t. X >= 0. Entries of the gradient that
+   * point out of the feasible region at an active bound are dropped.
+   * @param[in] X current nxk factor before its update
+   * @param[in] gram kxk gram of the fixed factor(s)
+   * @param[in] B nxk rhs or kxn if trans
+   * @param[in] trans B is given as kxn
+   */
+  void add_pgrad(const MAT &X, const MAT &gram, const MAT &B,
+                 bool trans = false) {
+    if (!this->m_checking || this->m_type != STOP_PGRAD) return;
+    MAT G = X * gram;
+    double sqnorm = 0;
+    for (UWORD j = 0; j < G.n_cols; j++) {
+      for (UWORD i = 0; i < G.n_rows; i++) {
+        double g = G(i, j) - (trans ? B(j, i) : B(i, j));
+        if (X(i, j) > 0 || g < 0) sqnorm += g * g;
+      }
+    }
+    this->m_sums[0] += sqnorm;
+  }
+  /**
+   * Adds the change of the i-th factor since the last check and keeps
+   * a copy of it for the next check.
+   * @param[in] i index of the factor. Say, 0 for W and 1 for H.
+   * @param[in] X current factor
+   */
+  void add_factor(unsigned int i, const MAT &X) {
+    if (!this->m_checking || this->m_type != STOP_FACTOR) return;
+    if (this->m_snapshot.size() <= i) this->m_snapshot.resize(i + 1);
+    if (this->m_snapshot[i].n_rows == X.n_rows &&
+        this->m_snapshot[i].n_cols == X.n_cols) {
+      this->m_sums[0] += arma::accu(arma::square(X - this->m_snapshot[i]));
+    }
+    this->m_sums[1] += arma::accu(arma::square(X));
+    this->m_snapshot[i] = X;
+  }
+  /**
+   * Evaluates the criterion at the end of a check iteration.
+   * The first check only records the reference values.
+   * @param[in] relerr relative error of the current iterate. Used only
+   *            by STOP_RELERR.
+   * @return true if the iterations can stop
+   */
+  bool converged(double relerr = 0) {
+    if (!this->m_checking) return false;
+    this->m_checking = false;
+    bool done = false;
+    switch (this->m_type) {
+      case STOP_RELERR:
+        this->m_measure = std::abs(this->m_prev - relerr);
+        done = this->m_has_prev && this->m_measure < this->m_tol;
+        this->m_prev = relerr;
+        break;
+      case STOP_PGRAD:
+        this->m_measure = std::sqrt(this->m_sums[0]);
+        if (!this->m_has_prev) this->m_ref = this->m_measure;
+        done = this->m_measure <= this->m_tol * this->m_ref;
+        break;
+      case STOP_FACTOR:
+        this->m_measure = (this->m_sums[1] > 0)
+                              ? std::sqrt(this->m_sums[0] / this->m_sums[1])
+                              : 0;
+        done = this->m_has_prev && this->m_measure < this->m_tol;
+        break;
+      default:
+        break;
+    }
+    this->m_has_prev = true;
+    return done;
+  }
+};
+
+}  // namespace planc
+
+#endif  // COMMON_STOPCRITERION_HPP_
@@ -5,6 +5,7 @@
 
 // #include <cblas.h>
 #include <mkl.h>
+#include <omp.h>
 #include <armadillo>
 #include <fstream>
 #include <ios>
@@ -13,6 +14,7 @@
 #include <type_traits>
 #include <utility>
 #include <vector>
+#include "common/tensorstorage.hpp"
 #include "common/utils.h"
 
 namespace planc {
@@ -70,8 +72,33 @@ class Tensor {
     return sub;
   }
 
+  /**
+   * Reads the number of modes and the dimensions from the .info file
+   * that sits next to the given binary file and sets m_numel.
+   * @param[in] filename of the binary file as std::string
+   */
+  void read_info(std::string filename) {
+    std::string filename_no_extension =
+        filename.substr(0, filename.find_last_of("."));
+    filename_no_extension.append(".info");
+
+    std::ifstream ifs;
+    // info file always in text mode
+    ifs.open(filename_no_extension, std::ios_base::in);
+    // write modes
+    ifs >> this->m_modes;
+    // dimension of modes
+    this->m_dimensions = arma::zeros<UVEC>(this->m_modes);
+    for (int i = 0; i < this->m_modes; i++) {
+      ifs >> this->m_dimensions[i];
+    }
+    ifs.close();
+    this->m_numel = arma::prod(this->m_dimensions);
+  }
+
  public:
-  std::vector<double> m_data;
+  /// heap allocated or file mapped elements. See TensorStorage.
+  TensorStorage m_data;
 
   Tensor() {
     this->m_modes = 0;
@@ -97,6 +124,23 @@ class Tensor {
     m_data.resize(m_numel);
     randu();
   }
+  /**
+   * With i_shape_only, only the dimensions and the global start index
+   * without any element storage, so numel is 0. Describes the
+   * local block of a tensor whose elements are held elsewhere, say, by
+   * a SparseTensor.
+   */
+  Tensor(const UVEC &i_dimensions, const UVEC &i_start_idx, bool i_shape_only)
+      : m_modes(i_dimensions.n_rows),
+        m_dimensions(i_dimensions),
+        m_numel(i_shape_only ? 0 : arma::prod(i_dimensions)),
+        m_global_idx(i_start_idx),
+        rand_seed(103) {
+    if (!i_shape_only) {
+      m_data.resize(m_numel);
+      randu();
+    }
+  }
   /**
    * Need when copying from matrix to Tensor. otherwise copy constructor
    * will be called. The data will be passed in row major order
@@ -291,6 +335,11 @@ class Tensor {
       for (int i = i_n + 1; i < this->m_modes; i++) {
         nmats *= this->m_dimensions[i];
       }
+      // enough slabs to keep every thread busy
+      if (omp_get_max_threads() > 1 && nmats >= omp_get_max_threads()) {
+        mttkrp_slabs(i_n, ncols, nmats, i_krp, o_mttkrp);
+        return;
+      }
       // For each matrix...
       for (int i = 0; i < nmats; i++) {
         // char transa = 'T';
@@ -322,6 +371,47 @@ class Tensor {
       }
     }
   }
+  /**
+   * Parallel mttkrp for i_n > 0. The nmats row major slabs are split
+   * across the OpenMP threads instead of relying on the threads inside
+   * the small dgemm of every slab. Every thread accumulates its slabs
+   * into a private dimension[i_n] x k buffer with a sequential dgemm
+   * and then every thread sums a range of all the private buffers into
+   * o_mttkrp.
+   * @param[in] i_n mode number
+   * @param[in] ncols product of the dimensions before i_n
+   * @param[in] nmats product of the dimensions after i_n
+   * @param[in] i_krp Khatri-rao product matrix leaving out mode i_n
+   * @param[out] o_mttkrp pointer to the mttkrp matrix.
+   */
+  void mttkrp_slabs(const int i_n, const int ncols, const int nmats,
+                    const MAT &i_krp, MAT *o_mttkrp) const {
+    int m = this->m_dimensions[i_n];
+    int n = i_krp.n_cols;
+    int k = ncols;
+    int nthreads = omp_get_max_threads();
+    std::vector<MAT> acc(nthreads);
+    for (int t = 0; t < nthreads; t++) acc[t].zeros(n, m);
+    UWORD outnumel = static_cast<UWORD>(m) * n;
+    double *out = o_mttkrp->memptr();
+#pragma omp parallel num_threads(nthreads)
+    {
+      double *myacc = acc[omp_get_thread_num()].memptr();
+#pragma omp for schedule(static)
+      for (int i = 0; i < nmats; i++) {
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m, n, k, 1.0,
+                    &this->m_data[0] + static_cast<UWORD>(i) * k * m, ncols,
+                    i_krp.memptr() + static_cast<UWORD>(i) * k,
+                    i_krp.n_rows, 1.0, myacc, n);
+      }
+#pragma omp for schedule(static)
+      for (UWORD e = 0; e < outnumel; e++) {
+        double sum = 0;
+        for (int t = 0; t < nthreads; t++) sum += acc[t][e];
+        out[e] = sum;
+      }
+    }
+  }
   /// prints the value of the tensor.
   void print() const {
     INFO << "Dimensions: " << this->m_dimensions;
@@ -444,8 +534,7 @@ class Tensor {
     INFO << "size of the outputfile in GB "
          << (this->m_numel * 8.0) / (1024 * 1024 * 1024) << std::endl;
     size_t nwrite =
-        fwrite(&this->m_data[0], sizeof(std::vector<double>::value_type),
-               this->numel(), fp);
+        fwrite(&this->m_data[0], sizeof(double), this->numel(), fp);
     if (nwrite != this->numel()) {
       WARN << "something wrong ::write::" << nwrite
            << "::numel::" << this->numel() << std::endl;
@@ -465,32 +554,16 @@ class Tensor {
       this->m_data.clear();  // destroy storage in this
       this->m_numel = 0;
     }
-    std::string filename_no_extension =
-        filename.substr(0, filename.find_last_of("."));
-    filename_no_extension.append(".info");
-
-    std::ifstream ifs;
-    // info file always in text mode
-    ifs.open(filename_no_extension, std::ios_base::in);
-    // write modes
-    ifs >> this->m_modes;
-    // dimension of modes
-    this->m_dimensions = arma::zeros<UVEC>(this->m_modes);
-    for (int i = 0; i < this->m_modes; i++) {
-      ifs >> this->m_dimensions[i];
-    }
-    ifs.close();
+    read_info(filename);
     // ifs.open(filename, mode);
     FILE *fp = fopen(filename.c_str(), "rb");
-    this->m_numel = arma::prod(this->m_dimensions);
     this->m_data.resize(this->m_numel);
     // for (int i = 0; i < this->m_numel; i++) {
     //   ifs >> this->m_data[i];
     // }
     // ifs.read(reinterpret_cast<char *>(this->m_data), sizeof(this->m_data));
     size_t nread =
-        fread(&this->m_data[0], sizeof(std::vector<double>::value_type),
-              this->numel(), fp);
+        fread(&this->m_data[0], sizeof(double), this->numel(), fp);
     if (nread != this->numel()) {
       WARN << "something wrong ::write::" << nread
            << "::numel::" << this->numel() << std::endl;
@@ -499,6 +572,26 @@ class Tensor {
     fclose(fp);
   }
 
+  /**
+   * Same file format as read. Instead of copying, the binary file is
+   * mapped privately and the tensor operates on the mapped pages.
+   * The file is never modified. Falls back to read if the mapping fails.
+   * @param[in] filename as std::string
+   * @param[in] populate prefault all the pages while mapping
+   */
+  void read_mmap(std::string filename, bool populate = false) {
+    this->m_data.clear();
+    this->m_numel = 0;
+    read_info(filename);
+    if (!this->m_data.map(filename, this->m_numel, populate)) {
+      WARN << "mapping " << filename << " failed. reading instead"
+           << std::endl;
+      read(filename);
+    }
+  }
+  /// Returns true if the tensor is backed by a mapped file
+  bool is_mapped() const { return this->m_data.is_mapped(); }
+
   /**
    * Given a vector of subscripts, it return the linear index
    * in the tensor.
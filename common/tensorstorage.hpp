@@ -0,0 +1,157 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef COMMON_TENSORSTORAGE_HPP_
+#define COMMON_TENSORSTORAGE_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "common/utils.h"
+
+namespace planc {
+
+/**
+ * Storage of the tensor elements. By default the elements live on the
+ * heap in a std::vector. Alternatively, a raw binary file can be mapped
+ * with map() and the elements are then read straight from the page
+ * cache without any copy. The mapping is private, so the file is never
+ * modified. A write to the tensor only copies the touched pages.
+ * Copy constructor and copy assignment always produce heap storage.
+ */
+class TensorStorage {
+ private:
+  std::vector<double> m_heap;
+  double *m_ptr;
+  UWORD m_size;
+  void *m_map;
+  size_t m_map_bytes;
+
+  void unmap() {
+    if (m_map != NULL) {
+      munmap(m_map, m_map_bytes);
+      m_map = NULL;
+      m_map_bytes = 0;
+    }
+  }
+
+ public:
+  TensorStorage() : m_ptr(NULL), m_size(0), m_map(NULL), m_map_bytes(0) {}
+  TensorStorage(const TensorStorage &src)
+      : m_ptr(NULL), m_size(0), m_map(NULL), m_map_bytes(0) {
+    resize(src.size());
+    if (m_size > 0) memcpy(m_ptr, src.m_ptr, sizeof(double) * m_size);
+  }
+  TensorStorage &operator=(const TensorStorage &other) {
+    if (this != &other) {
+      TensorStorage temp(other);
+      swap(temp);
+    }
+    return *this;
+  }
+  ~TensorStorage() { unmap(); }
+
+  /**
+   * Resizes the storage to n elements on the heap. Existing elements
+   * are preserved as in std::vector::resize. A mapped storage is
+   * copied to the heap and unmapped.
+   * @param[in] number of elements
+   */
+  void resize(UWORD n) {
+    if (m_map != NULL) {
+      std::vector<double> temp(n);
+      memcpy(&temp[0], m_ptr, sizeof(double) * std::min(n, m_size));
+      unmap();
+      m_heap.swap(temp);
+    } else {
+      m_heap.resize(n);
+    }
+    m_size = n;
+    m_ptr = (n > 0) ? &m_heap[0] : NULL;
+  }
+  /// Releases the heap or the mapped storage
+  void clear() {
+    unmap();
+    std::vector<double>().swap(m_heap);
+    m_ptr = NULL;
+    m_size = 0;
+  }
+
+  /**
+   * Maps the first numel doubles of the given raw binary file.
+   * @param[in] filename of the raw binary file
+   * @param[in] numel number of doubles to be mapped
+   * @param[in] populate prefault all the pages during the map with
+   *            MAP_POPULATE. Otherwise only MADV_WILLNEED is advised
+   *            and the pages are read in the background.
+   * @return false if the file cannot be opened, is smaller than
+   *         numel doubles or cannot be mapped. Storage is empty then.
+   */
+  bool map(const std::string &filename, UWORD numel, bool populate = false) {
+    clear();
+    size_t nbytes = sizeof(double) * numel;
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      ERR << "could not open " << filename << " for mapping" << std::endl;
+      return false;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || static_cast<size_t>(sb.st_size) < nbytes) {
+      ERR << "size of " << filename << " is less than " << nbytes << " bytes"
+          << std::endl;
+      close(fd);
+      return false;
+    }
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+#endif
+    void *addr = NULL;
+    if (nbytes > 0) {
+      addr = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+    }
+    // the mapping holds its own reference to the file
+    close(fd);
+    if (addr == MAP_FAILED) {
+      ERR << "mmap of " << filename << " failed" << std::endl;
+      return false;
+    }
+    if (addr != NULL && !populate) {
+      madvise(addr, nbytes, MADV_WILLNEED);
+    }
+    m_map = addr;
+    m_map_bytes = nbytes;
+    m_ptr = reinterpret_cast<double *>(addr);
+    m_size = numel;
+    return true;
+  }
+
+  /// Returns true if the elements are backed by a mapped file
+  bool is_mapped() const { return m_map != NULL; }
+  /// Returns the number of elements
+  UWORD size() const { return m_size; }
+  /// Returns the pointer to the first element
+  double *data() { return m_ptr; }
+  const double *data() const { return m_ptr; }
+  double &operator[](UWORD i) { return m_ptr[i]; }
+  const double &operator[](UWORD i) const { return m_ptr[i]; }
+
+  void swap(TensorStorage &in) {
+    using std::swap;
+    swap(m_heap, in.m_heap);
+    swap(m_ptr, in.m_ptr);
+    swap(m_size, in.m_size);
+    swap(m_map, in.m_map);
+    swap(m_map_bytes, in.m_map_bytes);
+  }
+};
+
+inline void swap(TensorStorage &x, TensorStorage &y) { x.swap(y); }
+
+}  // namespace planc
+
+#endif  // COMMON_TENSORSTORAGE_HPP_
@@ -11,6 +11,8 @@ enum algotype { MU, HALS, ANLSBPP, NAIVEANLSBPP, AOADMM, NESTEROV, CPALS };
 
 enum normtype { NONE, L2NORM, MAXNORM };
 
+enum stoptype { STOP_ITER, STOP_RELERR, STOP_PGRAD, STOP_FACTOR };
+
 // #if !defined(ARMA_64BIT_WORD)
 // #define ARMA_64BIT_WORD
 #define ARMA_DONT_USE_WRAPPER
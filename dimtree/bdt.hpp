@@ -0,0 +1,372 @@
+/* Copyright 2017 Ramakrishnan Kannan */
+
+#ifndef DIMTREE_BDT_HPP_
+#define DIMTREE_BDT_HPP_
+
+#include <omp.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common/ncpfactors.hpp"
+#include "common/tensor.hpp"
+#include "common/utils.hpp"
+#include "dimtree/ddttensor.hpp"
+
+namespace planc {
+
+/**
+ * Binary dimension tree for the mttkrp of all the modes of a dense
+ * tensor. Every node covers a contiguous range of modes [lo, hi] and
+ * holds the tensor contracted with the factors of all the other modes,
+ * stored as a k x prod(I_lo..I_hi) matrix with the rank fastest. The
+ * root is the input tensor and the leaf of mode n is the k x I_n mttkrp
+ * of mode n. A child of the root is a dgemm of the tensor with the KRP
+ * of its sibling modes (partial mttkrp) and any other child is a
+ * multi-TTV of its parent with the KRP of its sibling modes.
+ *
+ * Every node is memoized and stays valid until a factor outside of its
+ * range is changed with set_factor. In the sweep over the modes in the
+ * natural order every node is hence computed exactly once per sweep,
+ * and the multi-TTVs of an internal node are shared by all the modes
+ * below it instead of being redone from the partial mttkrp.
+ *
+ * The splits are chosen from the dimensions by a dynamic program over
+ * the mode ranges that minimizes the flops of a sweep and breaks the
+ * ties by the memory of the memoized nodes. For three modes this is a
+ * single split tree.
+ */
+class BinaryDimensionTree {
+ private:
+  struct Node {
+    int lo;
+    int hi;
+    int parent;
+    int left;
+    int right;
+    /// product of the dimensions lo..hi
+    UWORD numel;
+    /// k x numel contracted tensor. Unused for the root.
+    MAT t;
+    bool valid;
+  };
+  /// columns of a multi-TTV block owned by one thread
+  static const UWORD kBlockCols = 64;
+
+  const Tensor &m_input_tensor;
+  /// m_nodes[0] is the root
+  std::vector<Node> m_nodes;
+  /// leaf node of every mode
+  std::vector<int> m_leaf;
+  /// k x I_n transposed factors
+  std::vector<MAT> m_factors_t;
+  UVEC m_dims;
+  int m_modes;
+  int m_k;
+  /// KRP of the sibling modes while computing a node
+  MAT m_krp_t;
+  double m_sweep_flops;
+  UWORD m_memoized_words;
+  double m_mttkrp_time;
+  double m_multittv_time;
+
+  double range_prod(int lo, int hi) const {
+    double p = 1;
+    for (int i = lo; i <= hi; i++) p *= m_dims(i);
+    return p;
+  }
+
+  /**
+   * Chooses the split of every mode range. flops(lo, hi) is the cost of
+   * computing the whole subtree below a node of range [lo, hi] given
+   * the node. Every split reads the node once per child and forms the
+   * KRP of the sibling of every child.
+   * @return split[lo * N + hi] is the last mode of the left child
+   */
+  std::vector<int> plan() {
+    int N = m_modes;
+    std::vector<double> flops(N * N, 0), words(N * N, 0);
+    std::vector<int> split(N * N, -1);
+    for (int len = 2; len <= N; len++) {
+      for (int lo = 0; lo + len - 1 < N; lo++) {
+        int hi = lo + len - 1;
+        double best_f = std::numeric_limits<double>::max();
+        double best_w = best_f;
+        for (int s = lo; s < hi; s++) {
+          double l = range_prod(lo, s);
+          double r = range_prod(s + 1, hi);
+          double f = 4.0 * m_k * l * r + m_k * (l + r) + flops[lo * N + s] +
+                     flops[(s + 1) * N + hi];
+          double w = m_k * (l + r) + words[lo * N + s] + words[(s + 1) * N + hi];
+          if (f < best_f || (f == best_f && w < best_w)) {
+            best_f = f;
+            best_w = w;
+            split[lo * N + hi] = s;
+          }
+        }
+        flops[lo * N + hi] = best_f;
+        words[lo * N + hi] = best_w;
+      }
+    }
+    m_sweep_flops = flops[N - 1];
+    m_memoized_words = static_cast<UWORD>(words[N - 1]);
+    return split;
+  }
+
+  int build(int lo, int hi, int parent, const std::vector<int> &split) {
+    int id = m_nodes.size();
+    m_nodes.push_back(Node());
+    m_nodes[id].lo = lo;
+    m_nodes[id].hi = hi;
+    m_nodes[id].parent = parent;
+    m_nodes[id].left = -1;
+    m_nodes[id].right = -1;
+    m_nodes[id].numel = 1;
+    for (int i = lo; i <= hi; i++) m_nodes[id].numel *= m_dims(i);
+    m_nodes[id].valid = false;
+    if (parent >= 0) m_nodes[id].t.zeros(m_k, m_nodes[id].numel);
+    if (lo == hi) {
+      m_leaf[lo] = id;
+    } else {
+      int s = split[lo * m_modes + hi];
+      int l = build(lo, s, id, split);
+      int r = build(s + 1, hi, id, split);
+      m_nodes[id].left = l;
+      m_nodes[id].right = r;
+    }
+    return id;
+  }
+
+  /**
+   * Transposed KRP of the factors lo..hi with mode lo the fastest, i.e.
+   * k x prod(I_lo..I_hi). Expanded in place one mode at a time.
+   */
+  void krp_t(int lo, int hi, MAT *o_krp_t) {
+    UWORD n = 1;
+    for (int i = lo; i <= hi; i++) n *= m_dims(i);
+    o_krp_t->set_size(m_k, n);
+    double *out = o_krp_t->memptr();
+    std::memcpy(out, m_factors_t[lo].memptr(),
+                sizeof(double) * m_k * m_dims(lo));
+#pragma omp parallel
+    {
+      UWORD cur = m_dims(lo);
+      for (int j = lo + 1; j <= hi; j++) {
+        const MAT &f = m_factors_t[j];
+        UWORD nblocks = (cur + kBlockCols - 1) / kBlockCols;
+        // block 0 is the source of every block, so the indices i > 0
+        // are expanded first and block 0 in place after the barrier
+#pragma omp for schedule(static)
+        for (UWORD t = nblocks; t < m_dims(j) * nblocks; t++) {
+          UWORD i = t / nblocks;
+          UWORD cb = (t % nblocks) * kBlockCols;
+          UWORD nc = std::min(cb + kBlockCols, cur) - cb;
+          vdMul_Rows(m_k, nc, f.colptr(i), out + cb * m_k,
+                     out + (i * cur + cb) * m_k);
+        }
+#pragma omp for schedule(static)
+        for (UWORD b = 0; b < nblocks; b++) {
+          UWORD cb = b * kBlockCols;
+          UWORD nc = std::min(cb + kBlockCols, cur) - cb;
+          vdMul_Rows(m_k, nc, f.colptr(0), out + cb * m_k, out + cb * m_k);
+        }
+        cur *= m_dims(j);
+      }
+    }
+  }
+
+  /**
+   * Contracts the right modes of the k x (L x R) parent P with the k x R
+   * KRP into the k x L left child. Every thread owns a block of columns
+   * of the output and streams its columns of every slab of P.
+   */
+  void ttv_left(const MAT &P, UWORD L, UWORD R, const MAT &krp, MAT *o_t) {
+    const double *p = P.memptr();
+    double *out = o_t->memptr();
+    UWORD nblocks = (L + kBlockCols - 1) / kBlockCols;
+#pragma omp parallel for schedule(static)
+    for (UWORD b = 0; b < nblocks; b++) {
+      UWORD lb = b * kBlockCols;
+      UWORD le = std::min(lb + kBlockCols, L);
+      std::memset(out + lb * m_k, 0, sizeof(double) * m_k * (le - lb));
+      for (UWORD rr = 0; rr < R; rr++) {
+        vdMulAdd_Rows(m_k, le - lb, krp.colptr(rr), p + (rr * L + lb) * m_k,
+                      out + lb * m_k);
+      }
+    }
+  }
+
+  /**
+   * Contracts the left modes of the k x (L x R) parent P with the k x L
+   * KRP into the k x R right child. Parallel over the columns of the
+   * output if there are enough of them, otherwise every thread sums a
+   * range of the left modes into its own buffer as in
+   * Tensor::mttkrp_slabs.
+   */
+  void ttv_right(const MAT &P, UWORD L, UWORD R, const MAT &krp, MAT *o_t) {
+    const double *p = P.memptr();
+    const double *kl = krp.memptr();
+    double *out = o_t->memptr();
+    int nthreads = omp_get_max_threads();
+    vdMulAdd_kernel kernel = vdMulAdd_dispatch();
+    if (R >= static_cast<UWORD>(nthreads)) {
+#pragma omp parallel for schedule(static)
+      for (UWORD rr = 0; rr < R; rr++) {
+        double *oc = out + rr * m_k;
+        std::memset(oc, 0, sizeof(double) * m_k);
+        for (UWORD l = 0; l < L; l++) {
+          kernel(m_k, kl + l * m_k, p + (rr * L + l) * m_k, oc);
+        }
+      }
+      return;
+    }
+    std::vector<MAT> acc(nthreads);
+    for (int t = 0; t < nthreads; t++) acc[t].zeros(m_k, R);
+    UWORD outnumel = m_k * R;
+#pragma omp parallel num_threads(nthreads)
+    {
+      double *myacc = acc[omp_get_thread_num()].memptr();
+#pragma omp for schedule(static)
+      for (UWORD l = 0; l < L; l++) {
+        const double *kc = kl + l * m_k;
+        for (UWORD rr = 0; rr < R; rr++) {
+          kernel(m_k, kc, p + (rr * L + l) * m_k, myacc + rr * m_k);
+        }
+      }
+#pragma omp for schedule(static)
+      for (UWORD e = 0; e < outnumel; e++) {
+        double sum = 0;
+        for (int t = 0; t < nthreads; t++) sum += acc[t][e];
+        out[e] = sum;
+      }
+    }
+  }
+
+  /// Computes the node from its parent, computing the parent if stale
+  void compute(int id) {
+    if (m_nodes[id].valid) return;
+    int p = m_nodes[id].parent;
+    if (p != 0) compute(p);
+    Node &node = m_nodes[id];
+    const Node &left = m_nodes[m_nodes[p].left];
+    const Node &right = m_nodes[m_nodes[p].right];
+    bool is_left = (left.lo == node.lo);
+    const Node &sibling = is_left ? right : left;
+    UWORD L = left.numel;
+    UWORD R = right.numel;
+    tic();
+    krp_t(sibling.lo, sibling.hi, &m_krp_t);
+    if (p == 0) {
+      // partial mttkrp with the L x R unfolding of the input tensor
+      const double *X = &m_input_tensor.m_data[0];
+      if (is_left) {
+        cblas_dgemm(CblasColMajor, CblasNoTrans, CblasTrans, m_k, L, R, 1.0,
+                    m_krp_t.memptr(), m_k, X, L, 0.0, node.t.memptr(), m_k);
+      } else {
+        cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, m_k, R, L, 1.0,
+                    m_krp_t.memptr(), m_k, X, L, 0.0, node.t.memptr(), m_k);
+      }
+      m_mttkrp_time += toc();
+    } else {
+      const MAT &P = m_nodes[p].t;
+      if (is_left) {
+        ttv_left(P, L, R, m_krp_t, &node.t);
+      } else {
+        ttv_right(P, L, R, m_krp_t, &node.t);
+      }
+      m_multittv_time += toc();
+    }
+    node.valid = true;
+  }
+
+  void layout(int id, std::ostringstream &os) const {
+    const Node &node = m_nodes[id];
+    if (node.lo == node.hi) {
+      os << node.lo;
+      return;
+    }
+    os << "(";
+    layout(node.left, os);
+    os << " ";
+    layout(node.right, os);
+    os << ")";
+  }
+
+ public:
+  BinaryDimensionTree(const Tensor &i_input_tensor,
+                      const NCPFactors &i_ncp_factors)
+      : m_input_tensor(i_input_tensor),
+        m_dims(i_input_tensor.dimensions()),
+        m_modes(i_input_tensor.modes()),
+        m_k(i_ncp_factors.rank()),
+        m_mttkrp_time(0),
+        m_multittv_time(0) {
+    m_factors_t.resize(m_modes);
+    for (int i = 0; i < m_modes; i++) {
+      m_factors_t[i] = i_ncp_factors.factor(i).t();
+    }
+    m_leaf.assign(m_modes, 0);
+    std::vector<int> split = plan();
+    m_nodes.reserve(2 * m_modes - 1);
+    build(0, m_modes - 1, -1, split);
+  }
+
+  /**
+   * Sets the factor of a mode and invalidates every node that depends
+   * on it, i.e. whose range does not contain the mode.
+   * @param[in] factor_t_ptr k x I_mode transposed factor
+   * @param[in] mode
+   */
+  void set_factor(const double *factor_t_ptr, const long int mode) {
+    std::memcpy(m_factors_t[mode].memptr(), factor_t_ptr,
+                sizeof(double) * m_k * m_dims(mode));
+    for (unsigned int i = 1; i < m_nodes.size(); i++) {
+      if (mode < m_nodes[i].lo || mode > m_nodes[i].hi) {
+        m_nodes[i].valid = false;
+      }
+    }
+  }
+
+  /**
+   * mttkrp of the mode n from the memoized tree. The modes can be
+   * visited in any order, the natural order gives the most reuse.
+   * @param[in] n mode
+   * @param[out] out k x I_n mttkrp, or I_n x k if colmajor
+   * @param[in] colmajor
+   * @param[out] multittv_time seconds in the multi-TTVs
+   * @param[out] mttkrp_time seconds in the partial mttkrps
+   */
+  void in_order_reuse_MTTKRP(long int n, double *out, bool colmajor,
+                             double &multittv_time, double &mttkrp_time) {
+    m_mttkrp_time = 0;
+    m_multittv_time = 0;
+    int id = m_leaf[n];
+    compute(id);
+    const MAT &mttkrp_t = m_nodes[id].t;
+    if (colmajor) {
+      MAT mttkrp(out, m_dims(n), m_k, false, true);
+      mttkrp = mttkrp_t.t();
+    } else {
+      std::memcpy(out, mttkrp_t.memptr(), sizeof(double) * mttkrp_t.n_elem);
+    }
+    multittv_time = m_multittv_time;
+    mttkrp_time = m_mttkrp_time;
+  }
+
+  /// Tree as nested parentheses of the modes. Say, ((0 1) (2 (3 4)))
+  std::string layout() const {
+    std::ostringstream os;
+    layout(0, os);
+    return os.str();
+  }
+  /// flops of a sweep over all the modes
+  double sweep_flops() const { return m_sweep_flops; }
+  /// doubles held by the memoized nodes
+  UWORD memoized_words() const { return m_memoized_words; }
+};
+
+}  // namespace planc
+
+#endif  // DIMTREE_BDT_HPP_
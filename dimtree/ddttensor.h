@@ -233,6 +233,9 @@ void remove_mode_Ktensor(ktensor *Y, long int n);
 
 // mkl unavailable functions
 void vdMul(long int, double *, double *, double *);
+void vdMul_Rows(long int, long int, const double *, const double *, double *);
+void vdMulAdd_Rows(long int, long int, const double *, const double *,
+                   double *);
 
 // define dgemm
 extern "C" void dgemm_(char *transa, char *transb, int *m, int *n, int *k, double *alpha,
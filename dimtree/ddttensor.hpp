@@ -5,12 +5,184 @@
 
 #include "dimtree/ddttensor.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DDT_SIMD_DISPATCH 1
+#endif
+
+typedef void (*vdMul_kernel)(long int n, const double *a, const double *b,
+                             double *c);
+
 /*
-  Element wise multiplication between two vectors
+  Element wise multiplication between two vectors, portable kernel
 */
+void vdMul_scalar(long int n, const double *a, const double *b, double *c) {
+  for (long int i = 0; i < n; i++) c[i] = a[i] * b[i];
+}
+
+#ifdef DDT_SIMD_DISPATCH
+/*
+  Element wise multiplication between two vectors, 4 doubles per AVX2
+  instruction and the scalar loop for the tail
+*/
+__attribute__((target("avx2"))) void vdMul_avx2(long int n, const double *a,
+                                                const double *b, double *c) {
+  long int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d c0 = _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d c1 =
+        _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4));
+    _mm256_storeu_pd(c + i, c0);
+    _mm256_storeu_pd(c + i + 4, c1);
+  }
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(c + i,
+                     _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  for (; i < n; i++) c[i] = a[i] * b[i];
+}
+
+/*
+  Element wise multiplication between two vectors, 8 doubles per AVX-512
+  instruction and a masked instruction for the tail
+*/
+__attribute__((target("avx512f"))) void vdMul_avx512(long int n,
+                                                     const double *a,
+                                                     const double *b,
+                                                     double *c) {
+  long int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm512_storeu_pd(c + i,
+                     _mm512_mul_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+  }
+  if (i < n) {
+    __mmask8 m = static_cast<__mmask8>((1u << (n - i)) - 1);
+    _mm512_mask_storeu_pd(c + i, m,
+                          _mm512_mul_pd(_mm512_maskz_loadu_pd(m, a + i),
+                                        _mm512_maskz_loadu_pd(m, b + i)));
+  }
+}
+#endif
 
+/*
+  Picks the widest vdMul kernel the running cpu supports. Called once,
+  the binary itself is built for the baseline instruction set.
+*/
+vdMul_kernel select_vdMul_kernel() {
+#ifdef DDT_SIMD_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return vdMul_avx512;
+  if (__builtin_cpu_supports("avx2")) return vdMul_avx2;
+#endif
+  return vdMul_scalar;
+}
+
+vdMul_kernel vdMul_dispatch() {
+  static const vdMul_kernel kernel = select_vdMul_kernel();
+  return kernel;
+}
+
+/*
+  Element wise multiplication between two vectors
+*/
 void vdMul(long int n, double *a, double *b, double *c) {
-  for (long int i = 0; i < n; i++) c[i] = a[i] * b[i];
+  vdMul_dispatch()(n, a, b, c);
+}
+
+/*
+  vdMul_Rows()
+  Hadamard product of the row a with nrows consecutive rows of the row
+  major B, written to the consecutive rows of C. This is a block of
+  rows of a Khatri-Rao product, a stays in L1 and B and C are streamed.
+  1) n, length of a row
+  2) nrows, number of rows of B and C
+*/
+void vdMul_Rows(long int n, long int nrows, const double *a, const double *B,
+                double *C) {
+  vdMul_kernel kernel = vdMul_dispatch();
+  for (long int j = 0; j < nrows; j++) kernel(n, a, B + j * n, C + j * n);
+}
+
+typedef void (*vdMulAdd_kernel)(long int n, const double *a,
+                                const double *b, double *c);
+
+/*
+  Element wise multiply and accumulate, c += a .* b, portable kernel
+*/
+void vdMulAdd_scalar(long int n, const double *a, const double *b,
+                     double *c) {
+  for (long int i = 0; i < n; i++) c[i] += a[i] * b[i];
+}
+
+#ifdef DDT_SIMD_DISPATCH
+/*
+  c += a .* b with AVX2. A multiply and an add, so that the cpu does not
+  need fma.
+*/
+__attribute__((target("avx2"))) void vdMulAdd_avx2(long int n,
+                                                   const double *a,
+                                                   const double *b,
+                                                   double *c) {
+  long int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d ab = _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    _mm256_storeu_pd(c + i, _mm256_add_pd(_mm256_loadu_pd(c + i), ab));
+  }
+  for (; i < n; i++) c[i] += a[i] * b[i];
+}
+
+/*
+  c += a .* b with AVX-512 fma and a masked instruction for the tail
+*/
+__attribute__((target("avx512f"))) void vdMulAdd_avx512(long int n,
+                                                        const double *a,
+                                                        const double *b,
+                                                        double *c) {
+  long int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm512_storeu_pd(c + i, _mm512_fmadd_pd(_mm512_loadu_pd(a + i),
+                                            _mm512_loadu_pd(b + i),
+                                            _mm512_loadu_pd(c + i)));
+  }
+  if (i < n) {
+    __mmask8 m = static_cast<__mmask8>((1u << (n - i)) - 1);
+    _mm512_mask_storeu_pd(c + i, m,
+                          _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a + i),
+                                          _mm512_maskz_loadu_pd(m, b + i),
+                                          _mm512_maskz_loadu_pd(m, c + i)));
+  }
+}
+#endif
+
+/*
+  Picks the vdMulAdd kernel of the same instruction set as vdMul_dispatch
+*/
+vdMulAdd_kernel select_vdMulAdd_kernel() {
+#ifdef DDT_SIMD_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return vdMulAdd_avx512;
+  if (__builtin_cpu_supports("avx2")) return vdMulAdd_avx2;
+#endif
+  return vdMulAdd_scalar;
+}
+
+vdMulAdd_kernel vdMulAdd_dispatch() {
+  static const vdMulAdd_kernel kernel = select_vdMulAdd_kernel();
+  return kernel;
+}
+
+/*
+  vdMulAdd_Rows()
+  Accumulating vdMul_Rows. The Hadamard product of the row a with nrows
+  consecutive rows of the row major B is added to the consecutive rows
+  of C. This is the inner loop of a tensor times a block of KRP rows.
+  1) n, length of a row
+  2) nrows, number of rows of B and C
+*/
+void vdMulAdd_Rows(long int n, long int nrows, const double *a,
+                   const double *B, double *C) {
+  vdMulAdd_kernel kernel = vdMulAdd_dispatch();
+  for (long int j = 0; j < nrows; j++) kernel(n, a, B + j * n, C + j * n);
 }
 
 /*
@@ -276,7 +448,7 @@ void update_Partial_Hadamards(ktensor *Y, long int *indexers,
 }
 
 void KR_RowMajor(ktensor *Y, double *C, long int n) {
-  long int i, j, lF, rF;
+  long int i, lF, rF;
   if (n != Y->nmodes - 1)
     lF = Y->nmodes - 1;
   else
@@ -285,11 +457,9 @@ void KR_RowMajor(ktensor *Y, double *C, long int n) {
   if (rF == n) rF--;
 
   for (i = 0; i < Y->dims[lF]; i++) {  // loop over the rows of the left matrix
-    for (j = 0; j < Y->dims[rF];
-         j++) {  // loop over the rows of the right matrix
-      vdMul(Y->rank, &Y->factors[lF][i * Y->rank], &Y->factors[rF][j * Y->rank],
-            &C[i * Y->rank * Y->dims[rF] + j * Y->rank]);
-    }
+    // all the rows of the right matrix in one block
+    vdMul_Rows(Y->rank, Y->dims[rF], &Y->factors[lF][i * Y->rank],
+               Y->factors[rF], &C[i * Y->rank * Y->dims[rF]]);
   }
 }
 
@@ -371,12 +541,12 @@ void Multi_KR_RowMajor(ktensor *Y, double *C, long int n) {
 // you need to include the diagonal
 void Upper_Hadamard_RowMajor(long int nRows, long int nCols, double *A,
                              double *B, double *C) {
-  long int i, j;
+  long int i;
 
-  for (i = 0; i < nRows; i++) {
-    for (j = i; j < nCols; j++) {
-      C[i * nCols + j] = A[i * nCols + j] * B[i * nCols + j];
-    }
+  vdMul_kernel kernel = vdMul_dispatch();
+  for (i = 0; i < nRows && i < nCols; i++) {
+    // the upper part of row i is contiguous
+    kernel(nCols - i, &A[i * nCols + i], &B[i * nCols + i], &C[i * nCols + i]);
   }
 }
 
@@ -1076,20 +1246,15 @@ void parallel_KR_RowMajor(ktensor *Y, double *C, long int start, long int end) {
   j = indexers[0];
   for (; (c < end) && (i < Y->dims[1]); i++) {
     if (c != start) j = 0;
-    for (; (c < end) && (j < Y->dims[0]); j++) {
-      /*
-        vdMul call
-        1) number of elements to multiply together
-        2) pointer to first vector
-        3) pointer to second vector
-        4) pointer to output location
-           -i*Y->rank*Y->dims[0], the size of the right matrix times
-           i -j*Y->rank, the length of a row times j
-      */
-      vdMul(Y->rank, &Y->factors[1][i * Y->rank], &Y->factors[0][j * Y->rank],
-            &C[(c - start) * Y->rank]);
-      c++;
-    }
+    /*
+      Rows j.. of the right matrix times row i of the left matrix are
+      consecutive rows of C, multiply them as one block
+    */
+    long int nrows = Y->dims[0] - j;
+    if (nrows > end - c) nrows = end - c;
+    vdMul_Rows(Y->rank, nrows, &Y->factors[1][i * Y->rank],
+               &Y->factors[0][j * Y->rank], &C[(c - start) * Y->rank]);
+    c += nrows;
   }
   free(indexers);
 }
@@ -7,6 +7,7 @@
 #include <armadillo>
 #include <string>
 #include <vector>
+#include "common/checkpoint.hpp"
 #include "distnmf/distnmf.hpp"
 #include "distnmf/mpicomm.hpp"
 
@@ -19,6 +20,8 @@
  * W of size \f${globalm}{p} \times k\f$
  * A is \f$m \times n\f$ matrix
  * H is \f$n \times k\f$ matrix
+ * On a pr x pc x pk grid every layer holds a replica of the 2D
+ * distribution of A and works on k/pk of the rank. p is then prxpcxpk.
  */
 namespace planc {
 
@@ -27,6 +30,11 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
   // needed in derived algorithms to
   // call BPP routines
  protected:
+  /// Element type of the input matrix. The communicated factor blocks
+  /// and the local products with A are in this precision. Factors, Grams
+  /// and the NNLS solves are always in double.
+  typedef typename INPUTMATTYPE::elem_type ELEMTYPE;
+  typedef arma::Mat<ELEMTYPE> BLKMAT;
   MAT HtH;    /// H is of size (globaln/p)*k;
   MAT WtW;    /// W is of size (globaln/p)*k;
   MAT AHtij;  /// AHtij is of size k*(globalm/p)
@@ -36,31 +44,65 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
 
   virtual void updateW() = 0;
   virtual void updateH() = 0;
+  /**
+   * Adds the state besides W and H that the algorithm carries from one
+   * iteration to the next, e.g. the ADMM duals. Used for the checkpoints.
+   * The matrices have to be of their final sizes.
+   */
+  virtual void checkpoint_state(std::vector<MAT *> *o_state) {}
+  /// Called after the checkpoint_state is restored from a checkpoint
+  virtual void checkpoint_restored() {}
 
  private:
   // Things needed while solving for W
   MAT localHtH;         /// H is of size (globaln/p)*k;
-  MAT Hjt, Hj;          /// Hj is of size n*k;
-  MAT AijHj, AijHjt;    /// AijHj is of size m*k;
+  BLKMAT Hjt, Hj;        /// Hj is of size n*k;
+  BLKMAT AijHj, AijHjt;  /// AijHj is of size m*k;
   INPUTMATTYPE A_ij_t;  /// n*m matrix. Transpose of A_ij
   // Things needed while solving for H
   MAT localWtW;        /// W is of size (globalm/p)*k;
-  MAT Wit, Wi;         /// Wi is of size m*k;
-  MAT WitAij, AijWit;  /// WijtAij is of size k*n;
+  BLKMAT Wit, Wi;        /// Wi is of size m*k;
+  BLKMAT WitAij, AijWit; /// WijtAij is of size k*n;
 
   // needed for error computation
   MAT prevH;        // used for error computation
   MAT prevHtH;      // used for error computation
   MAT WtAijH;       /// global k*k matrix.
   MAT localWtAijH;  /// local k*k matrix
-  MAT errMtx;
-  MAT A_errMtx;
+  BLKMAT errMtx;
+  BLKMAT A_errMtx;
+
+  // periodic checkpoints of W, H and the checkpoint_state. NULL if off.
+  Checkpoint *m_checkpoint;
+  bool m_restart;
+
+  /// W, H and the checkpoint_state of the algorithm
+  std::vector<MAT *> checkpoint_matrices() {
+    std::vector<MAT *> state;
+    state.push_back(&this->W);
+    state.push_back(&this->H);
+    checkpoint_state(&state);
+    return state;
+  }
 
   // needed for block implementation to save memory
-  MAT Ht_blk;
-  MAT AHtij_blk;
-  MAT Wt_blk;
-  MAT WtAij_blk;
+  BLKMAT Ht_blk;
+  BLKMAT AHtij_blk;
+  BLKMAT Wt_blk;
+  BLKMAT WtAij_blk;
+#ifdef MPI_PIPELINE
+  // second set of block buffers. While the local mm of block i runs,
+  // the allgather of block i+1 and the reduce_scatter of block i-1
+  // are in flight on these.
+  BLKMAT Wt_blk_nxt, Wit_nxt;
+  BLKMAT WitAij_prv, WtAij_blk_prv;
+  BLKMAT Ht_blk_nxt, Hjt_nxt;
+  BLKMAT AijHjt_prv, AHtij_blk_prv;
+#endif
+
+  // staging of the alltoall over the k fiber of the 3D grid
+  BLKMAT fiber_sendbuf;
+  BLKMAT fiber_recvbuf;
 
   std::vector<int> recvWtAsize;
   std::vector<int> recvAHsize;
@@ -86,7 +128,7 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     AijHjt.zeros(this->perk, this->m);
     AHtij.zeros(this->k, this->globalm() / MPI_SIZE);
     this->recvAHsize.resize(NUMCOLPROCS);
-    int fillsize = this->perk * (this->globalm() / MPI_SIZE);
+    int fillsize = this->perk * (this->globalm() / LAYERSIZE);
     fillVector<int>(fillsize, &recvAHsize);
 #ifdef MPI_VERBOSE
     if (ISROOT) {
@@ -95,8 +137,8 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     }
 #endif
     // allocated for block implementation.
-    Ht_blk.zeros(this->perk, (this->globalm() / MPI_SIZE));
-    AHtij_blk.zeros(this->perk, this->globalm() / MPI_SIZE);
+    Ht_blk.zeros(this->perk, this->globaln() / LAYERSIZE);
+    AHtij_blk.zeros(this->perk, this->globalm() / LAYERSIZE);
 
     // These initialization are for solving H.
     Wt.zeros(this->k, this->globalm() / MPI_SIZE);
@@ -108,12 +150,24 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     AijWit.zeros(this->n, this->perk);
     WtAij.zeros(this->k, this->globaln() / MPI_SIZE);
     this->recvWtAsize.resize(NUMROWPROCS);
-    fillsize = this->perk * (this->globaln() / MPI_SIZE);
+    fillsize = this->perk * (this->globaln() / LAYERSIZE);
     fillVector<int>(fillsize, &recvWtAsize);
 
     // allocated for block implementation
-    Wt_blk.zeros(this->perk, this->globalm() / MPI_SIZE);
-    WtAij_blk.zeros(this->perk, this->globaln() / MPI_SIZE);
+    Wt_blk.zeros(this->perk, this->globalm() / LAYERSIZE);
+    WtAij_blk.zeros(this->perk, this->globaln() / LAYERSIZE);
+#ifdef MPI_PIPELINE
+    if (this->num_k_blocks > 1) {
+      Wt_blk_nxt.zeros(this->perk, this->globalm() / MPI_SIZE);
+      Wit_nxt.zeros(this->perk, this->m);
+      WitAij_prv.zeros(this->perk, this->n);
+      WtAij_blk_prv.zeros(this->perk, this->globaln() / MPI_SIZE);
+      Ht_blk_nxt.zeros(this->perk, this->globaln() / MPI_SIZE);
+      Hjt_nxt.zeros(this->perk, this->n);
+      AijHjt_prv.zeros(this->perk, this->m);
+      AHtij_blk_prv.zeros(this->perk, this->globalm() / MPI_SIZE);
+    }
+#endif
 #ifdef MPI_VERBOSE
     if (ISROOT) {
       INFO << "::recvWtAsize::";
@@ -155,6 +209,16 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     AHtij_blk.clear();
     Wt_blk.clear();
     WtAij_blk.clear();
+#ifdef MPI_PIPELINE
+    Wt_blk_nxt.clear();
+    Wit_nxt.clear();
+    WitAij_prv.clear();
+    WtAij_blk_prv.clear();
+    Ht_blk_nxt.clear();
+    Hjt_nxt.clear();
+    AijHjt_prv.clear();
+    AHtij_blk_prv.clear();
+#endif
     if (this->is_compute_error()) {
       errMtx.clear();
       A_errMtx.clear();
@@ -179,10 +243,20 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
                               communicator) {
     num_k_blocks = numkblks;
     perk = this->k / num_k_blocks;
+    if (this->m_mpicomm.pk() > 1) {
+      // the rank is split over the layers of the grid instead
+      if (num_k_blocks > 1) {
+        PRINTROOT("numkblocks ignored on the 3D grid");
+      }
+      num_k_blocks = 1;
+      perk = this->k / this->m_mpicomm.pk();
+    }
     allocateMatrices();
     this->Wt = leftlowrankfactor.t();
     this->Ht = rightlowrankfactor.t();
     A_ij_t = input.t();
+    m_checkpoint = NULL;
+    m_restart = false;
     PRINTROOT("aunmf()::constructor succesful");
   }
   ~DistAUNMF() {
@@ -203,12 +277,24 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
    * this->m_mpicomm.comm_subs()[1] is row communicator.
    */
   void distWtA() {
+#ifndef USE_PACOSS
+    if (this->m_mpicomm.pk() > 1) {
+      distWtA3D();
+      return;
+    }
+#endif
+#if defined(MPI_PIPELINE) && !defined(USE_PACOSS)
+    if (num_k_blocks > 1) {
+      distWtAPipelined();
+      return;
+    }
+#endif
     for (int i = 0; i < num_k_blocks; i++) {
       int start_row = i * perk;
       int end_row = (i + 1) * perk - 1;
-      Wt_blk = Wt.rows(start_row, end_row);
+      Wt_blk = arma::conv_to<BLKMAT>::from(Wt.rows(start_row, end_row));
       distWtABlock();
-      WtAij.rows(start_row, end_row) = WtAij_blk;
+      WtAij.rows(start_row, end_row) = arma::conv_to<MAT>::from(WtAij_blk);
     }
   }
   void distWtABlock() {
@@ -220,12 +306,12 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     this->m_rowcomm->expCommBegin(Wit.memptr(), this->perk);
     this->m_rowcomm->expCommFinish(Wit.memptr(), this->perk);
 #else
-    int sendcnt = (this->globalm() / MPI_SIZE) * this->perk;
-    int recvcnt = (this->globalm() / MPI_SIZE) * this->perk;
+    int sendcnt = (this->globalm() / LAYERSIZE) * this->perk;
+    int recvcnt = (this->globalm() / LAYERSIZE) * this->perk;
     Wit.zeros();
     MPITIC;  // allgather WtA
-    MPI_Allgather(Wt_blk.memptr(), sendcnt, MPI_DOUBLE, Wit.memptr(), recvcnt,
-                  MPI_DOUBLE, this->m_mpicomm.commSubs()[1]);
+    MPI_Allgather(Wt_blk.memptr(), sendcnt, mpitype<ELEMTYPE>(), Wit.memptr(),
+                  recvcnt, mpitype<ELEMTYPE>(), this->m_mpicomm.commSubs()[1]);
 #endif
     double temp = MPITOC;  // allgather WtA
     PRINTROOT("n::" << this->n << "::k::" << this->k << PRINTMATINFO(Wt)
@@ -271,13 +357,83 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     WtAij_blk.zeros();
     MPITIC;  // reduce_scatter WtA
     MPI_Reduce_scatter(this->WitAij.memptr(), this->WtAij_blk.memptr(),
-                       &(this->recvWtAsize[0]), MPI_DOUBLE, MPI_SUM,
+                       &(this->recvWtAsize[0]), mpitype<ELEMTYPE>(), MPI_SUM,
                        this->m_mpicomm.commSubs()[0]);
     temp = MPITOC;  // reduce_scatter WtA
 #endif
     this->time_stats.communication_duration(temp);
     this->time_stats.reducescatter_duration(temp);
   }
+#if defined(MPI_PIPELINE) && !defined(USE_PACOSS)
+  /**
+   * Pipelined version of distWtA over the k-blocks.
+   * The allgather of block i+1 and the reduce_scatter of block i-1
+   * are posted as nonblocking collectives and progress while
+   * Wit*A of block i is computed. Only the time spent waiting
+   * on the requests is accounted as communication.
+   */
+  void distWtAPipelined() {
+    int sendcnt = (this->globalm() / LAYERSIZE) * this->perk;
+    int recvcnt = (this->globalm() / LAYERSIZE) * this->perk;
+    MPI_Request gatherreq = MPI_REQUEST_NULL;
+    MPI_Request scatterreq = MPI_REQUEST_NULL;
+    Wt_blk = arma::conv_to<BLKMAT>::from(Wt.rows(0, perk - 1));
+    MPITIC;  // allgather WtA
+    MPI_Iallgather(Wt_blk.memptr(), sendcnt, mpitype<ELEMTYPE>(), Wit.memptr(),
+                   recvcnt, mpitype<ELEMTYPE>(), this->m_mpicomm.commSubs()[1],
+                   &gatherreq);
+    MPI_Wait(&gatherreq, MPI_STATUS_IGNORE);
+    double temp = MPITOC;  // allgather WtA
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allgather_duration(temp);
+    for (int i = 0; i < num_k_blocks; i++) {
+      if (i + 1 < num_k_blocks) {
+        Wt_blk_nxt = arma::conv_to<BLKMAT>::from(
+            Wt.rows((i + 1) * perk, (i + 2) * perk - 1));
+        MPI_Iallgather(Wt_blk_nxt.memptr(), sendcnt, mpitype<ELEMTYPE>(),
+                       Wit_nxt.memptr(), recvcnt, mpitype<ELEMTYPE>(),
+                       this->m_mpicomm.commSubs()[1], &gatherreq);
+      }
+      MPITIC;  // mm WtA
+      this->WitAij = this->Wit * this->A;
+      temp = MPITOC;  // mm WtA
+      this->time_stats.compute_duration(temp);
+      this->time_stats.mm_duration(temp);
+      this->reportTime(temp, "WtA::");
+      MPITIC;  // reduce_scatter WtA
+      MPI_Wait(&scatterreq, MPI_STATUS_IGNORE);
+      temp = MPITOC;  // reduce_scatter WtA
+      this->time_stats.communication_duration(temp);
+      this->time_stats.reducescatter_duration(temp);
+      if (i > 0) {
+        WtAij.rows((i - 1) * perk, i * perk - 1) =
+            arma::conv_to<MAT>::from(WtAij_blk_prv);
+      }
+      // WitAij_prv is free again. Hand the product of block i to it.
+      this->WitAij.swap(this->WitAij_prv);
+      MPI_Ireduce_scatter(this->WitAij_prv.memptr(),
+                          this->WtAij_blk_prv.memptr(),
+                          &(this->recvWtAsize[0]), mpitype<ELEMTYPE>(),
+                          MPI_SUM,
+                          this->m_mpicomm.commSubs()[0], &scatterreq);
+      if (i + 1 < num_k_blocks) {
+        MPITIC;  // allgather WtA
+        MPI_Wait(&gatherreq, MPI_STATUS_IGNORE);
+        temp = MPITOC;  // allgather WtA
+        this->time_stats.communication_duration(temp);
+        this->time_stats.allgather_duration(temp);
+        this->Wit.swap(this->Wit_nxt);
+      }
+    }
+    MPITIC;  // reduce_scatter WtA
+    MPI_Wait(&scatterreq, MPI_STATUS_IGNORE);
+    temp = MPITOC;  // reduce_scatter WtA
+    this->time_stats.communication_duration(temp);
+    this->time_stats.reducescatter_duration(temp);
+    WtAij.rows((num_k_blocks - 1) * perk, num_k_blocks * perk - 1) =
+        arma::conv_to<MAT>::from(WtAij_blk_prv);
+  }
+#endif
   /**
    * There are totally prxpc process.
    * Each process will hold the following
@@ -290,12 +446,24 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
    * To preserve the memory for Hj, we collect only partial k
    */
   void distAH() {
+#ifndef USE_PACOSS
+    if (this->m_mpicomm.pk() > 1) {
+      distAH3D();
+      return;
+    }
+#endif
+#if defined(MPI_PIPELINE) && !defined(USE_PACOSS)
+    if (num_k_blocks > 1) {
+      distAHPipelined();
+      return;
+    }
+#endif
     for (int i = 0; i < num_k_blocks; i++) {
       int start_row = i * perk;
       int end_row = (i + 1) * perk - 1;
-      Ht_blk = Ht.rows(start_row, end_row);
+      Ht_blk = arma::conv_to<BLKMAT>::from(Ht.rows(start_row, end_row));
       distAHBlock();
-      AHtij.rows(start_row, end_row) = AHtij_blk;
+      AHtij.rows(start_row, end_row) = arma::conv_to<MAT>::from(AHtij_blk);
     }
   }
   void distAHBlock() {
@@ -314,12 +482,12 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     this->m_colcomm->expCommBegin(Hjt.memptr(), this->perk);
     this->m_colcomm->expCommFinish(Hjt.memptr(), this->perk);
 #else
-    int sendcnt = (this->globaln() / MPI_SIZE) * this->perk;
-    int recvcnt = (this->globaln() / MPI_SIZE) * this->perk;
+    int sendcnt = (this->globaln() / LAYERSIZE) * this->perk;
+    int recvcnt = (this->globaln() / LAYERSIZE) * this->perk;
     Hjt.zeros();
     MPITIC;  // allgather AH
-    MPI_Allgather(this->Ht_blk.memptr(), sendcnt, MPI_DOUBLE,
-                  this->Hjt.memptr(), recvcnt, MPI_DOUBLE,
+    MPI_Allgather(this->Ht_blk.memptr(), sendcnt, mpitype<ELEMTYPE>(),
+                  this->Hjt.memptr(), recvcnt, mpitype<ELEMTYPE>(),
                   this->m_mpicomm.commSubs()[0]);
 #endif
     PRINTROOT("n::" << this->n << "::k::" << this->k << PRINTMATINFO(Ht)
@@ -367,13 +535,151 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
     AHtij_blk.zeros();
     MPITIC;  // reduce_scatter AH
     MPI_Reduce_scatter(this->AijHjt.memptr(), this->AHtij_blk.memptr(),
-                       &(this->recvAHsize[0]), MPI_DOUBLE, MPI_SUM,
+                       &(this->recvAHsize[0]), mpitype<ELEMTYPE>(), MPI_SUM,
                        this->m_mpicomm.commSubs()[1]);
     temp = MPITOC;  // reduce_scatter AH
 #endif
     this->time_stats.communication_duration(temp);
     this->time_stats.reducescatter_duration(temp);
   }
+#if defined(MPI_PIPELINE) && !defined(USE_PACOSS)
+  /**
+   * Pipelined version of distAH over the k-blocks.
+   * Mirror image of distWtAPipelined with the row and column
+   * communicators exchanged.
+   */
+  void distAHPipelined() {
+    int sendcnt = (this->globaln() / LAYERSIZE) * this->perk;
+    int recvcnt = (this->globaln() / LAYERSIZE) * this->perk;
+    MPI_Request gatherreq = MPI_REQUEST_NULL;
+    MPI_Request scatterreq = MPI_REQUEST_NULL;
+    Ht_blk = arma::conv_to<BLKMAT>::from(Ht.rows(0, perk - 1));
+    MPITIC;  // allgather AH
+    MPI_Iallgather(Ht_blk.memptr(), sendcnt, mpitype<ELEMTYPE>(), Hjt.memptr(),
+                   recvcnt, mpitype<ELEMTYPE>(), this->m_mpicomm.commSubs()[0],
+                   &gatherreq);
+    MPI_Wait(&gatherreq, MPI_STATUS_IGNORE);
+    double temp = MPITOC;  // allgather AH
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allgather_duration(temp);
+    for (int i = 0; i < num_k_blocks; i++) {
+      if (i + 1 < num_k_blocks) {
+        Ht_blk_nxt = arma::conv_to<BLKMAT>::from(
+            Ht.rows((i + 1) * perk, (i + 2) * perk - 1));
+        MPI_Iallgather(Ht_blk_nxt.memptr(), sendcnt, mpitype<ELEMTYPE>(),
+                       Hjt_nxt.memptr(), recvcnt, mpitype<ELEMTYPE>(),
+                       this->m_mpicomm.commSubs()[0], &gatherreq);
+      }
+      MPITIC;  // mm AH
+      this->AijHjt = this->Hjt * this->A_ij_t;
+      temp = MPITOC;  // mm AH
+      this->time_stats.compute_duration(temp);
+      this->time_stats.mm_duration(temp);
+      this->reportTime(temp, "AH::");
+      MPITIC;  // reduce_scatter AH
+      MPI_Wait(&scatterreq, MPI_STATUS_IGNORE);
+      temp = MPITOC;  // reduce_scatter AH
+      this->time_stats.communication_duration(temp);
+      this->time_stats.reducescatter_duration(temp);
+      if (i > 0) {
+        AHtij.rows((i - 1) * perk, i * perk - 1) =
+            arma::conv_to<MAT>::from(AHtij_blk_prv);
+      }
+      this->AijHjt.swap(this->AijHjt_prv);
+      MPI_Ireduce_scatter(this->AijHjt_prv.memptr(),
+                          this->AHtij_blk_prv.memptr(),
+                          &(this->recvAHsize[0]), mpitype<ELEMTYPE>(),
+                          MPI_SUM,
+                          this->m_mpicomm.commSubs()[1], &scatterreq);
+      if (i + 1 < num_k_blocks) {
+        MPITIC;  // allgather AH
+        MPI_Wait(&gatherreq, MPI_STATUS_IGNORE);
+        temp = MPITOC;  // allgather AH
+        this->time_stats.communication_duration(temp);
+        this->time_stats.allgather_duration(temp);
+        this->Hjt.swap(this->Hjt_nxt);
+      }
+    }
+    MPITIC;  // reduce_scatter AH
+    MPI_Wait(&scatterreq, MPI_STATUS_IGNORE);
+    temp = MPITOC;  // reduce_scatter AH
+    this->time_stats.communication_duration(temp);
+    this->time_stats.reducescatter_duration(temp);
+    AHtij.rows((num_k_blocks - 1) * perk, num_k_blocks * perk - 1) =
+        arma::conv_to<MAT>::from(AHtij_blk_prv);
+  }
+#endif
+#ifndef USE_PACOSS
+  /**
+   * Exchanges a k x ownedsize factor for a perk x (pk * ownedsize) block
+   * over the fiber of the 3D grid. Layer l receives the rows
+   * [l*perk, (l+1)*perk) of the factor of every process of its fiber,
+   * side by side in the order of the fiber.
+   * @param[in] Xt is k x ownedsize
+   * @param[out] Xt_blk is perk x (pk * ownedsize)
+   */
+  void fiberScatter(const MAT &Xt, BLKMAT *Xt_blk) {
+    int pk = this->m_mpicomm.pk();
+    int owned = Xt.n_cols;
+    fiber_sendbuf.set_size(this->perk, pk * owned);
+    for (int l = 0; l < pk; l++) {
+      fiber_sendbuf.cols(l * owned, (l + 1) * owned - 1) =
+          arma::conv_to<BLKMAT>::from(
+              Xt.rows(l * this->perk, (l + 1) * this->perk - 1));
+    }
+    Xt_blk->set_size(this->perk, pk * owned);
+    MPITIC;  // alltoall fiber
+    MPI_Alltoall(fiber_sendbuf.memptr(), this->perk * owned,
+                 mpitype<ELEMTYPE>(), Xt_blk->memptr(), this->perk * owned,
+                 mpitype<ELEMTYPE>(), this->m_mpicomm.commSubs()[2]);
+    double temp = MPITOC;  // alltoall fiber
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allgather_duration(temp);
+  }
+  /**
+   * Reverse of fiberScatter. The perk x (pk * ownedsize) products of the
+   * layers are exchanged over the fiber and stacked into the k x
+   * ownedsize product of the columns owned by this process.
+   * @param[in] XtA_blk is perk x (pk * ownedsize)
+   * @param[out] XtA is k x ownedsize
+   */
+  void fiberGather(const BLKMAT &XtA_blk, MAT *XtA) {
+    int pk = this->m_mpicomm.pk();
+    int owned = XtA->n_cols;
+    fiber_recvbuf.set_size(this->perk, pk * owned);
+    MPITIC;  // alltoall fiber
+    MPI_Alltoall(XtA_blk.memptr(), this->perk * owned, mpitype<ELEMTYPE>(),
+                 fiber_recvbuf.memptr(), this->perk * owned,
+                 mpitype<ELEMTYPE>(), this->m_mpicomm.commSubs()[2]);
+    double temp = MPITOC;  // alltoall fiber
+    this->time_stats.communication_duration(temp);
+    this->time_stats.reducescatter_duration(temp);
+    for (int l = 0; l < pk; l++) {
+      XtA->rows(l * this->perk, (l + 1) * this->perk - 1) =
+          arma::conv_to<MAT>::from(
+              fiber_recvbuf.cols(l * owned, (l + 1) * owned - 1));
+    }
+  }
+  /**
+   * distWtA on the pr x pc x pk grid. The layer l gathers only the rows
+   * [l*k/pk, (l+1)*k/pk) of Wt over its row communicator and reduce
+   * scatters the same rows of WtA over its column communicator. This
+   * cuts the volume of both collectives by pk compared to the 2D grid
+   * at the cost of the replicated A and two alltoalls of the owned
+   * k x (m/p) and k x (n/p) blocks within the fiber.
+   */
+  void distWtA3D() {
+    fiberScatter(this->Wt, &this->Wt_blk);
+    distWtABlock();
+    fiberGather(this->WtAij_blk, &this->WtAij);
+  }
+  /// distAH on the pr x pc x pk grid. See distWtA3D.
+  void distAH3D() {
+    fiberScatter(this->Ht, &this->Ht_blk);
+    distAHBlock();
+    fiberGather(this->AHtij_blk, &this->AHtij);
+  }
+#endif
   /**
    * There are p processes.
    * Every process i has W in m_i * k
@@ -412,25 +718,49 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
    * Refer Algorithm 1 in Page 3 of
    * the PPoPP HPC-NMF paper.
    */
+  /**
+   * Saves W, H and the checkpoint_state through i_checkpoint after
+   * every checkpoint interval. If i_restart is set, computeNMF first
+   * restores the last checkpoint and continues after its iteration.
+   */
+  void checkpoint(Checkpoint *i_checkpoint, bool i_restart) {
+    this->m_checkpoint = i_checkpoint;
+    this->m_restart = i_restart;
+  }
+
   void computeNMF() {
     PRINTROOT("computeNMF started");
 
 #ifdef MPI_VERBOSE
     DISTPRINTINFO(PRINTMAT(this->A));
 #endif
-    // error computation
-    if (this->is_compute_error()) {
+    // error computation. The stopping criterion may need the gram based
+    // error even if it is not reported.
+    bool track_error = this->is_compute_error() || this->m_stop.needs_error();
+    if (track_error) {
       prevH.zeros(size(this->H));
       prevHtH.zeros(this->k, this->k);
       WtAijH.zeros(this->k, this->k);
       localWtAijH.zeros(this->k, this->k);
     }
+    unsigned int start_it = 0;
+    if (m_checkpoint != NULL && m_restart) {
+      unsigned int saved_it;
+      if (m_checkpoint->restore(checkpoint_matrices(), &saved_it)) {
+        this->Wt = this->W.t();
+        this->Ht = this->H.t();
+        checkpoint_restored();
+        start_it = saved_it + 1;
+      }
+    }
 #ifdef __WITH__BARRIER__TIMING__
     MPI_Barrier(MPI_COMM_WORLD);
 #endif
-    for (unsigned int iter = 0; iter < this->num_iterations(); iter++) {
+    for (unsigned int iter = start_it; iter < this->num_iterations(); iter++) {
+      this->m_stop.start(iter);
       // saving current instance for error computation.
-      if (iter > 0 && this->is_compute_error()) {
+      if (iter > 0 && (this->is_compute_error() ||
+                       (track_error && this->m_stop.checking()))) {
         this->prevH = this->H;
         this->prevHtH = this->HtH;
       }
@@ -450,6 +780,7 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
 #ifdef MPI_VERBOSE
         DISTPRINTINFO(PRINTMAT(this->WtAij));
 #endif
+        this->m_stop.add_pgrad(this->H, this->WtW, this->WtAij, true);
         MPITIC;  // nnls H
         // ensure both Ht and H are consistent after the update
         // some function find Ht and some H.
@@ -477,6 +808,7 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
 #ifdef MPI_VERBOSE
         DISTPRINTINFO(PRINTMAT(this->AHtij));
 #endif
+        this->m_stop.add_pgrad(this->W, this->HtH, this->AHtij, true);
         MPITIC;  // nnls W
         // Update W given HtH and AH step 3 of the algorithm.
         // ensure W and Wt are consistent. As some algorithms
@@ -495,17 +827,34 @@ class DistAUNMF : public DistNMF<INPUTMATTYPE> {
 #ifdef BUILD_SPARSE
         this->computeError(iter);
 #else
-        this->computeError2(iter);
+        // on the 3D grid Wit and Hjt hold only k/pk rows
+        if (this->m_mpicomm.pk() > 1) {
+          this->computeError(iter);
+        } else {
+          this->computeError2(iter);
+        }
 #endif
 
         PRINTROOT("it=" << iter << "::algo::" << this->m_algorithm << "::k::"
                         << this->k << "::err::" << sqrt(this->objective_err)
                         << "::relerr::"
                         << sqrt(this->objective_err / this->m_globalsqnormA));
+      } else if (iter > 0 && track_error && this->m_stop.checking()) {
+        this->computeError(iter);
       }
       PRINTROOT("completed it=" << iter
                                 << "::taken::" << this->time_stats.duration());
+      // the error of the first iteration is not available
+      if ((iter > 0 || !this->m_stop.needs_error()) && this->converged(iter)) {
+        break;
+      }
+      if (m_checkpoint != NULL && m_checkpoint->due(iter)) {
+        std::vector<MAT *> state = checkpoint_matrices();
+        m_checkpoint->save(iter,
+                           std::vector<const MAT *>(state.begin(), state.end()));
+      }
     }  // end for loop
+    if (m_checkpoint != NULL) m_checkpoint->wait();
     MPI_Barrier(MPI_COMM_WORLD);
     this->reportTime(this->time_stats.duration(), "total_d");
     this->reportTime(this->time_stats.communication_duration(), "total_comm");
@@ -5,19 +5,13 @@
 
 #include "distnmf/aunmf.hpp"
 #include "nnls/bppnnls.hpp"
+#include "nnls/bppnnlspool.hpp"
 
 /**
  * Provides the updateW and updateH for the
  * distributed ANLS/BPP algorithm.
  */
 
-#ifdef BUILD_CUDA
-#define ONE_THREAD_MATRIX_SIZE 1000
-#include <omp.h>
-#else
-#define ONE_THREAD_MATRIX_SIZE giventInput.n_cols + 5
-#endif
-
 namespace planc {
 
 template <class INPUTMATTYPE>
@@ -25,6 +19,8 @@ class DistANLSBPP : public DistAUNMF<INPUTMATTYPE> {
  private:
   ROWVEC localWnorm;
   ROWVEC Wnorm;
+  /// per thread NNLS workspaces reused across the iterations
+  BPPNNLSPool<MAT, VEC> nnlsPool;
 
   void allocateMatrices() {}
 
@@ -32,54 +28,9 @@ class DistANLSBPP : public DistAUNMF<INPUTMATTYPE> {
    * Multi threaded ANLS/BPP using openMP
    */
   void updateOtherGivenOneMultipleRHS(const MAT& giventGiven,
-                                      const MAT& giventInput, MAT* othermat) {
-    UINT numThreads = (giventInput.n_cols / ONE_THREAD_MATRIX_SIZE) + 1;
-#pragma omp parallel for schedule(dynamic)
-    for (UINT i = 0; i < numThreads; i++) {
-      UINT spanStart = i * ONE_THREAD_MATRIX_SIZE;
-      UINT spanEnd = (i + 1) * ONE_THREAD_MATRIX_SIZE - 1;
-      if (spanEnd > giventInput.n_cols - 1) {
-        spanEnd = giventInput.n_cols - 1;
-      }
-      // if it is exactly divisible, the last iteration is unnecessary.
-      BPPNNLS<MAT, VEC>* subProblem;
-      if (spanStart <= spanEnd) {
-        if (spanStart == spanEnd) {
-          subProblem = new BPPNNLS<MAT, VEC>(
-              giventGiven, (VEC)giventInput.col(spanStart), true);
-        } else {  // if (spanStart < spanEnd)
-          subProblem = new BPPNNLS<MAT, VEC>(
-              giventGiven, (MAT)giventInput.cols(spanStart, spanEnd), true);
-        }
-#ifdef MPI_VERBOSE
-#pragma omp parallel
-        {
-          DISTPRINTINFO("Scheduling " << worh << " start=" << spanStart
-                                      << ", end=" << spanEnd
-                                      << ", tid=" << omp_get_thread_num());
-        }
-#endif
-        subProblem->solveNNLS();
-#ifdef MPI_VERBOSE
-#pragma omp parallel
-        {
-          DISTPRINTINFO("completed " << worh << " start=" << spanStart
-                                     << ", end=" << spanEnd
-                                     << ", tid=" << omp_get_thread_num()
-                                     << " cpu=" << sched_getcpu());
-        }
-#endif
-        if (spanStart == spanEnd) {
-          ROWVEC solVec = subProblem->getSolutionVector().t();
-          (*othermat).row(i) = solVec;
-        } else {  // if (spanStart < spanEnd)
-          (*othermat).rows(spanStart, spanEnd) =
-              subProblem->getSolutionMatrix().t();
-        }
-        subProblem->clear();
-        delete subProblem;
-      }
-    }
+                                      const MAT& giventInput, MAT* othermat,
+                                      char worh) {
+    nnlsPool.solve(giventGiven, giventInput, othermat, true, worh);
   }
 
  protected:
@@ -90,7 +41,7 @@ class DistANLSBPP : public DistAUNMF<INPUTMATTYPE> {
    * this->HtH is of size kxk
   */
   void updateW() {
-    updateOtherGivenOneMultipleRHS(this->HtH, this->AHtij, &this->W);
+    updateOtherGivenOneMultipleRHS(this->HtH, this->AHtij, &this->W, 'W');
     this->Wt = this->W.t();
   }
   /**
@@ -100,7 +51,7 @@ class DistANLSBPP : public DistAUNMF<INPUTMATTYPE> {
    * this->WtW is of size kxk
    */  
   void updateH() {
-    updateOtherGivenOneMultipleRHS(this->WtW, this->WtAij, &this->H);
+    updateOtherGivenOneMultipleRHS(this->WtW, this->WtAij, &this->H, 'H');
     this->Ht = this->H.t();
   }
 
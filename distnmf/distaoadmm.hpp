@@ -76,6 +76,15 @@ class DistAOADMM : public DistAUNMF<INPUTMATTYPE> {
   }
 
  protected:
+  /// the duals are carried over the outer iterations
+  void checkpoint_state(std::vector<MAT *> *o_state) {
+    o_state->push_back(&this->Ut);
+    o_state->push_back(&this->Vt);
+  }
+  void checkpoint_restored() {
+    this->U = this->Ut.t();
+    this->V = this->Vt.t();
+  }
   /// updateW given HtH and AHt
   void updateW() {
     // Calculate modified Gram Matrix
@@ -5,8 +5,14 @@
 
 #include <unistd.h>
 #include <armadillo>
+#include <cstdint>
+#include <fstream>
 #include <string>
+#include <vector>
 #include "common/distutils.hpp"
+#ifdef BUILD_SPARSE
+#include "common/spmatio.hpp"
+#endif
 #include "distnmf/mpicomm.hpp"
 
 /**
@@ -42,6 +48,82 @@ class DistIO {
 #endif
 
   const iodistributions m_distio;
+  // zero based permuted index of every original row and column or -1,
+  // as written by utilities/partition-balanced. Only held by rank 0.
+  std::vector<int64_t> m_rowmap;
+  std::vector<int64_t> m_colmap;
+  // true if the TWOD input came with the index maps
+  bool m_permuted;
+
+  static bool read_index_map(const std::string& name,
+                             std::vector<int64_t>* map) {
+    std::ifstream ifs(name.c_str());
+    if (!ifs.is_open()) return false;
+    map->clear();
+    int64_t idx;
+    while (ifs >> idx) map->push_back(idx);
+    return ifs.eof() && !map->empty();
+  }
+  /**
+   * Collective. Looks for file_name_rowmap and file_name_colmap next to
+   * the TWOD input. Only supported on the 2D grid.
+   */
+  void read_index_maps(const std::string& file_name) {
+    int found = 0;
+    if (MPI_RANK == 0) {
+      found = read_index_map(file_name + "_rowmap", &m_rowmap) &&
+              read_index_map(file_name + "_colmap", &m_colmap);
+    }
+    MPI_Bcast(&found, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    m_permuted = found && this->m_mpicomm.pk() == 1;
+    if (found && !m_permuted && MPI_RANK == 0) {
+      WARN << "index maps of " << file_name << " are ignored on the 3D grid"
+           << std::endl;
+    } else if (m_permuted && MPI_RANK == 0) {
+      INFO << "read the index maps of " << file_name
+           << ". W and H are written in the original order." << std::endl;
+    }
+  }
+  /**
+   * Collective. Gathers the row blocks of X on rank 0 and writes them in
+   * the original order given by map. The rows dropped by the partitioner
+   * are zero.
+   * @param[in] X local block of the factor
+   * @param[in] block position of X in the permuted order of the rows
+   * @param[in] map from the original to the permuted row index
+   * @param[in] name of the output file
+   */
+  void write_unpermuted(const MAT& X, int block,
+                        const std::vector<int64_t>& map,
+                        const std::string& name) {
+    MAT Xt = X.t();
+    MAT all;
+    std::vector<int> blocks;
+    if (MPI_RANK == 0) {
+      all.set_size(X.n_cols, X.n_rows * MPI_SIZE);
+      blocks.resize(MPI_SIZE);
+    }
+    MPI_Gather(&block, 1, MPI_INT, blocks.data(), 1, MPI_INT, 0,
+               MPI_COMM_WORLD);
+    MPI_Gather(Xt.memptr(), Xt.n_elem, MPI_DOUBLE, all.memptr(), Xt.n_elem,
+               MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (MPI_RANK != 0) return;
+    // column of all that holds the first row of every block
+    std::vector<UWORD> block_start(MPI_SIZE);
+    for (int r = 0; r < MPI_SIZE; r++) block_start[blocks[r]] = r * X.n_rows;
+    const int64_t total = X.n_rows * MPI_SIZE;
+    MAT out = arma::zeros<MAT>(map.size(), X.n_cols);
+    for (UWORD i = 0; i < map.size(); i++) {
+      if (map[i] < 0) continue;
+      if (map[i] >= total) {
+        ERR << "index map of " << name << " does not match the grid" << std::endl;
+        return;
+      }
+      UWORD col = block_start[map[i] / X.n_rows] + map[i] % X.n_rows;
+      out.row(i) = all.col(col).t();
+    }
+    out.save(name, arma::raw_ascii);
+  }
   /**
    * A random matrix is always needed for sparse case
    * to get the pattern. That is., the indices where
@@ -94,20 +176,22 @@ class DistIO {
 #ifndef BUILD_SPARSE
   /* normalization */
   void normalize(normtype i_normtype) {
-    ROWVEC globalnormA = arma::zeros<ROWVEC>(m_A.n_cols);
-    ROWVEC normc = arma::zeros<ROWVEC>(m_A.n_cols);
+    typedef typename MATTYPE::elem_type ELEMTYPE;
+    typedef arma::Row<ELEMTYPE> NORMVEC;
+    NORMVEC globalnormA = arma::zeros<NORMVEC>(m_A.n_cols);
+    NORMVEC normc = arma::zeros<NORMVEC>(m_A.n_cols);
     MATTYPE normmat = arma::zeros<MATTYPE>(m_A.n_rows, m_A.n_cols);
     switch (m_distio) {
       case ONED_ROW:
         if (i_normtype == L2NORM) {
           normc = arma::sum(arma::square(m_A));
           MPI_Allreduce(normc.memptr(), globalnormA.memptr(), m_A.n_cols,
-                        MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+                        mpitype<ELEMTYPE>(), MPI_SUM, MPI_COMM_WORLD);
 
         } else if (i_normtype == MAXNORM) {
           normc = arma::max(m_A);
           MPI_Allreduce(normc.memptr(), globalnormA.memptr(), m_A.n_cols,
-                        MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+                        mpitype<ELEMTYPE>(), MPI_MAX, MPI_COMM_WORLD);
         }
 
         break;
@@ -123,11 +207,11 @@ class DistIO {
         if (i_normtype == L2NORM) {
           normc = arma::sum(arma::square(m_A));
           MPI_Allreduce(normc.memptr(), globalnormA.memptr(), m_A.n_cols,
-                        MPI_DOUBLE, MPI_SUM, this->m_mpicomm.commSubs()[1]);
+                        mpitype<ELEMTYPE>(), MPI_SUM, this->m_mpicomm.commSubs()[1]);
         } else if (i_normtype == MAXNORM) {
           normc = arma::max(m_A);
           MPI_Allreduce(normc.memptr(), globalnormA.memptr(), m_A.n_cols,
-                        MPI_DOUBLE, MPI_SUM, this->m_mpicomm.commSubs()[1]);
+                        mpitype<ELEMTYPE>(), MPI_SUM, this->m_mpicomm.commSubs()[1]);
         }
         break;
       default:
@@ -214,7 +298,7 @@ class DistIO {
       MAT myHcols = Hrnd.cols(start_col, end_col);
       templr = myWrnd * myHcols;
     }
-    (*X) = ceil(kalpha * templr + kbeta);
+    (*X) = arma::conv_to<MATTYPE>::from(ceil(kalpha * templr + kbeta));
 #endif
   }
 
@@ -311,7 +395,7 @@ class DistIO {
 
  public:
   DistIO<MATTYPE>(const MPICommunicator& mpic, const iodistributions& iod)
-      : m_mpicomm(mpic), m_distio(iod) {}
+      : m_mpicomm(mpic), m_distio(iod), m_permuted(false) {}
   /**
    * We need m,n,pr,pc only for rand matrices. If otherwise we are
    * expecting the file will hold all the details.
@@ -369,8 +453,10 @@ class DistIO {
           break;
         }
         case TWOD:
+          // the layers of the 3D grid generate the same replica of A
           m_A.zeros(m / pr, n / pc);
-          randMatrix(type, MPI_RANK + kPrimeOffset, sparsity, &m_A);
+          randMatrix(type, this->m_mpicomm.layer_rank() + kPrimeOffset,
+                     sparsity, &m_A);
           if (type == "lowrank") {
             randomLowRank(m, n, k, &m_A);
           }
@@ -381,7 +467,11 @@ class DistIO {
       if (m_distio == ONED_ROW || m_distio == ONED_DOUBLE) {
         sr << file_name << "rows_" << MPI_SIZE << "_" << MPI_RANK;
 #ifdef BUILD_SPARSE
-        m_Arows.load(sr.str(), arma::coord_ascii);
+        if (!load_sp_mat(sr.str(), &m_Arows)) {
+          ERR << "rank::" << MPI_RANK << "::could not load::" << sr.str()
+              << std::endl;
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
         uniform_dist_matrix(m_Arows);
 #else
         m_Arows.load(sr.str());
@@ -390,7 +480,11 @@ class DistIO {
       if (m_distio == ONED_COL || m_distio == ONED_DOUBLE) {
         sc << file_name << "cols_" << MPI_SIZE << "_" << MPI_RANK;
 #ifdef BUILD_SPARSE
-        m_Acols.load(sc.str(), arma::coord_ascii);
+        if (!load_sp_mat(sc.str(), &m_Acols)) {
+          ERR << "rank::" << MPI_RANK << "::could not load::" << sc.str()
+              << std::endl;
+          MPI_Abort(MPI_COMM_WORLD, 1);
+        }
         uniform_dist_matrix(m_Acols);
 #else
         m_Acols.load(sc.str());
@@ -399,29 +493,19 @@ class DistIO {
       }
       if (m_distio == TWOD) {
         // sr << file_name << "_" << MPI_SIZE << "_" << MPI_RANK;
-        sr << file_name << MPI_RANK;
+        sr << file_name << this->m_mpicomm.layer_rank();
 #ifdef BUILD_SPARSE
-        MAT temp_ijv;
-        temp_ijv.load(sr.str(), arma::raw_ascii);
-        if (temp_ijv.n_rows > 0 && temp_ijv.n_cols > 0) {
-          MAT vals(2, temp_ijv.n_rows);
-          MAT idxs_only = temp_ijv.cols(0, 1);
-          arma::umat idxs = arma::conv_to<arma::umat>::from(idxs_only);
-          arma::umat idxst = idxs.t();
-          vals = temp_ijv.col(2);
-          SP_MAT temp_spmat(idxst, vals);
-          m_A = temp_spmat;
-        } else {
-          arma::umat idxs = arma::zeros<arma::umat>(2, 1);
-          VEC vals = arma::zeros<VEC>(1);
-          SP_MAT temp_spmat(idxs, vals);
-          m_A = temp_spmat;
+        // text ijv or binary CSC. Empty block becomes an empty 1x1.
+        if (!load_sp_mat(sr.str(), &m_A)) {
+          ERR << "rank::" << MPI_RANK << "::could not load::" << sr.str()
+              << std::endl;
+          MPI_Abort(MPI_COMM_WORLD, 1);
         }
-        // m_A.load(sr.str(), arma::coord_ascii);
         uniform_dist_matrix(m_A);
 #else
         m_A.load(sr.str());
 #endif
+        read_index_maps(file_name);
       }
     }
 #ifndef BUILD_SPARSE
@@ -432,12 +516,25 @@ class DistIO {
   }
   /**
    * Writes the factor matrix as output_file_name_W_MPISIZE_MPIRANK
+   * If the input came with the index maps of partition-balanced, rank 0
+   * instead writes the whole W and H in the original order of the rows
+   * and the columns as output_file_name_W and output_file_name_H.
    * @param[in] Local W factor matrix
    * @param[in] Local H factor matrix
    * @param[in] output file name
    */
   void writeOutput(const MAT& W, const MAT& H,
                    const std::string& output_file_name) {
+    if (m_permuted) {
+      // W is ordered W_0, W_1, .. and H column major over the grid.
+      int pr = this->m_mpicomm.pr();
+      int pc = this->m_mpicomm.pc();
+      int wblock = this->m_mpicomm.row_rank() * pc + this->m_mpicomm.col_rank();
+      int hblock = this->m_mpicomm.col_rank() * pr + this->m_mpicomm.row_rank();
+      write_unpermuted(W, wblock, m_rowmap, output_file_name + "_W");
+      write_unpermuted(H, hblock, m_colmap, output_file_name + "_H");
+      return;
+    }
     std::stringstream sw, sh;
     sw << output_file_name << "_W_" << MPI_SIZE << "_" << MPI_RANK;
     sh << output_file_name << "_H_" << MPI_SIZE << "_" << MPI_RANK;
@@ -1,6 +1,7 @@
 /* Copyright 2016 Ramakrishnan Kannan */
 
 #include <string>
+#include "common/checkpoint.hpp"
 #include "common/distutils.hpp"
 #include "common/parsecommandline.hpp"
 #include "common/utils.hpp"
@@ -19,6 +20,14 @@
 
 namespace planc {
 
+// Dense input of the 2D algorithms. With MIXED_PRECISION the input and
+// the communicated factor blocks are single precision.
+#ifdef MIXED_PRECISION
+#define DENSE_INPUT_MAT FMAT
+#else
+#define DENSE_INPUT_MAT MAT
+#endif
+
 class DistNMFDriver {
  private:
   int m_argc;
@@ -30,6 +39,8 @@ class DistNMFDriver {
   int m_num_it;
   int m_pr;
   int m_pc;
+  int m_pk;
+  bool m_auto_grid;
   FVEC m_regW;
   FVEC m_regH;
   algotype m_nmfalgo;
@@ -39,6 +50,10 @@ class DistNMFDriver {
   int m_num_k_blocks;
   static const int kprimeoffset = 17;
   normtype m_input_normalization;
+  StopCriterion m_stop;
+  std::string m_checkpoint_prefix;
+  int m_checkpoint_every;
+  bool m_restart;
 
 #ifdef BUILD_CUDA
   void printDevProp(cudaDeviceProp devProp) {
@@ -87,13 +102,17 @@ class DistNMFDriver {
          << "::k::" << this->m_k << "::m::" << this->m_globalm
          << "::n::" << this->m_globaln << "::t::" << this->m_num_it
          << "::pr::" << this->m_pr << "::pc::" << this->m_pc
+         << "::pk::" << this->m_pk
          << "::error::" << this->m_compute_error
          << "::distio::" << this->m_distio << "::regW::"
          << "l2::" << this->m_regW(0) << "::l1::" << this->m_regW(1)
          << "::regH::"
          << "l2::" << this->m_regH(0) << "::l1::" << this->m_regH(1)
          << "::num_k_blocks::" << this->m_num_k_blocks
-         << "::normtype::" << this->m_input_normalization << std::endl;
+         << "::normtype::" << this->m_input_normalization
+         << "::stop::" << this->m_stop.name()
+         << "::tol::" << this->m_stop.tolerance()
+         << "::checkevery::" << this->m_stop.check_every() << std::endl;
   }
 
   template <class NMFTYPE>
@@ -157,10 +176,37 @@ class DistNMFDriver {
     }
   }
 
+  /**
+   * Picks pr x pc of a layer with the least modeled communication
+   * when -p is not given. MPI is initialized here for the number of
+   * processes. The communicator leaves the initialized MPI alone.
+   */
+  void autoGrid() {
+    int numprocs, rank;
+    MPI_Init(&this->m_argc, &this->m_argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    UVEC dims(2);
+    dims(0) = this->m_globalm;
+    dims(1) = this->m_globaln;
+    UVEC grid = best_processor_grid(numprocs / this->m_pk, dims, this->m_k);
+    this->m_pr = grid(0);
+    this->m_pc = grid(1);
+    if (rank == 0) {
+      INFO << "auto grid::pr::" << this->m_pr << "::pc::" << this->m_pc
+           << "::pk::" << this->m_pk << "::modeled words::"
+           << grid_cost(grid, dims, this->m_k) << std::endl;
+    }
+  }
+
   template <class NMFTYPE>
   void callDistNMF2D() {
     std::string rand_prefix("rand_");
-    MPICommunicator mpicomm(this->m_argc, this->m_argv, this->m_pr, this->m_pc);
+#ifndef USE_PACOSS
+    if (this->m_auto_grid) autoGrid();
+#endif
+    MPICommunicator mpicomm(this->m_argc, this->m_argv, this->m_pr, this->m_pc,
+                            this->m_pk);
 // #ifdef BUILD_CUDA
 //         if (mpicomm.rank()==0){
 //             gpuQuery();
@@ -197,8 +243,8 @@ class DistNMFDriver {
 #else  // ifdef USE_PACOSS
 
     if ((this->m_pr > 0) && (this->m_pc > 0) &&
-        (this->m_pr * this->m_pc != mpicomm.size())) {
-      ERR << "pr*pc is not MPI_SIZE" << std::endl;
+        (this->m_pr * this->m_pc * this->m_pk != mpicomm.size())) {
+      ERR << "pr*pc*pk is not MPI_SIZE" << std::endl;
       MPI_Barrier(MPI_COMM_WORLD);
       MPI_Abort(MPI_COMM_WORLD, 1);
     }
@@ -209,7 +255,7 @@ class DistNMFDriver {
       INFO << "sparse case" << std::endl;
     }
 #else   // ifdef BUILD_SPARSE
-    DistIO<MAT> dio(mpicomm, m_distio);
+    DistIO<DENSE_INPUT_MAT> dio(mpicomm, m_distio);
 #endif  // ifdef BUILD_SPARSE. One outstanding PACOSS
 
     if (m_Afile_name.compare(0, rand_prefix.size(), rand_prefix) == 0) {
@@ -224,7 +270,7 @@ class DistNMFDriver {
     // dio.A().n_rows, dio.A().n_cols);
     SP_MAT A(dio.A());
 #else   // ifdef BUILD_SPARSE
-    MAT A(dio.A());
+    DENSE_INPUT_MAT A(dio.A());
 #endif  // ifdef BUILD_SPARSE. One outstanding PACOSS
 
     if (m_Afile_name.compare(0, rand_prefix.size(), rand_prefix) != 0) {
@@ -246,6 +292,10 @@ class DistNMFDriver {
     // don't worry about initializing with the
     // same matrix as only one of them will be used.
     arma::arma_rng::set_seed(mpicomm.rank());
+    Checkpoint checkpoint(this->m_checkpoint_prefix, mpicomm.rank(),
+                          this->m_checkpoint_every);
+    // the factors come from the checkpoint. skip the warm start.
+    bool restart = this->m_restart && checkpoint.available();
 #ifdef USE_PACOSS
     MAT W = arma::randu<MAT>(rowcomm->localOwnedRowCount(), this->m_k);
     MAT H = arma::randu<MAT>(colcomm->localOwnedRowCount(), this->m_k);
@@ -258,7 +308,7 @@ class DistNMFDriver {
         // initializer we run couple of iterations of HALS.
 #ifndef USE_PACOSS
 #ifdef BUILD_SPARSE
-    if (m_nmfalgo == ANLSBPP) {
+    if (m_nmfalgo == ANLSBPP && !restart) {
       DistHALS<SP_MAT> lrinitializer(A, W, H, mpicomm, this->m_num_k_blocks);
       lrinitializer.num_iterations(4);
       lrinitializer.algorithm(HALS);
@@ -286,10 +336,12 @@ class DistNMFDriver {
 #endif  // ifdef USE_PACOSS
     memusage(mpicomm.rank(), "after constructor ");
     nmfAlgorithm.num_iterations(this->m_num_it);
+    nmfAlgorithm.stop_criterion(this->m_stop);
     nmfAlgorithm.compute_error(this->m_compute_error);
     nmfAlgorithm.algorithm(this->m_nmfalgo);
     nmfAlgorithm.regW(this->m_regW);
     nmfAlgorithm.regH(this->m_regH);
+    if (checkpoint.enabled()) nmfAlgorithm.checkpoint(&checkpoint, restart);
     MPI_Barrier(MPI_COMM_WORLD);
     try {
       mpitic();
@@ -316,12 +368,37 @@ class DistNMFDriver {
     this->m_Afile_name = pc.input_file_name();
     this->m_pr = pc.pr();
     this->m_pc = pc.pc();
+    this->m_pk = pc.pk();
+    this->m_auto_grid = pc.auto_grid();
+    if (this->m_pk < 1 || this->m_k % this->m_pk != 0) {
+      WARN << "pk::" << this->m_pk << " does not divide k::" << this->m_k
+           << ". Using the 2D grid." << std::endl;
+      this->m_pk = 1;
+    }
+#ifdef USE_PACOSS
+    this->m_pk = 1;
+#endif
     this->m_sparsity = pc.sparsity();
     this->m_num_it = pc.iterations();
+    this->m_stop = pc.stop_criterion();
+    this->m_checkpoint_prefix = pc.checkpoint_prefix();
+    this->m_checkpoint_every = pc.checkpoint_every();
+    this->m_restart = pc.restart();
+    if (this->m_restart && this->m_checkpoint_prefix.empty()) {
+      WARN << "--restart needs --checkpoint. Starting from the beginning."
+           << std::endl;
+      this->m_restart = false;
+    }
     this->m_distio = TWOD;
     this->m_regW = pc.regW();
     this->m_regH = pc.regH();
-    this->m_num_k_blocks = 1;
+    this->m_num_k_blocks = pc.num_k_blocks();
+    if (this->m_num_k_blocks < 1 || this->m_k % this->m_num_k_blocks != 0) {
+      WARN << "num_k_blocks::" << this->m_num_k_blocks
+           << " does not divide k::" << this->m_k << ". Using a single block."
+           << std::endl;
+      this->m_num_k_blocks = 1;
+    }
     this->m_globalm = pc.globalm();
     this->m_globaln = pc.globaln();
     this->m_compute_error = pc.compute_error();
@@ -337,21 +414,21 @@ class DistNMFDriver {
 #ifdef BUILD_SPARSE
         callDistNMF2D<DistMU<SP_MAT> >();
 #else   // ifdef BUILD_SPARSE
-        callDistNMF2D<DistMU<MAT> >();
+        callDistNMF2D<DistMU<DENSE_INPUT_MAT> >();
 #endif  // ifdef BUILD_SPARSE
         break;
       case HALS:
 #ifdef BUILD_SPARSE
         callDistNMF2D<DistHALS<SP_MAT> >();
 #else   // ifdef BUILD_SPARSE
-        callDistNMF2D<DistHALS<MAT> >();
+        callDistNMF2D<DistHALS<DENSE_INPUT_MAT> >();
 #endif  // ifdef BUILD_SPARSE
         break;
       case ANLSBPP:
 #ifdef BUILD_SPARSE
         callDistNMF2D<DistANLSBPP<SP_MAT> >();
 #else   // ifdef BUILD_SPARSE
-        callDistNMF2D<DistANLSBPP<MAT> >();
+        callDistNMF2D<DistANLSBPP<DENSE_INPUT_MAT> >();
 #endif  // ifdef BUILD_SPARSE
         break;
       case NAIVEANLSBPP:
@@ -365,13 +442,13 @@ class DistNMFDriver {
 #ifdef BUILD_SPARSE
         callDistNMF2D<DistAOADMM<SP_MAT> >();
 #else   // ifdef BUILD_SPARSE
-        callDistNMF2D<DistAOADMM<MAT> >();
+        callDistNMF2D<DistAOADMM<DENSE_INPUT_MAT> >();
 #endif  // ifdef BUILD_SPARSE
       case CPALS:
 #ifdef BUILD_SPARSE
         callDistNMF2D<DistALS<SP_MAT> >();
 #else   // ifdef BUILD_SPARSE
-        callDistNMF2D<DistALS<MAT> >();
+        callDistNMF2D<DistALS<DENSE_INPUT_MAT> >();
 #endif  // ifdef BUILD_SPARSE
       default:
         ERR << "Unsupport algorithm" <<  this->m_nmfalgo << std::endl;
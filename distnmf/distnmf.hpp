@@ -31,6 +31,29 @@ class DistNMF : public NMF<INPUTMATTYPE> {
   ROWVEC localWnorm;
   ROWVEC Wnorm;
 
+  /**
+   * Distributed version of NMF::converged. The local sums of the
+   * stopping criterion are allreduced before it is evaluated, so that
+   * all the processes stop in the same iteration.
+   * @param[in] iteration for logging
+   * @return true if the iterations can stop
+   */
+  bool converged(int iteration) {
+    if (!this->m_stop.checking()) return false;
+    this->m_stop.add_factor(0, this->W);
+    this->m_stop.add_factor(1, this->H);
+    MPI_Allreduce(MPI_IN_PLACE, this->m_stop.sums(), 2, MPI_DOUBLE, MPI_SUM,
+                  MPI_COMM_WORLD);
+    bool done = this->m_stop.converged(
+        sqrt(this->objective_err / this->m_globalsqnormA));
+    if (done) {
+      PRINTROOT("converged at it=" << iteration << "::"
+                                   << this->m_stop.name()
+                                   << "::" << this->m_stop.measure());
+    }
+    return done;
+  }
+
  public:
   /**
    * There are totally prxpc process.
@@ -50,6 +73,8 @@ class DistNMF : public NMF<INPUTMATTYPE> {
     this->m_globaln = 0;
     MPI_Allreduce(&sqnorma, &(this->m_globalsqnormA), 1, MPI_DOUBLE, MPI_SUM,
                   MPI_COMM_WORLD);
+    // every layer of the 3D grid holds a replica of A
+    this->m_globalsqnormA /= this->m_mpicomm.pk();
     this->m_ownedm = this->W.n_rows;
     this->m_ownedn = this->H.n_rows;
 #ifdef USE_PACOSS
@@ -13,7 +13,10 @@
 
 /**
  * Class and function for 2D MPI communicator
- * with row and column communicators
+ * with row and column communicators.
+ * Optionally the grid is pr x pc x pk. Every one of the pk layers is a
+ * pr x pc grid with its own row and column communicators and the
+ * processes with the same (row, col) across the layers form a fiber.
  */
 
 namespace planc {
@@ -27,6 +30,8 @@ class MPICommunicator {
   int m_col_rank;
   int m_col_size;
   int m_pr, m_pc;
+  int m_pk;
+  int m_layer;
 
   // for 2D communicators
   // MPI Related stuffs
@@ -37,10 +42,11 @@ class MPICommunicator {
       INFO << "size=" << size() << std::endl;
       INFO << "rowsize=" << m_row_size << ":pr=" << m_pr << std::endl;
       INFO << "colsize=" << m_col_size << ":pc=" << m_pc << std::endl;
+      INFO << "pk=" << m_pk << std::endl;
     }
     MPI_Barrier(MPI_COMM_WORLD);
     INFO << ":rank=" << rank() << ":row_rank=" << row_rank() << ":colrank"
-         << col_rank() << std::endl;
+         << col_rank() << ":layer=" << layer() << std::endl;
   }
 
  public:
@@ -54,6 +60,8 @@ class MPICommunicator {
 #endif
     MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &m_numProcs);
+    m_pk = 1;
+    m_layer = 0;
   }
   ~MPICommunicator() {
     MPI_Barrier(MPI_COMM_WORLD);
@@ -63,34 +71,45 @@ class MPICommunicator {
     MPI_Finalize();
 #endif
   }
-  MPICommunicator(int argc, char *argv[], int pr, int pc) {
+  /**
+   * Sets up the pr x pc grid, or the pr x pc x pk grid for pk > 1.
+   * The ranks are row major in the grid. So the processes of a fiber
+   * are consecutive and (row, col) of every layer has the same
+   * layer_rank as the rank of the process (row, col) of the 2D grid.
+   * MPI may already be initialized by the caller to pick the grid.
+   */
+  MPICommunicator(int argc, char *argv[], int pr, int pc, int pk = 1) {
 #ifdef USE_PACOSS
     TMPI_Init(&argc, &argv);
 #else
-    MPI_Init(&argc, &argv);
+    int initialized;
+    MPI_Initialized(&initialized);
+    if (!initialized) MPI_Init(&argc, &argv);
 #endif
     MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &m_numProcs);
     int reorder = 0;
     std::vector<int> dimSizes;
     std::vector<int> periods;
-    int nd = 2;
+    int nd = (pk > 1) ? 3 : 2;
     dimSizes.resize(nd);
     this->m_pr = pr;
     this->m_pc = pc;
+    this->m_pk = pk;
     dimSizes[0] = pr;
     dimSizes[1] = pc;
+    if (nd == 3) dimSizes[2] = pk;
     periods.resize(nd);
     MPI_Comm gridComm;
     std::vector<int> gridCoords;
     fillVector<int>(1, &periods);
     // int MPI_Cart_create(MPI_Comm comm_old, int ndims, const int dims[],
     //                const int periods[], int reorder, MPI_Comm *comm_cart)
-    if (dimSizes[0] * dimSizes[1] != m_numProcs) {
+    if (pr * pc * pk != m_numProcs) {
       if (m_rank == 0) {
         std::cerr << "Processor grid dimensions do not"
-                  << "multiply to MPI_SIZE::" << dimSizes[0] << 'x'
-                  << dimSizes[1] << "::m_numProcs::" << m_numProcs << std::endl;
+                  << "multiply to MPI_SIZE::" << pr << 'x' << pc << 'x' << pk
+                  << "::m_numProcs::" << m_numProcs << std::endl;
       }
       MPI_Barrier(MPI_COMM_WORLD);
       MPI_Abort(MPI_COMM_WORLD, 1);
@@ -110,6 +129,9 @@ class MPICommunicator {
     MPI_Comm_size(m_commSubs[1], &m_col_size);
     MPI_Comm_rank(m_commSubs[0], &m_row_rank);
     MPI_Comm_rank(m_commSubs[1], &m_col_rank);
+    m_layer = 0;
+    if (nd == 3) MPI_Comm_rank(m_commSubs[2], &m_layer);
+    delete[] keepCols;
 #ifdef MPI_VERBOSE
     printConfig();
 #endif
@@ -126,6 +148,17 @@ class MPICommunicator {
   const int pr() const { return m_pr; }
   /// Total number of column processor
   const int pc() const { return m_pc; }
+  /// Number of layers of the grid. 1 for the 2D grid.
+  const int pk() const { return m_pk; }
+  /// returns the layer of this process. 0 for the 2D grid.
+  const int layer() const { return m_layer; }
+  /// returns the rank within the pr x pc layer
+  const int layer_rank() const { return m_row_rank * m_pc + m_col_rank; }
+  /**
+   * commSubs()[0] is the column and commSubs()[1] the row communicator
+   * within the layer. On the 3D grid commSubs()[2] is the fiber of pk
+   * processes with the same row and column.
+   */
   const MPI_Comm *commSubs() const { return m_commSubs; }
 };
 
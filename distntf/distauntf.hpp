@@ -2,12 +2,16 @@
 #ifndef DISTNTF_DISTAUNTF_HPP_
 #define DISTNTF_DISTAUNTF_HPP_
 
+#include <algorithm>
 #include <armadillo>
 #include <string>
 #include <vector>
+#include "common/checkpoint.hpp"
 #include "common/distutils.hpp"
 #include "common/ntf_utils.hpp"
-#include "dimtree/ddt.hpp"
+#include "common/sptensor.hpp"
+#include "common/stopcriterion.hpp"
+#include "dimtree/bdt.hpp"
 #include "distntf/distntfmpicomm.hpp"
 #include "distntf/distntftime.hpp"
 
@@ -46,9 +50,20 @@ class DistAUNTF {
   MAT global_gram;
 
   virtual MAT update(int current_mode) = 0;
+  /**
+   * Adds the state besides the local factors that the algorithm carries
+   * from one outer iteration to the next, e.g. the ADMM duals or the
+   * Nesterov iterates. Used for the checkpoints. The matrices have to be
+   * of their final sizes.
+   */
+  virtual void checkpoint_state(std::vector<MAT *> *o_state) {}
+  /// Called after the checkpoint_state is restored from a checkpoint
+  virtual void checkpoint_restored() {}
 
  private:
   const Tensor &m_input_tensor;
+  // local nonzeros of a sparse input. NULL for a dense input.
+  const SparseTensor *m_sparse_tensor;
   NCPFactors m_gathered_ncp_factors;
   NCPFactors m_gathered_ncp_factors_t;
   // mttkrp related variables
@@ -56,6 +71,8 @@ class DistAUNTF {
   // gram related variables.
   MAT factor_local_grams;    // U in the algorithm.
   MAT *factor_global_grams;  // G in the algorithm
+  // prefix and suffix hadamards of factor_global_grams
+  GramHadamard m_gram_hadamard;
 
   // NTF related variable.
   const unsigned int m_low_rank_k;
@@ -68,8 +85,12 @@ class DistAUNTF {
   FVEC m_regularizers;
   bool m_compute_error;
   bool m_enable_dim_tree;
+  // all the modes are updated from the same snapshot of the factors
+  bool m_jacobi;
   unsigned int m_current_it;
   double m_rel_error;
+  // convergence based stopping
+  StopCriterion m_stop;
 
   // needed for acceleration algorithms.
   bool m_accelerated;
@@ -81,7 +102,25 @@ class DistAUNTF {
   double m_global_sqnorm_A;
   MAT hadamard_all_grams;
 
-  DenseDimensionTree *kdt;
+  BinaryDimensionTree *kdt;
+
+  // periodic checkpoints of the local factors and the checkpoint_state.
+  // NULL if off.
+  Checkpoint *m_checkpoint;
+  bool m_restart;
+  VEC m_checkpoint_lambda;
+
+  // the rank-k is split into these many chunks and the
+  // collectives are pipelined chunk by chunk.
+  unsigned int m_num_k_blocks;
+#ifdef MPI_PIPELINE
+  // in flight state of gather_ncp_factor_begin/finish
+  std::vector<MPI_Request> m_gather_reqs;
+  std::vector<MAT> m_gather_sendblk;
+  std::vector<MAT> m_gather_recvblk;
+  std::vector<std::vector<int> > m_gather_cnts;
+  std::vector<std::vector<int> > m_gather_displs;
+#endif
 
   /**
    * do the local syrk only for the current updated factor
@@ -110,6 +149,7 @@ class DistAUNTF {
     applyReg(this->m_regularizers(current_mode * 2),
              this->m_regularizers(current_mode * 2 + 1),
              &(factor_global_grams[current_mode]));
+    m_gram_hadamard.set(current_mode, factor_global_grams[current_mode]);
     this->time_stats.communication_duration(temp);
     this->time_stats.allreduce_duration(temp);
   }
@@ -136,20 +176,14 @@ class DistAUNTF {
   }
 
   /**
-   * This iterates over all grams leaving out current mode
-   * and finds hadamard of the grams
+   * Finds the hadamard of all the grams leaving out current mode from
+   * the prefix and the suffix hadamards, i.e. in O(k^2) during a sweep.
    *
    * @param[in] current_mode.
    */
   void gram_hadamard(unsigned int current_mode) {
-    global_gram.ones();
     MPITIC;  // gram hadamard
-    for (unsigned int i = 0; i < m_modes; i++) {
-      if (i != current_mode) {
-        //%= element-wise multiplication
-        global_gram %= factor_global_grams[i];
-      }
-    }
+    m_gram_hadamard.leave_out_one(current_mode, &global_gram);
     double temp = MPITOC;  // gram hadamard
     this->time_stats.compute_duration(temp);
     this->time_stats.gram_duration(temp);
@@ -233,6 +267,174 @@ class DistAUNTF {
     this->time_stats.trans_duration(temp);
   }
 
+#ifdef MPI_PIPELINE
+  /**
+   * Nonblocking counterpart of gather_ncp_factor. The rows of the local
+   * factor transpose are split into m_num_k_blocks chunks and an
+   * MPI_Iallgatherv is posted for every chunk on the slice communicator.
+   * The caller can do local work before gather_ncp_factor_finish.
+   * @param[in] current_mode
+   */
+  void gather_ncp_factor_begin(const int current_mode) {
+    MPI_Comm current_slice_comm = this->m_mpicomm.slice(current_mode);
+    int slice_size;
+    MPI_Comm_size(current_slice_comm, &slice_size);
+    int dimsize = m_factor_local_dims[current_mode];
+    const MAT &local_factor_t = m_local_ncp_factors_t.factor(current_mode);
+
+    m_gather_reqs.assign(m_num_k_blocks, MPI_REQUEST_NULL);
+    m_gather_sendblk.resize(m_num_k_blocks);
+    m_gather_recvblk.resize(m_num_k_blocks);
+    m_gather_cnts.assign(m_num_k_blocks, std::vector<int>(slice_size, 0));
+    m_gather_displs.assign(m_num_k_blocks, std::vector<int>(slice_size, 0));
+    MPITIC;  // allgather tic
+    for (unsigned int b = 0; b < m_num_k_blocks; b++) {
+      int kb = itersplit(m_low_rank_k, m_num_k_blocks, b);
+      int ks = startidx(m_low_rank_k, m_num_k_blocks, b);
+      for (int i = 0; i < slice_size; i++) {
+        m_gather_cnts[b][i] = itersplit(dimsize, slice_size, i) * kb;
+        m_gather_displs[b][i] = startidx(dimsize, slice_size, i) * kb;
+      }
+      m_gather_sendblk[b] = local_factor_t.rows(ks, ks + kb - 1);
+      m_gather_recvblk[b].zeros(kb, dimsize);
+      MPI_Iallgatherv(m_gather_sendblk[b].memptr(),
+                      m_nls_sizes[current_mode] * kb, MPI_DOUBLE,
+                      m_gather_recvblk[b].memptr(), &m_gather_cnts[b][0],
+                      &m_gather_displs[b][0], MPI_DOUBLE, current_slice_comm,
+                      &m_gather_reqs[b]);
+    }
+    double temp = MPITOC;  // allgather toc
+    this->time_stats.communication_duration(temp);
+    this->time_stats.allgather_duration(temp);
+  }
+
+  /**
+   * Completes the chunks posted by gather_ncp_factor_begin in the order
+   * they arrive and copies each of them into the gathered factor and its
+   * transpose while the remaining chunks are still in flight.
+   * @param[in] current_mode
+   */
+  void gather_ncp_factor_finish(const int current_mode) {
+    MAT &gathered_factor_t = m_gathered_ncp_factors_t.factor(current_mode);
+    MAT &gathered_factor = m_gathered_ncp_factors.factor(current_mode);
+    double temp;
+    for (unsigned int i = 0; i < m_num_k_blocks; i++) {
+      int b;
+      MPITIC;  // allgather tic
+      MPI_Waitany(m_num_k_blocks, &m_gather_reqs[0], &b, MPI_STATUS_IGNORE);
+      temp = MPITOC;  // allgather toc
+      this->time_stats.communication_duration(temp);
+      this->time_stats.allgather_duration(temp);
+      int kb = itersplit(m_low_rank_k, m_num_k_blocks, b);
+      int ks = startidx(m_low_rank_k, m_num_k_blocks, b);
+      MPITIC;  // transpose tic
+      gathered_factor_t.rows(ks, ks + kb - 1) = m_gather_recvblk[b];
+      gathered_factor.cols(ks, ks + kb - 1) = m_gather_recvblk[b].t();
+      temp = MPITOC;  // transpose toc
+      this->time_stats.compute_duration(temp);
+      this->time_stats.trans_duration(temp);
+    }
+  }
+
+  /**
+   * Pipelined version of distmttkrp. The local MTTKRP is computed
+   * m_num_k_blocks columns of the KRP at a time and the reduce scatter
+   * of a chunk is posted as soon as it is ready, so that it progresses
+   * while the next chunk is computed. The dimension tree computes all
+   * the columns at once and hence only the chunked reduce scatters
+   * overlap with each other.
+   * @param[in] current_mode
+   */
+  void distmttkrp_pipelined(const int &current_mode) {
+    double temp;
+    MPI_Comm current_slice_comm = this->m_mpicomm.slice(current_mode);
+    int slice_size;
+    MPI_Comm_size(current_slice_comm, &slice_size);
+    int dimsize = m_factor_local_dims[current_mode];
+    // the sparse and the dimension tree mttkrp are computed at once
+    bool whole_mttkrp = this->m_enable_dim_tree || m_sparse_tensor != NULL;
+    if (m_sparse_tensor != NULL) {
+      MPITIC;  // mttkrp tic
+      m_sparse_tensor->mttkrp(current_mode, m_gathered_ncp_factors_t,
+                              &ncp_mttkrp_t[current_mode]);
+      temp = MPITOC;  // mttkrp toc
+      this->time_stats.compute_duration(temp);
+      this->time_stats.mttkrp_duration(temp);
+    } else if (this->m_enable_dim_tree) {
+      double multittv_time = 0;
+      double mttkrp_time = 0;
+      kdt->in_order_reuse_MTTKRP(current_mode,
+                                 ncp_mttkrp_t[current_mode].memptr(), false,
+                                 multittv_time, mttkrp_time);
+      this->time_stats.compute_duration(multittv_time);
+      this->time_stats.compute_duration(mttkrp_time);
+      this->time_stats.multittv_duration(multittv_time);
+      this->time_stats.mttkrp_duration(mttkrp_time);
+    } else {
+#ifndef FUSED_MTTKRP
+      MPITIC;  // krp tic
+      m_gathered_ncp_factors.krp_leave_out_one(current_mode,
+                                               &ncp_krp[current_mode]);
+      temp = MPITOC;  // krp toc
+      this->time_stats.compute_duration(temp);
+      this->time_stats.krp_duration(temp);
+#endif
+    }
+    std::vector<MPI_Request> reqs(m_num_k_blocks, MPI_REQUEST_NULL);
+    std::vector<MAT> sendblk(m_num_k_blocks);
+    std::vector<MAT> recvblk(m_num_k_blocks);
+    std::vector<std::vector<int> > recvmttkrpsize(
+        m_num_k_blocks, std::vector<int>(slice_size, 0));
+    for (unsigned int b = 0; b < m_num_k_blocks; b++) {
+      int kb = itersplit(m_low_rank_k, m_num_k_blocks, b);
+      int ks = startidx(m_low_rank_k, m_num_k_blocks, b);
+      if (whole_mttkrp) {
+        sendblk[b] = ncp_mttkrp_t[current_mode].rows(ks, ks + kb - 1);
+      } else {
+        sendblk[b].zeros(kb, dimsize);
+        MPITIC;  // mttkrp tic
+#ifdef FUSED_MTTKRP
+        m_gathered_ncp_factors.fused_mttkrp(current_mode, m_input_tensor,
+                                            &sendblk[b], ks);
+#else
+        // columns of the krp are contiguous. Alias them.
+        MAT krp_blk(ncp_krp[current_mode].colptr(ks),
+                    ncp_krp[current_mode].n_rows, kb, false, true);
+        m_input_tensor.mttkrp(current_mode, krp_blk, &sendblk[b]);
+#endif
+        temp = MPITOC;  // mttkrp toc
+        this->time_stats.compute_duration(temp);
+        this->time_stats.mttkrp_duration(temp);
+      }
+      for (int i = 0; i < slice_size; i++) {
+        recvmttkrpsize[b][i] = itersplit(dimsize, slice_size, i) * kb;
+      }
+      recvblk[b].zeros(kb, m_nls_sizes[current_mode]);
+      MPITIC;  // reduce_scatter mttkrp
+      MPI_Ireduce_scatter(sendblk[b].memptr(), recvblk[b].memptr(),
+                          &recvmttkrpsize[b][0], MPI_DOUBLE, MPI_SUM,
+                          current_slice_comm, &reqs[b]);
+      temp = MPITOC;  // reduce_scatter mttkrp
+      this->time_stats.communication_duration(temp);
+      this->time_stats.reducescatter_duration(temp);
+    }
+    MPITIC;  // reduce_scatter mttkrp
+    MPI_Waitall(m_num_k_blocks, &reqs[0], MPI_STATUSES_IGNORE);
+    temp = MPITOC;  // reduce_scatter mttkrp
+    this->time_stats.communication_duration(temp);
+    this->time_stats.reducescatter_duration(temp);
+    for (unsigned int b = 0; b < m_num_k_blocks; b++) {
+      int kb = itersplit(m_low_rank_k, m_num_k_blocks, b);
+      int ks = startidx(m_low_rank_k, m_num_k_blocks, b);
+      ncp_local_mttkrp_t[current_mode].rows(ks, ks + kb - 1) = recvblk[b];
+    }
+#ifdef DISTNTF_VERBOSE
+    DISTPRINTINFO(ncp_local_mttkrp_t[current_mode]);
+#endif
+    this->m_stale_mttkrp[current_mode] = false;
+  }
+#endif
+
   /**
    * It perform the mttkrp of the current_mode. That is., it determines
    * the KRP leaving out the current mode and matrix multiplies with the
@@ -241,8 +443,48 @@ class DistAUNTF {
    * @param[in] current_mode
    */
   void distmttkrp(const int &current_mode) {
+#ifdef MPI_PIPELINE
+    distmttkrp_pipelined(current_mode);
+    return;
+#endif
+    local_mttkrp(current_mode);
+    reduce_scatter_mttkrp(current_mode);
+  }
+  /**
+   * Jacobi counterpart of distmttkrp. The local mttkrps of all the stale
+   * modes are computed with the same gathered factors. For the dense
+   * tensor without the dimension tree, the local tensor is traversed
+   * only once for all of them. Then every mode is reduce scattered.
+   */
+  void distmttkrp_all() {
+    std::vector<MAT *> out(m_modes, static_cast<MAT *>(NULL));
+    for (unsigned int i = 0; i < m_modes; i++) {
+      if (is_stale_mttkrp(i)) out[i] = &ncp_mttkrp_t[i];
+    }
+    if (m_sparse_tensor == NULL && !this->m_enable_dim_tree) {
+      MPITIC;  // mttkrp tic
+      m_gathered_ncp_factors.mttkrp_all(m_input_tensor, out);
+      double temp = MPITOC;  // mttkrp toc
+      this->time_stats.compute_duration(temp);
+      this->time_stats.mttkrp_duration(temp);
+    } else {
+      for (unsigned int i = 0; i < m_modes; i++) {
+        if (out[i] != NULL) local_mttkrp(i);
+      }
+    }
+    for (unsigned int i = 0; i < m_modes; i++) {
+      if (out[i] != NULL) reduce_scatter_mttkrp(i);
+    }
+  }
+  /**
+   * mttkrp of the local tensor with the gathered factors into
+   * ncp_mttkrp_t[current_mode].
+   * @param[in] current_mode
+   */
+  void local_mttkrp(const int &current_mode) {
     double temp;
-    if (!this->m_enable_dim_tree) {
+#ifndef FUSED_MTTKRP
+    if (!this->m_enable_dim_tree && m_sparse_tensor == NULL) {
       MPITIC;  // krp tic
       m_gathered_ncp_factors.krp_leave_out_one(current_mode,
                                                &ncp_krp[current_mode]);
@@ -250,8 +492,16 @@ class DistAUNTF {
       this->time_stats.compute_duration(temp);
       this->time_stats.krp_duration(temp);
     }
+#endif
 
-    if (this->m_enable_dim_tree) {
+    if (m_sparse_tensor != NULL) {
+      MPITIC;  // mttkrp tic
+      m_sparse_tensor->mttkrp(current_mode, m_gathered_ncp_factors_t,
+                              &ncp_mttkrp_t[current_mode]);
+      temp = MPITOC;  // mttkrp toc
+      this->time_stats.compute_duration(temp);
+      this->time_stats.mttkrp_duration(temp);
+    } else if (this->m_enable_dim_tree) {
       double multittv_time = 0;
       double mttkrp_time = 0;
       kdt->in_order_reuse_MTTKRP(current_mode,
@@ -264,8 +514,13 @@ class DistAUNTF {
 
     } else {
       MPITIC;  // mttkrp tic
+#ifdef FUSED_MTTKRP
+      m_gathered_ncp_factors.fused_mttkrp(current_mode, m_input_tensor,
+                                          &ncp_mttkrp_t[current_mode]);
+#else
       m_input_tensor.mttkrp(current_mode, ncp_krp[current_mode],
                             &ncp_mttkrp_t[current_mode]);
+#endif
       temp = MPITOC;  // mttkrp toc
       this->time_stats.compute_duration(temp);
       this->time_stats.mttkrp_duration(temp);
@@ -280,7 +535,14 @@ class DistAUNTF {
     // PRINTROOT("kdt vs mttkrp::" << same_mttkrp);
     // PRINTROOT("kdt mttkrp::" << kdt_ncp_mttkrp_t);
     // PRINTROOT("classic mttkrp_t::" << ncp_mttkrp_t[current_mode]);
-
+  }
+  /**
+   * Sums the local mttkrps over the slice of current_mode and scatters
+   * the rows of the local factor into ncp_local_mttkrp_t[current_mode].
+   * @param[in] current_mode
+   */
+  void reduce_scatter_mttkrp(const int &current_mode) {
+    double temp;
     MPI_Comm current_slice_comm = this->m_mpicomm.slice(current_mode);
     int slice_size;
     int slice_rank;
@@ -335,9 +597,11 @@ class DistAUNTF {
     UWORD current_size = 0;
     for (unsigned int i = 0; i < m_modes; i++) {
       current_size = TENSOR_LOCAL_NUMEL / TENSOR_LOCAL_DIM[i];
+#ifndef FUSED_MTTKRP
       if (!m_enable_dim_tree) {
         ncp_krp[i] = arma::zeros(current_size, this->m_low_rank_k);
       }
+#endif
       ncp_mttkrp_t[i] = arma::zeros(this->m_low_rank_k, TENSOR_LOCAL_DIM[i]);
       ncp_local_mttkrp_t[i] = arma::zeros(m_local_ncp_factors.factor(i).n_cols,
                                           m_local_ncp_factors.factor(i).n_rows);
@@ -390,10 +654,17 @@ class DistAUNTF {
     MAT factor_t = m_local_ncp_factors.factor(current_mode).t();
     m_local_ncp_factors_t.set(current_mode, factor_t);
     m_local_ncp_factors_t.set_lambda(m_local_ncp_factors.lambda());
+#ifdef MPI_PIPELINE
+    // line 15 posted first so that it overlaps with line 13 and 14
+    gather_ncp_factor_begin(current_mode);
+    update_global_gram(current_mode);
+    gather_ncp_factor_finish(current_mode);
+#else
     // line 13 and 14
     update_global_gram(current_mode);
     // line 15
     gather_ncp_factor(current_mode);
+#endif
     if (this->m_enable_dim_tree) {
       kdt->set_factor(m_gathered_ncp_factors_t.factor(current_mode).memptr(),
                       current_mode);
@@ -405,6 +676,33 @@ class DistAUNTF {
 
   virtual void accelerate() {}
 
+  /// lambda, the local factors and the checkpoint_state of the algorithm
+  std::vector<MAT *> checkpoint_matrices() {
+    m_checkpoint_lambda = m_local_ncp_factors.lambda();
+    std::vector<MAT *> state;
+    state.push_back(&m_checkpoint_lambda);
+    for (unsigned int i = 0; i < m_modes; i++) {
+      state.push_back(&m_local_ncp_factors.factor(i));
+    }
+    checkpoint_state(&state);
+    return state;
+  }
+
+  /// Continues from the last checkpoint. Returns the next iteration.
+  unsigned int restore_checkpoint() {
+    unsigned int saved_it;
+    if (!m_checkpoint->restore(checkpoint_matrices(), &saved_it)) return 0;
+    for (unsigned int i = 0; i < m_modes; i++) {
+      MAT factor_t = m_local_ncp_factors.factor(i).t();
+      m_local_ncp_factors_t.set(i, factor_t);
+    }
+    m_local_ncp_factors.invalidate_grams();
+    m_local_ncp_factors.set_lambda(m_checkpoint_lambda);
+    m_local_ncp_factors_t.set_lambda(m_checkpoint_lambda);
+    checkpoint_restored();
+    return saved_it + 1;
+  }
+
   void generateReport() {
     MPI_Barrier(MPI_COMM_WORLD);
     this->reportTime(this->time_stats.duration(), "total_d");
@@ -440,6 +738,7 @@ class DistAUNTF {
         m_input_tensor(i_tensor),
         m_gathered_ncp_factors(i_tensor.dimensions(), i_k, false),
         m_gathered_ncp_factors_t(i_tensor.dimensions(), i_k, true),
+        m_gram_hadamard(i_tensor.modes(), i_k),
         m_low_rank_k(i_k),
         m_modes(m_input_tensor.modes()),
         m_updalgo(i_algo),
@@ -448,8 +747,13 @@ class DistAUNTF {
         time_stats(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0) {
     this->m_compute_error = false;
     this->m_enable_dim_tree = false;
+    this->m_jacobi = false;
+    this->m_sparse_tensor = NULL;
+    this->m_checkpoint = NULL;
+    this->m_restart = false;
     this->m_accelerated = false;
     this->m_num_it = 30;
+    this->m_num_k_blocks = 1;
     this->m_rel_error = 1.0;
     // randomize again. otherwise all the process and factors
     // will be same.
@@ -463,9 +767,9 @@ class DistAUNTF {
     m_local_ncp_factors_t.set_lambda(m_local_ncp_factors.lambda());
     m_gathered_ncp_factors.trans(m_gathered_ncp_factors_t);
     allocateMatrices();
-    double normA = i_tensor.norm();
-    MPI_Allreduce(&normA, &this->m_global_sqnorm_A, 1, MPI_DOUBLE, MPI_SUM,
-                  MPI_COMM_WORLD);
+    // the tensor data may still be in flight from DistNTFIO. Hence,
+    // the norm of the tensor is computed only in computeNTF.
+    this->m_global_sqnorm_A = 0;
 
     DISTPRINTINFO("::NLS Solve Sizes::"
                   << m_nls_sizes << "::NLS start indices::" << m_nls_idxs);
@@ -478,6 +782,8 @@ class DistAUNTF {
   }
   /// Returns number of iterations
   void num_iterations(const int i_n) { this->m_num_it = i_n; }
+  /// Sets the convergence based stopping criterion
+  void stop_criterion(const StopCriterion &i_stop) { this->m_stop = i_stop; }
   /// Returns the numbers of modes of the tensor
   size_t modes() const { return this->m_modes; }
   /// Low Rank
@@ -496,6 +802,14 @@ class DistAUNTF {
   int current_it() const { return this->m_current_it; }
   /// Returns the current error
   double current_error() const { return this->m_rel_error; }
+  /**
+   * The local nonzeros of a sparse input. The mttkrp is then computed
+   * from them and the dense tensor of the constructor only describes
+   * the local block, see the shape only Tensor constructor.
+   */
+  void sparse_tensor(const SparseTensor *i_tensor) {
+    this->m_sparse_tensor = i_tensor;
+  }
   /// MTTKRP can be computed with or without dimension trees. Dimtree is
   /// default.
   void dim_tree(bool i_dim_tree) {
@@ -509,6 +823,29 @@ class DistAUNTF {
       }
     }
   }
+  /**
+   * Jacobi sweeps. The local mttkrps of all the modes are computed from
+   * one traversal of the local tensor with the factors of the previous
+   * iteration and then all the factors are updated. Converges differently
+   * from the default Gauss-Seidel sweep. Meant for HALS and MU.
+   */
+  void jacobi(bool i_jacobi) { this->m_jacobi = i_jacobi; }
+  /// Number of chunks the rank-k is split into for the pipelined
+  /// collectives. Effective only when built with MPI_PIPELINE.
+  void num_k_blocks(const unsigned int i_num_k_blocks) {
+    this->m_num_k_blocks = std::max(
+        1u, std::min(i_num_k_blocks, this->m_low_rank_k));
+  }
+  /**
+   * Saves the local factors and the checkpoint_state through
+   * i_checkpoint after every checkpoint interval. If i_restart is set,
+   * computeNTF first restores the last checkpoint and continues after
+   * its iteration.
+   */
+  void checkpoint(Checkpoint *i_checkpoint, bool i_restart) {
+    this->m_checkpoint = i_checkpoint;
+    this->m_restart = i_restart;
+  }
   /// Does the algorithm need acceleration?
   void accelerated(const bool &set_acceleration) {
     this->m_accelerated = set_acceleration;
@@ -576,43 +913,31 @@ class DistAUNTF {
 
   /// The main computeNTF loop
   void computeNTF() {
+    double normA = (m_sparse_tensor != NULL) ? m_sparse_tensor->norm()
+                                              : m_input_tensor.norm();
+    MPI_Allreduce(&normA, &this->m_global_sqnorm_A, 1, MPI_DOUBLE, MPI_SUM,
+                  MPI_COMM_WORLD);
+    unsigned int start_it = 0;
+    if (m_checkpoint != NULL && m_restart) start_it = restore_checkpoint();
     // initialize everything.
-    // line 3,4,5 of the algorithm
-    for (unsigned int i = 1; i < m_modes; i++) {
+    // line 3,4,5 of the algorithm. A jacobi sweep uses the gathered
+    // factor and the gram of mode 0 as well before updating it.
+    for (unsigned int i = m_jacobi ? 0 : 1; i < m_modes; i++) {
+#ifdef MPI_PIPELINE
+      gather_ncp_factor_begin(i);
+      update_global_gram(i);
+      gather_ncp_factor_finish(i);
+#else
       update_global_gram(i);
       gather_ncp_factor(i);
+#endif
     }
     if (this->m_enable_dim_tree) {
-      // Determine optimial split when given mode ordering.
-      // product of left dimensions \approx product of right dimensions.
-      size_t split_criteria = arma::prod(m_input_tensor.dimensions());
-      split_criteria = std::round(std::sqrt(split_criteria));
-      UVEC temp_cum_prod = arma::cumprod(m_input_tensor.dimensions());
-      int split_mode = 0;
-      while (temp_cum_prod(split_mode) < split_criteria) {
-        split_mode++;
-      }
-      PRINTROOT("KDT Split Mode::" << split_mode
-                                   << "::split criteria::" << split_criteria
-                                   << "::cum prod::" << std::endl
-                                   << temp_cum_prod << std::endl);
-
-      // check to see if split mode is left or right.
-      if (split_mode > 0) {
-        size_t current_left = temp_cum_prod(split_mode);
-        size_t good_criteria = temp_cum_prod(temp_cum_prod.n_rows - 1) /
-                               temp_cum_prod(split_mode - 1);
-        if (current_left > good_criteria) split_mode--;
-        PRINTROOT("KDT Split Mode::"
-                  << split_mode << "::split criteria::" << split_criteria
-                  << "::numerator::" << temp_cum_prod(temp_cum_prod.n_rows - 1)
-                  << "::good_criteria::" << good_criteria
-                  << "::current_left::" << current_left << std::endl
-                  << "::cum prod::" << std::endl
-                  << temp_cum_prod << std::endl);
-      }
-      kdt = new DenseDimensionTree(m_input_tensor, m_gathered_ncp_factors,
-                                   split_mode);
+      // splits at every level are chosen from the local dimensions
+      kdt = new BinaryDimensionTree(m_input_tensor, m_gathered_ncp_factors);
+      PRINTROOT("dimension tree::" << kdt->layout() << "::sweep flops::"
+                                   << kdt->sweep_flops() << "::memoized words::"
+                                   << kdt->memoized_words());
     }
 #ifdef DISTNTF_VERBOSE
     DISTPRINTINFO("local factor matrices::");
@@ -622,9 +947,19 @@ class DistAUNTF {
     DISTPRINTINFO("gathered factor matrices::");
     this->m_gathered_ncp_factors.print();
 #endif
-    for (this->m_current_it = 0; this->m_current_it < m_num_it;
+    for (this->m_current_it = start_it; this->m_current_it < m_num_it;
          this->m_current_it++) {
+      m_stop.start(this->m_current_it);
       MAT unnorm_factor;
+      std::vector<MAT> jacobi_factors;
+      // error of the iterate entering a jacobi sweep
+      double jacobi_err = 0;
+      bool needs_err =
+          m_compute_error || (m_stop.checking() && m_stop.needs_error());
+      if (m_jacobi) {
+        distmttkrp_all();
+        jacobi_factors.resize(m_modes);
+      }
       for (unsigned int current_mode = 0; current_mode < m_modes;
            current_mode++) {
         // line 9 and 10 of the algorithm
@@ -641,6 +976,21 @@ class DistAUNTF {
         DISTPRINTINFO("mttkrp::");
         this->ncp_local_mttkrp_t[current_mode].print();
 #endif
+        if (m_stop.checking() && m_stop.type() == STOP_PGRAD) {
+          // the current model with the scale in current_mode
+          MAT local_unnorm_factor =
+              m_local_ncp_factors.factor(current_mode) *
+              arma::diagmat(m_local_ncp_factors.lambda());
+          m_stop.add_pgrad(local_unnorm_factor, this->global_gram,
+                           this->ncp_local_mttkrp_t[current_mode], true);
+        }
+        if (m_jacobi && needs_err && current_mode == this->m_modes - 1) {
+          // the mttkrp matches only the factors before the sweep
+          MAT snapshot_factor = (m_local_ncp_factors.factor(current_mode) *
+                                 arma::diagmat(m_local_ncp_factors.lambda()))
+                                    .t();
+          jacobi_err = computeError(snapshot_factor, current_mode);
+        }
         MPITIC;  // nnls_tic
         MAT factor = update(current_mode);
         double temp = MPITOC;  // nnls_toc
@@ -651,13 +1001,25 @@ class DistAUNTF {
                              << std::endl
                              << factor);
 #endif
-        if (m_compute_error && current_mode == this->m_modes - 1) {
+        if ((m_compute_error || m_stop.checking()) &&
+            current_mode == this->m_modes - 1) {
           unnorm_factor = factor;
         }
-        update_factor_mode(current_mode, factor.t());
+        if (m_jacobi) {
+          jacobi_factors[current_mode] = factor;
+        } else {
+          update_factor_mode(current_mode, factor.t());
+        }
+      }
+      if (m_jacobi) {
+        for (unsigned int i = 0; i < m_modes; i++) {
+          update_factor_mode(i, jacobi_factors[i].t());
+        }
       }
       if (m_compute_error) {
-        double temp_err = computeError(unnorm_factor, this->m_modes - 1);
+        double temp_err = m_jacobi
+                              ? jacobi_err
+                              : computeError(unnorm_factor, this->m_modes - 1);
         this->m_rel_error = temp_err;
         double iter_time = this->time_stats.compute_duration() +
                            this->time_stats.communication_duration();
@@ -666,13 +1028,37 @@ class DistAUNTF {
                            << "  [algo]: " << this->m_updalgo << "  [time]: "
                            << iter_time << "  [relative_error]: " << temp_err);
       }
+      if (m_stop.checking()) {
+        for (unsigned int i = 0; i < m_modes; i++) {
+          m_stop.add_factor(i, m_local_ncp_factors.factor(i));
+        }
+        MPI_Allreduce(MPI_IN_PLACE, m_stop.sums(), 2, MPI_DOUBLE, MPI_SUM,
+                      MPI_COMM_WORLD);
+        double rel_err = this->m_rel_error;
+        if (!m_compute_error && m_stop.needs_error()) {
+          rel_err = m_jacobi ? jacobi_err
+                             : computeError(unnorm_factor, this->m_modes - 1);
+        }
+        if (m_stop.converged(rel_err)) {
+          PRINTROOT("converged at it::" << this->m_current_it << "::"
+                                        << m_stop.name()
+                                        << "::" << m_stop.measure());
+          break;
+        }
+      }
       if (this->m_accelerated) {
         // there is a acceleration possible. call accelerate method
         // in the derived class.
         accelerate();
       }
+      if (m_checkpoint != NULL && m_checkpoint->due(this->m_current_it)) {
+        std::vector<MAT *> state = checkpoint_matrices();
+        m_checkpoint->save(this->m_current_it, std::vector<const MAT *>(
+                                                   state.begin(), state.end()));
+      }
       PRINTROOT("[completed iteration]:  " << this->m_current_it);
     }
+    if (m_checkpoint != NULL) m_checkpoint->wait();
     generateReport();
   }
   /**
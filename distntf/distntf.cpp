@@ -1,8 +1,10 @@
 /* Copyright 2016 Ramakrishnan Kannan */
 
 #include <string>
+#include "common/checkpoint.hpp"
 #include "common/distutils.hpp"
 #include "common/parsecommandline.hpp"
+#include "common/sptensor.hpp"
 #include "common/tensor.hpp"
 #include "common/utils.hpp"
 #include "distntf/distauntf.hpp"
@@ -25,6 +27,7 @@ class DistNTF {
   std::string m_outputfile_name;
   int m_num_it;
   UVEC m_proc_grids;
+  bool m_auto_grid;
   FVEC m_regs;
   algotype m_ntfalgo;
   double m_sparsity;
@@ -35,6 +38,11 @@ class DistNTF {
   UVEC m_nls_sizes;
   UVEC m_nls_idxs;
   bool m_enable_dim_tree;
+  bool m_jacobi;
+  StopCriterion m_stop;
+  std::string m_checkpoint_prefix;
+  int m_checkpoint_every;
+  bool m_restart;
   static const int kprimeoffset = 17;
 
   void printConfig() {
@@ -45,13 +53,48 @@ class DistNTF {
               << ",   [error]" << this->m_compute_error
               << ",   [regs]" << this->m_regs
               << ",   [num_k_blocks]" << m_num_k_blocks
-              << ",   [dim_tree]" << m_enable_dim_tree << std::endl;
+              << ",   [dim_tree]" << m_enable_dim_tree
+              << ",   [jacobi]" << m_jacobi
+              << ",   [stop]" << m_stop.name()
+              << ",   [tol]" << m_stop.tolerance()
+              << ",   [checkevery]" << m_stop.check_every()
+              << ",   [checkpoint]" << m_checkpoint_prefix
+              << ",   [checkpointevery]" << m_checkpoint_every
+              << ",   [restart]" << m_restart << std::endl;
+  }
+
+  /**
+   * Picks the processor grid with the least modeled communication
+   * when -p is not given. MPI is initialized here for the number of
+   * processes. The communicator leaves the initialized MPI alone.
+   */
+  void autoGrid() {
+    int numprocs, rank;
+    MPI_Init(&this->m_argc, &this->m_argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (this->m_global_dims.n_elem == 0) {
+      if (rank == 0) {
+        ERR << "the number of modes is not known. pass -d or -p"
+            << std::endl;
+      }
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    this->m_proc_grids =
+        best_processor_grid(numprocs, this->m_global_dims, this->m_k);
+    if (rank == 0) {
+      INFO << "auto grid::" << this->m_proc_grids.t() << "::modeled words::"
+           << grid_cost(this->m_proc_grids, this->m_global_dims,
+                               this->m_k)
+           << std::endl;
+    }
   }
 
   template <class NTFTYPE>
   void callDistNTF() {
     planc::Tensor A;
     std::string rand_prefix("rand_");
+    if (this->m_auto_grid) autoGrid();
     planc::NTFMPICommunicator mpicomm(this->m_argc, this->m_argv,
                                       this->m_proc_grids);
     if (mpicomm.rank() == 0) {
@@ -59,17 +102,22 @@ class DistNTF {
     }
     mpicomm.printConfig();
     planc::DistNTFIO dio(mpicomm, A);
+#ifdef BUILD_SPARSE
+    // A only describes the local block. The nonzeros are in S.
+    planc::SparseTensor S;
+    dio.read_sparse_tensor(m_Afile_name, &S);
+#else
+    // the file read is finished only after the solver has initialized
+    // its factors.
     dio.readInput(m_Afile_name, this->m_global_dims, this->m_proc_grids,
-                    this->m_k, this->m_sparsity);
+                  this->m_k, this->m_sparsity, false);
+#endif
     this->m_global_dims = dio.global_dims();
     memusage(mpicomm.rank(), "[after input io memory usage is]:");
     INFO << "[mpi rank]: " << mpicomm.rank()
          << ",  [Completed generating tensor A dimension]: " << A.dimensions()
          << ",  [start indices]:  " << A.global_idx()
          << ",  [global dims]:   " << this->m_global_dims << std::endl;
-#ifdef DISTNTF_VERBOSE
-    A.print();
-#endif
 #ifdef WRITE_RAND_INPUT
     dio.writeRandInput();
 #endif  // ifdef WRITE_RAND_INPUT
@@ -112,17 +160,40 @@ class DistNTF {
                       this->m_nls_idxs, mpicomm);
     memusage(mpicomm.rank(), "after constructor ");
     ntfsolver.num_iterations(this->m_num_it);
+    ntfsolver.stop_criterion(this->m_stop);
     ntfsolver.compute_error(this->m_compute_error);
+    ntfsolver.jacobi(this->m_jacobi);
+#ifdef BUILD_SPARSE
+    ntfsolver.sparse_tensor(&S);
+    if (this->m_enable_dim_tree && mpicomm.rank() == 0) {
+      WARN << "dimension tree is only for dense tensors. ignored"
+           << std::endl;
+    }
+#else
     if (this->m_enable_dim_tree) {
       ntfsolver.dim_tree(this->m_enable_dim_tree);
     }
+#endif
     ntfsolver.regularizers(this->m_regs);
+    ntfsolver.num_k_blocks(this->m_num_k_blocks);
+    Checkpoint checkpoint(this->m_checkpoint_prefix, mpicomm.rank(),
+                          this->m_checkpoint_every);
+    if (checkpoint.enabled()) {
+      ntfsolver.checkpoint(&checkpoint, this->m_restart);
+    }
+    dio.read_dist_tensor_finish();
+#ifdef DISTNTF_VERBOSE
+    A.print();
+#endif
     MPI_Barrier(MPI_COMM_WORLD);
     // try {
     mpitic();
     ntfsolver.computeNTF();
     double temp = mpitoc();
     A.clear();
+#ifdef BUILD_SPARSE
+    S.clear();
+#endif
     if (!this->m_outputfile_name.empty()) {
       dio.write(this->m_outputfile_name, &ntfsolver);
     }
@@ -142,14 +213,25 @@ class DistNTF {
     this->m_k = pc.lowrankk();
     this->m_Afile_name = pc.input_file_name();
     this->m_proc_grids = pc.processor_grids();
+    this->m_auto_grid = pc.auto_grid();
     this->m_sparsity = pc.sparsity();
     this->m_num_it = pc.iterations();
-    this->m_num_k_blocks = 1;
+    this->m_stop = pc.stop_criterion();
+    this->m_num_k_blocks = pc.num_k_blocks();
     this->m_regs = pc.regularizers();
     this->m_global_dims = pc.dimensions();
     this->m_compute_error = pc.compute_error();
     this->m_enable_dim_tree = pc.dim_tree();
+    this->m_jacobi = pc.jacobi();
     this->m_outputfile_name = pc.output_file_name();
+    this->m_checkpoint_prefix = pc.checkpoint_prefix();
+    this->m_checkpoint_every = pc.checkpoint_every();
+    this->m_restart = pc.restart();
+    if (this->m_restart && this->m_checkpoint_prefix.empty()) {
+      WARN << "--restart needs --checkpoint. Starting from the beginning."
+           << std::endl;
+      this->m_restart = false;
+    }
     // printConfig();
     switch (this->m_ntfalgo) {
       case MU:
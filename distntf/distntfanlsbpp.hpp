@@ -5,12 +5,15 @@
 
 #include "distntf/distauntf.hpp"
 #include "nnls/bppnnls.hpp"
+#include "nnls/bppnnlspool.hpp"
 
 namespace planc {
 
-#define ONE_THREAD_MATRIX_SIZE 2000
-
 class DistNTFANLSBPP : public DistAUNTF {
+ private:
+  /// per thread NNLS workspaces reused across the iterations
+  BPPNNLSPool<MAT, VEC> nnlsPool;
+
  protected:
   /**
    * This is openmp multithreaded ANLS/BPP update function.
@@ -22,52 +25,8 @@ class DistNTFANLSBPP : public DistAUNTF {
   MAT update(const int mode) {
     MAT othermat(this->m_local_ncp_factors_t.factor(mode));
     if (m_nls_sizes[mode] > 0) {
-      unsigned int numThreads =
-        (this->ncp_local_mttkrp_t[mode].n_cols / ONE_THREAD_MATRIX_SIZE) + 1;
-      #pragma omp parallel for schedule(dynamic)
-      for (UINT i = 0; i < numThreads; i++) {
-        UINT spanStart = i * ONE_THREAD_MATRIX_SIZE;
-        UINT spanEnd = (i + 1) * ONE_THREAD_MATRIX_SIZE - 1;
-        if (spanEnd > this->ncp_local_mttkrp_t[mode].n_cols - 1) {
-          spanEnd = this->ncp_local_mttkrp_t[mode].n_cols - 1;
-        }
-        // if it is exactly divisible, the last iteration is unnecessary.
-        BPPNNLS<MAT, VEC> *subProblem;
-        if (spanStart <= spanEnd) {
-          if (spanStart == spanEnd) {
-            subProblem = new BPPNNLS<MAT, VEC>(
-              this->global_gram,
-              (VEC)this->ncp_local_mttkrp_t[mode].col(spanStart), true);
-          } else {  // if (spanStart < spanEnd)
-            subProblem = new BPPNNLS<MAT, VEC>(
-              this->global_gram,
-              (MAT)this->ncp_local_mttkrp_t[mode].cols(spanStart, spanEnd),
-              true);
-          }
-#ifdef _VERBOSE
-          INFO << "Scheduling " << worh << " start=" << spanStart
-             << ", end=" << spanEnd << ", tid=" << omp_get_thread_num()
-             << std::endl;
-#endif
-          // tic();
-          subProblem->solveNNLS();
-          // t2 = toc();
-#ifdef _VERBOSE
-          INFO << "completed " << worh << " start=" << spanStart
-             << ", end=" << spanEnd << ", tid=" << omp_get_thread_num()
-             << " cpu=" << sched_getcpu() << " time taken=" << t2
-             << " num_iterations()=" << numIter << std::endl;
-#endif
-          if (spanStart == spanEnd) {
-            VEC solVec = subProblem->getSolutionVector();
-            othermat.col(i) = solVec;
-          } else {  // if (spanStart < spanEnd)
-            othermat.cols(spanStart, spanEnd) = subProblem->getSolutionMatrix();
-          }
-          subProblem->clear();
-          delete subProblem;
-        }
-      }
+      nnlsPool.solve(this->global_gram, this->ncp_local_mttkrp_t[mode],
+                     &othermat, false, mode);
     } else {
       othermat.zeros();
     }
@@ -25,6 +25,12 @@ class DistNTFAOADMM : public DistAUNTF {
   double norm_time;
 
  protected:
+  /// the duals are carried over the outer iterations
+  void checkpoint_state(std::vector<MAT *> *o_state) {
+    for (unsigned int mode = 0; mode < this->modes(); mode++) {
+      o_state->push_back(&m_local_ncp_aux.factor(mode));
+    }
+  }
   /**
    * This is ADMM based update function.
    * Given the MTTKRP and the hadamard of all the grams, we
@@ -3,14 +3,20 @@
 #ifndef DISTNTF_DISTNTFIO_HPP_
 #define DISTNTF_DISTNTFIO_HPP_
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <armadillo>
+#include <cstdlib>
+#include <cstring>
 #include <limits>  // for limits of standard data types
 #include <string>
 #include <vector>
 #include "common/distutils.hpp"
 #include "common/ncpfactors.hpp"
 #include "common/npyio.hpp"
+#include "common/sptensor.hpp"
 #include "common/tensor.hpp"
 #include "distntf/distntfmpicomm.hpp"
 
@@ -37,6 +43,117 @@ class DistNTFIO {
   static const int kbeta = 0;
   UVEC m_global_dims;
   UVEC m_local_dims;
+  // Largest number of doubles handed to a single MPI-IO call. Keeps every
+  // call well below the 2GB int count limit of MPI and of the file systems.
+  static const UWORD kMaxIOChunk = 1 << 27;
+  // state of a read posted by read_dist_tensor_begin
+  bool m_read_pending;
+  MPI_File m_read_fh;
+  MPI_Datatype m_read_view;
+  std::vector<MPI_Request> m_read_reqs;
+  std::string m_read_filename;
+
+  /**
+   * Number of chunks of at most kMaxIOChunk doubles every process has to
+   * issue. Collective IO needs the same number of calls on every process,
+   * so it is the maximum across all the processes.
+   * @param[in] count number of local doubles
+   */
+  int io_num_chunks(const UWORD count) const {
+    int local_chunks = (count + kMaxIOChunk - 1) / kMaxIOChunk;
+    int num_chunks;
+    MPI_Allreduce(&local_chunks, &num_chunks, 1, MPI_INT, MPI_MAX,
+                  MPI_COMM_WORLD);
+    return num_chunks;
+  }
+  /// number of doubles of the local tensor in the given chunk
+  int io_chunk_count(const UWORD count, const int chunk) const {
+    UWORD chunk_start = chunk * kMaxIOChunk;
+    if (chunk_start >= count) return 0;
+    return (count - chunk_start < kMaxIOChunk) ? count - chunk_start
+                                               : kMaxIOChunk;
+  }
+
+  /**
+   * Hints for the collective IO. Collective buffering is always enabled.
+   * Lustre style striping can be passed through the environment variables
+   * PLANC_IO_STRIPING_FACTOR and PLANC_IO_STRIPING_UNIT and
+   * the collective buffer size through PLANC_IO_CB_BUFFER_SIZE.
+   * Striping takes effect only when the file is created.
+   * The caller must free the returned info.
+   */
+  MPI_Info io_hints() const {
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, const_cast<char *>("romio_cb_read"),
+                 const_cast<char *>("enable"));
+    MPI_Info_set(info, const_cast<char *>("romio_cb_write"),
+                 const_cast<char *>("enable"));
+    const char *hint_env[][2] = {
+        {"PLANC_IO_STRIPING_FACTOR", "striping_factor"},
+        {"PLANC_IO_STRIPING_UNIT", "striping_unit"},
+        {"PLANC_IO_CB_BUFFER_SIZE", "cb_buffer_size"}};
+    for (int i = 0; i < 3; i++) {
+      const char *value = std::getenv(hint_env[i][0]);
+      if (value != NULL) {
+        MPI_Info_set(info, const_cast<char *>(hint_env[i][1]),
+                     const_cast<char *>(value));
+      }
+    }
+    return info;
+  }
+
+  /**
+   * Block of the index i of a mode of length n split into p parts as
+   * itersplit/startidx do.
+   */
+  static int split_owner(UWORD n, int p, UWORD i) {
+    UWORD q = n / p;
+    UWORD r = n % p;
+    if (i < r * (q + 1)) return i / (q + 1);
+    return r + (i - r * (q + 1)) / q;
+  }
+
+  /**
+   * Parses the "i_1 ... i_N value" lines with one based indices between
+   * begin and end. Blank lines and lines starting with % or # are
+   * skipped. Appends the zero based global indices, N per nonzero, and
+   * the values. Returns the number of lines with an index out of range.
+   */
+  UWORD parse_nonzeros(const char *begin, const char *end,
+                       std::vector<UINT> *idx, std::vector<double> *vals) {
+    int modes = this->m_global_dims.n_rows;
+    std::vector<UINT> cur(modes);
+    std::string line;
+    UWORD bad = 0;
+    const char *p = begin;
+    while (p < end) {
+      const char *eol =
+          reinterpret_cast<const char *>(memchr(p, '\n', end - p));
+      if (eol == NULL) eol = end;
+      line.assign(p, eol - p);
+      p = eol + 1;
+      const char *c = line.c_str();
+      while (*c == ' ' || *c == '\t' || *c == '\r') c++;
+      if (*c == '\0' || *c == '%' || *c == '#') continue;
+      char *next;
+      int j = 0;
+      for (; j < modes; j++) {
+        UWORD i = strtoull(c, &next, 10);
+        if (next == c || i == 0 || i > this->m_global_dims[j]) break;
+        cur[j] = i - 1;
+        c = next;
+      }
+      double v = strtod(c, &next);
+      if (j < modes || next == c) {
+        bad++;
+        continue;
+      }
+      idx->insert(idx->end(), cur.begin(), cur.end());
+      vals->push_back(v);
+    }
+    return bad;
+  }
 
   /*
    * Uses the pattern from the input matrix X but
@@ -114,9 +231,10 @@ class DistNTFIO {
 
  public:
   explicit DistNTFIO(const NTFMPICommunicator &mpic, Tensor &in)
-      : m_mpicomm(mpic), m_A(in) {}
+      : m_mpicomm(mpic), m_A(in), m_read_pending(false) {}
   ~DistNTFIO() {
     // delete this->m_A;
+    read_dist_tensor_finish();
   }
   /*void readInput(const std::string file_name) {
     // In this case we are reading from a file.
@@ -161,6 +279,22 @@ class DistNTFIO {
   */
   UVEC read_dist_tensor(const std::string filename,
                         UVEC *start_idxs_uvec = NULL) {
+    read_dist_tensor_begin(filename, start_idxs_uvec);
+    read_dist_tensor_finish();
+    return this->m_global_dims;
+  }
+  /**
+   * Sizes the local tensor from the .info file and posts the collective
+   * reads of the .bin file in chunks of at most kMaxIOChunk doubles.
+   * The local tensor has its dimensions on return but its data is valid
+   * only after read_dist_tensor_finish. Use the time in between for work
+   * that doesn't touch the tensor data, such as the factor initialization.
+   * Without MPI-3.1 nonblocking collective IO the chunks are read here.
+   * @param[in] filename of the .bin file
+   * @param[out] start_idxs_uvec global start index of the local tensor
+   */
+  UVEC read_dist_tensor_begin(const std::string filename,
+                              UVEC *start_idxs_uvec = NULL) {
     // all processes reading the file_name.info file.
     std::string filename_no_extension =
         filename.substr(0, filename.find_last_of("."));
@@ -197,50 +331,89 @@ class DistNTFIO {
                                   << "Local Tensor Dims::" << this->m_local_dims
                                   << "::start_idxs::" << tmp_start_idxs_uvec);
     Tensor rc(this->m_local_dims);
+    // the storage moves along with the swap. So the reads can be
+    // posted straight into m_A.
+    swap(this->m_A, rc);
     // Create the datatype associated with this layout
-    MPI_Datatype view;
     MPI_Type_create_subarray(modes, global_dims, local_dims, start_idxs,
-                             MPI_ORDER_FORTRAN, MPI_DOUBLE, &view);
-    MPI_Type_commit(&view);
+                             MPI_ORDER_FORTRAN, MPI_DOUBLE, &m_read_view);
+    MPI_Type_commit(&m_read_view);
     // Open the file
-    MPI_File fh;
     // const MPI_Comm &comm = Y->getDistribution()->getComm(true);
     // get confirmed with grey
+    MPI_Info info = io_hints();
     int ret = MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_RDONLY,
-                            MPI_INFO_NULL, &fh);
+                            info, &m_read_fh);
+    MPI_Info_free(&info);
     if (ret != MPI_SUCCESS) {
       DISTPRINTINFO("Error: Could not read file " << filename << std::endl);
     }
     // Set the view
     MPI_Offset disp = 0;
-    MPI_File_set_view(fh, disp, MPI_DOUBLE, view, "native", MPI_INFO_NULL);
+    MPI_File_set_view(m_read_fh, disp, MPI_DOUBLE, m_read_view, "native",
+                      MPI_INFO_NULL);
     // Read the file
-    int count = rc.numel();
+    UWORD count = this->m_A.numel();
+    int num_chunks = io_num_chunks(count);
     DISTPRINTINFO("reading::" << count << "::in gbs::"
-                              << (count * 8.0) / (1024 * 1024 * 1024));
-    assert(count * 8 <= std::numeric_limits<int>::max());
-    if (ISROOT && 8 * count > std::numeric_limits<int>::max()) {
-      PRINTROOT("file read size ::" << 8.0 * count << " > 2GB" << std::endl);
-    }
-    MPI_Status status;
-    ret = MPI_File_read_all(fh, &rc.m_data[0], count, MPI_DOUBLE, &status);
-    int nread;
-    MPI_Get_count(&status, MPI_DOUBLE, &nread);
-    if (ret != MPI_SUCCESS) {
-      DISTPRINTINFO("Error: Could not read file " << filename << std::endl);
+                              << (count * 8.0) / (1024 * 1024 * 1024)
+                              << "::chunks::" << num_chunks);
+    m_read_reqs.assign(num_chunks, MPI_REQUEST_NULL);
+    m_read_filename = filename;
+    for (int i = 0; i < num_chunks; i++) {
+      // offsets are in doubles relative to the view
+      MPI_Offset offset = static_cast<MPI_Offset>(i) * kMaxIOChunk;
+      int chunk_count = io_chunk_count(count, i);
+      double *buf = (chunk_count > 0) ? &this->m_A.m_data[offset] : NULL;
+#if MPI_VERSION > 3 || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1)
+      ret = MPI_File_iread_at_all(m_read_fh, offset, buf, chunk_count,
+                                  MPI_DOUBLE, &m_read_reqs[i]);
+#else
+      MPI_Status status;
+      ret = MPI_File_read_at_all(m_read_fh, offset, buf, chunk_count,
+                                 MPI_DOUBLE, &status);
+#endif
+      if (ret != MPI_SUCCESS) {
+        DISTPRINTINFO("Error: Could not read file " << filename << std::endl);
+      }
     }
-    // Close the file
-    MPI_File_close(&fh);
-    // Free the datatype
-    MPI_Type_free(&view);
+    m_read_pending = true;
 
     // free the allocated things.
     delete[] global_dims;
     delete[] local_dims;
     delete[] start_idxs;
-    swap(this->m_A, rc);
     return this->m_global_dims;
   }
+  /**
+   * Waits for the reads posted by read_dist_tensor_begin and
+   * closes the file. No-op if nothing is pending.
+   */
+  void read_dist_tensor_finish() {
+    if (!m_read_pending) return;
+    std::vector<MPI_Status> statuses(m_read_reqs.size());
+    if (!m_read_reqs.empty()) {
+      MPI_Waitall(m_read_reqs.size(), &m_read_reqs[0], &statuses[0]);
+    }
+#if MPI_VERSION > 3 || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1)
+    UWORD nread = 0;
+    for (unsigned int i = 0; i < statuses.size(); i++) {
+      int chunk_read;
+      MPI_Get_count(&statuses[i], MPI_DOUBLE, &chunk_read);
+      nread += chunk_read;
+    }
+    if (nread != this->m_A.numel()) {
+      DISTPRINTINFO("Error: read " << nread << " of " << this->m_A.numel()
+                                   << " from " << m_read_filename);
+    }
+#endif
+    // Close the file
+    MPI_File_close(&m_read_fh);
+    // Free the datatype
+    MPI_Type_free(&m_read_view);
+    m_read_reqs.clear();
+    m_read_pending = false;
+  }
   /**
    * Writes distributed tensor.
    * Expecting a .tensor text file and .bin file.
@@ -291,9 +464,10 @@ class DistNTFIO {
 
     // Open the file
     MPI_File fh;
-    int ret =
-        MPI_File_open(MPI_COMM_WORLD, filename.c_str(),
-                      MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_Info info = io_hints();
+    int ret = MPI_File_open(MPI_COMM_WORLD, filename.c_str(),
+                            MPI_MODE_CREATE | MPI_MODE_WRONLY, info, &fh);
+    MPI_Info_free(&info);
     if (ISROOT && ret != MPI_SUCCESS) {
       DISTPRINTINFO("Error: Could not open file " << filename << std::endl);
     }
@@ -302,14 +476,20 @@ class DistNTFIO {
     MPI_Offset disp = 0;
     MPI_File_set_view(fh, disp, MPI_DOUBLE, view, "native", MPI_INFO_NULL);
 
-    // Write the file
-    int count = local_tensor.numel();
-    assert(count <= std::numeric_limits<int>::max());
-    MPI_Status status;
-    ret = MPI_File_write_all(fh, &local_tensor.m_data[0], count, MPI_DOUBLE,
-                             &status);
-    if (ret != MPI_SUCCESS) {
-      DISTPRINTINFO("Error: Could not write file " << filename << std::endl);
+    // Write the file in chunks of at most kMaxIOChunk doubles
+    UWORD count = local_tensor.numel();
+    int num_chunks = io_num_chunks(count);
+    for (int i = 0; i < num_chunks; i++) {
+      MPI_Offset offset = static_cast<MPI_Offset>(i) * kMaxIOChunk;
+      int chunk_count = io_chunk_count(count, i);
+      const double *buf =
+          (chunk_count > 0) ? &local_tensor.m_data[offset] : NULL;
+      MPI_Status status;
+      ret = MPI_File_write_at_all(fh, offset, const_cast<double *>(buf),
+                                  chunk_count, MPI_DOUBLE, &status);
+      if (ret != MPI_SUCCESS) {
+        DISTPRINTINFO("Error: Could not write file " << filename << std::endl);
+      }
     }
     // Close the file
     MPI_File_close(&fh);
@@ -325,10 +505,12 @@ class DistNTFIO {
    * We need m,n,pr,pc only for rand matrices. If otherwise we are
    * expecting the file will hold all the details.
    * If we are loading by file name we dont need distio flag.
-   *
+   * With i_finish_read false, a file read is only posted and the caller
+   * must call read_dist_tensor_finish before touching the tensor data.
    */
   void readInput(const std::string file_name, UVEC i_global_dims,
-                 UVEC i_proc_grids, UWORD k = 0, double sparsity = 0) {
+                 UVEC i_proc_grids, UWORD k = 0, double sparsity = 0,
+                 bool i_finish_read = true) {
     // INFO << "readInput::" << file_name << "::" << distio << "::"
     //     << m << "::" << n << "::" << pr << "::" << pc
     //     << "::" << this->MPI_RANK << "::" << this->m_mpicomm.size() <<
@@ -358,7 +540,8 @@ class DistNTFIO {
         this->m_A.set_idx(start_rows);
       }
     } else {
-      read_dist_tensor(file_name);
+      read_dist_tensor_begin(file_name);
+      if (i_finish_read) read_dist_tensor_finish();
     }
   }
   void write(const std::string &output_file_name, DistAUNTF *ntfsolver) {
@@ -388,6 +571,164 @@ class DistNTFIO {
       ntfsolver->lambda().save(sw.str(), arma::raw_ascii);
     }
   }
+  /**
+   * Reads a sparse tensor in the text format of
+   * utilities/permute-sparse-struct: "order nnz" on the first
+   * line, the dimensions on the second and one "i_1 ... i_N value" line
+   * with one based indices for every nonzero.
+   *
+   * Medium grained distribution. The tensor is split into the blocks of
+   * the processor grid exactly as the dense tensor and every process
+   * owns the nonzeros of its block, so the factor rows and the
+   * collectives of DistAUNTF are the same as in the dense case. Every
+   * process parses an equal byte range of the file and the nonzeros
+   * are sent to the owner of their block with one all to all. Randomly
+   * permuting the indices with permute-sparse-struct beforehand
+   * balances the nonzeros across the blocks.
+   *
+   * The tensor of this DistNTFIO becomes the shape only local block.
+   * @param[in] filename of the sparse tensor
+   * @param[out] o_sptensor local nonzeros in local indices
+   */
+  void read_sparse_tensor(const std::string &filename,
+                          SparseTensor *o_sptensor) {
+    std::ifstream ifs(filename.c_str(), std::ios_base::in);
+    int modes = 0;
+    UWORD global_nnz = 0;
+    ifs >> modes >> global_nnz;
+    UVEC proc_grids = this->m_mpicomm.proc_grids();
+    if (!ifs || modes != static_cast<int>(proc_grids.n_rows)) {
+      PRINTROOT("Error: could not read a " << proc_grids.n_rows
+                                           << " mode sparse tensor from "
+                                           << filename);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    this->m_global_dims = arma::zeros<UVEC>(modes);
+    for (int i = 0; i < modes; i++) ifs >> this->m_global_dims[i];
+    size_t data_start = ifs.tellg();
+    ifs.close();
+    this->m_local_dims = arma::zeros<UVEC>(modes);
+    UVEC start_idxs = arma::zeros<UVEC>(modes);
+    for (int i = 0; i < modes; i++) {
+      this->m_local_dims[i] = itersplit(this->m_global_dims[i], proc_grids[i],
+                                        this->m_mpicomm.fiber_rank(i));
+      start_idxs[i] = startidx(this->m_global_dims[i], proc_grids[i],
+                               this->m_mpicomm.fiber_rank(i));
+    }
+    PRINTROOT("Reading sparse tensor::" << filename << "::global dims::"
+                                        << this->m_global_dims.t()
+                                        << "::nnz::" << global_nnz);
+
+    // parse an equal byte range of the file split at line boundaries
+    std::vector<UINT> idx;
+    std::vector<double> vals;
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+      DISTPRINTINFO("Error: Could not read file " << filename);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    size_t nbytes = sb.st_size;
+    void *addr = MAP_FAILED;
+    if (nbytes > data_start) {
+      addr = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (addr != MAP_FAILED) {
+      const char *text = reinterpret_cast<const char *>(addr);
+      size_t range = nbytes - data_start;
+      size_t bounds[2];
+      for (int b = 0; b < 2; b++) {
+        size_t pos = data_start + range / MPI_SIZE * (MPI_RANK + b);
+        if (MPI_RANK + b == MPI_SIZE) pos = nbytes;
+        if (pos > data_start && pos < nbytes) {
+          const char *eol = reinterpret_cast<const char *>(
+              memchr(text + pos - 1, '\n', nbytes - pos + 1));
+          pos = (eol == NULL) ? nbytes : (eol - text) + 1;
+        }
+        bounds[b] = pos;
+      }
+      madvise(const_cast<char *>(text) + bounds[0], bounds[1] - bounds[0],
+              MADV_SEQUENTIAL);
+      UWORD bad = parse_nonzeros(text + bounds[0], text + bounds[1], &idx,
+                                 &vals);
+      munmap(addr, nbytes);
+      if (bad > 0) {
+        DISTPRINTINFO("skipped " << bad << " malformed or out of range lines");
+      }
+    }
+
+    // bucket the nonzeros by the owner of their block
+    int nprocs = MPI_SIZE;
+    UWORD local_nnz = vals.size();
+    std::vector<int> owner(local_nnz);
+    std::vector<int> sendcnt(nprocs, 0), recvcnt(nprocs, 0);
+    std::vector<int> coords(modes);
+    for (UWORD e = 0; e < local_nnz; e++) {
+      for (int j = 0; j < modes; j++) {
+        coords[j] = split_owner(this->m_global_dims[j], proc_grids[j],
+                                idx[e * modes + j]);
+      }
+      owner[e] = this->m_mpicomm.rank(&coords[0]);
+      sendcnt[owner[e]]++;
+    }
+    MPI_Alltoall(&sendcnt[0], 1, MPI_INT, &recvcnt[0], 1, MPI_INT,
+                 MPI_COMM_WORLD);
+    std::vector<int> senddispl(nprocs, 0), recvdispl(nprocs, 0);
+    for (int r = 1; r < nprocs; r++) {
+      senddispl[r] = senddispl[r - 1] + sendcnt[r - 1];
+      recvdispl[r] = recvdispl[r - 1] + recvcnt[r - 1];
+    }
+    UWORD recv_nnz = recvdispl[nprocs - 1] + recvcnt[nprocs - 1];
+    std::vector<double> sendvals(local_nnz);
+    std::vector<UINT> sendidx(local_nnz * modes);
+    {
+      std::vector<int> next(senddispl);
+      for (UWORD e = 0; e < local_nnz; e++) {
+        int dst = next[owner[e]]++;
+        sendvals[dst] = vals[e];
+        for (int j = 0; j < modes; j++) {
+          sendidx[dst * modes + j] = idx[e * modes + j];
+        }
+      }
+      std::vector<double>().swap(vals);
+      std::vector<UINT>().swap(idx);
+    }
+    std::vector<double> recvvals(recv_nnz);
+    std::vector<UINT> recvidx(recv_nnz * modes);
+    MPI_Alltoallv(sendvals.data(), &sendcnt[0], &senddispl[0], MPI_DOUBLE,
+                  recvvals.data(), &recvcnt[0], &recvdispl[0], MPI_DOUBLE,
+                  MPI_COMM_WORLD);
+    // the indices travel as modes unsigned ints per nonzero
+    for (int r = 0; r < nprocs; r++) {
+      sendcnt[r] *= modes;
+      senddispl[r] *= modes;
+      recvcnt[r] *= modes;
+      recvdispl[r] *= modes;
+    }
+    MPI_Alltoallv(sendidx.data(), &sendcnt[0], &senddispl[0], MPI_UNSIGNED,
+                  recvidx.data(), &recvcnt[0], &recvdispl[0], MPI_UNSIGNED,
+                  MPI_COMM_WORLD);
+    std::vector<double>().swap(sendvals);
+    std::vector<UINT>().swap(sendidx);
+
+    // local indices, one vector per mode
+    std::vector<std::vector<UINT> > local_idx(modes,
+                                              std::vector<UINT>(recv_nnz));
+    for (UWORD e = 0; e < recv_nnz; e++) {
+      for (int j = 0; j < modes; j++) {
+        local_idx[j][e] = recvidx[e * modes + j] - start_idxs[j];
+      }
+    }
+    std::vector<UINT>().swap(recvidx);
+    SparseTensor local(this->m_local_dims, start_idxs, &local_idx, &recvvals);
+    std::swap(*o_sptensor, local);
+    Tensor shape(this->m_local_dims, start_idxs, true);
+    swap(this->m_A, shape);
+    DISTPRINTINFO("local dims::" << this->m_local_dims.t() << "::start idxs::"
+                                 << start_idxs.t()
+                                 << "::local nnz::" << o_sptensor->nnz());
+  }
   void writeRandInput() {}
   const Tensor &A() const { return m_A; }
   const NTFMPICommunicator &mpicomm() const { return m_mpicomm; }
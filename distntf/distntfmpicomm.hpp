@@ -66,11 +66,14 @@ class NTFMPICommunicator {
 
   /**
    * Constructor for setting up the nD grid communicators
+   * MPI may already be initialized by the caller to pick the grid.
    */
   NTFMPICommunicator(int argc, char *argv[], const UVEC &i_dims)
       : m_proc_grids(i_dims) {
     // Get the number of MPI processes
-    MPI_Init(&argc, &argv);
+    int initialized;
+    MPI_Initialized(&initialized);
+    if (!initialized) MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, reinterpret_cast<int *>(&m_global_rank));
     MPI_Comm_size(MPI_COMM_WORLD, reinterpret_cast<int *>(&m_num_procs));
     if (m_num_procs != arma::prod(m_proc_grids)) {
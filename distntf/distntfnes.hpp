@@ -28,8 +28,34 @@ class DistNTFNES : public DistAUNTF {
   double stop_iter_time;
   double proj_time;
   double norm_time;
+  // lambdas of m_prox_t and m_prev_t and the acceleration counters
+  VEC m_checkpoint_scalars;
 
  protected:
+  /// the proximal and the previous iterates and the acceleration state
+  void checkpoint_state(std::vector<MAT *> *o_state) {
+    int num_modes = m_prox_t.modes();
+    int lowrank = m_prox_t.rank();
+    m_checkpoint_scalars.set_size(2 * lowrank + 2);
+    m_checkpoint_scalars.head(lowrank) = m_prox_t.lambda();
+    m_checkpoint_scalars.subvec(lowrank, 2 * lowrank - 1) = m_prev_t.lambda();
+    m_checkpoint_scalars(2 * lowrank) = acc_exp;
+    m_checkpoint_scalars(2 * lowrank + 1) = acc_fails;
+    o_state->push_back(&m_checkpoint_scalars);
+    for (int mode = 0; mode < num_modes; mode++) {
+      o_state->push_back(&m_prox_t.factor(mode));
+      o_state->push_back(&m_prev_t.factor(mode));
+    }
+  }
+  void checkpoint_restored() {
+    int lowrank = m_prox_t.rank();
+    VEC prox_lambda = m_checkpoint_scalars.head(lowrank);
+    VEC prev_lambda = m_checkpoint_scalars.subvec(lowrank, 2 * lowrank - 1);
+    m_prox_t.set_lambda(prox_lambda);
+    m_prev_t.set_lambda(prev_lambda);
+    acc_exp = static_cast<int>(m_checkpoint_scalars(2 * lowrank));
+    acc_fails = static_cast<int>(m_checkpoint_scalars(2 * lowrank + 1));
+  }
   inline double get_lambda(double L, double mu) {
     double q = L / mu;
     double lambda = 0.0;
@@ -86,11 +86,14 @@ class AOADMMNMF : public NMF<T> {
     this->At = this->A.t();
     INFO << "computed transpose At=" << PRINTMATINFO(this->At) << std::endl;
     while (currentIteration < this->num_iterations()) {
+      this->m_stop.start(currentIteration);
       tic();
       // update H
       tic();
       WtA = this->W.t() * this->A;
       WtW = this->W.t() * this->W;
+      // before the ADMM penalty goes on the diagonal
+      this->m_stop.add_pgrad(this->H, WtW, WtA, true);
       beta = trace(WtW) / this->k;
       beta = beta > 0 ? beta : 0.01;
       WtW.diag() += beta;
@@ -136,6 +139,7 @@ class AOADMMNMF : public NMF<T> {
       tic();
       AH = this->A * this->H;
       HtH = this->H.t() * this->H;
+      this->m_stop.add_pgrad(this->W, HtH, AH);
       alpha = trace(HtH) / this->k;
       alpha = alpha > 0 ? alpha : 0.01;
       HtH.diag() += alpha;
@@ -180,10 +184,13 @@ class AOADMMNMF : public NMF<T> {
       INFO << "Completed It (" << currentIteration << "/"
            << this->num_iterations() << ")"
            << " time =" << toc() << std::endl;
-      this->computeObjectiveError();
+      // HtH carries the ADMM regularization on its diagonal
+      HtH.diag() -= alpha;
+      this->computeObjectiveErrorFromAH(AH, HtH);
       INFO << "Completed it = " << currentIteration
            << " AOADMMERR=" << sqrt(this->objective_err) / this->normA
            << std::endl;
+      if (this->converged(currentIteration)) break;
       currentIteration++;
     }
   }
@@ -6,29 +6,30 @@
 #include <omp.h>
 #include "common/nmf.hpp"
 #include "nnls/bppnnls.hpp"
+#include "nnls/bppnnlspool.hpp"
 
 // needed for precondition with hals
 #ifdef BUILD_SPARSE
 #include "hals.hpp"
 #endif
 
-#define ONE_THREAD_MATRIX_SIZE 2000
-
 namespace planc {
 
 template <class T>
 class BPPNMF : public NMF<T> {
  private:
   T At;
+  /// gram and product of the last update, reused by the objective error
   MAT giventGiven;
+  MAT giventInput;
+  /// per thread NNLS workspaces reused across the iterations
+  BPPNNLSPool<MAT, VEC> nnlsPool;
   // designed as if W is given and H is found.
   // The transpose is the other problem.
   void updateOtherGivenOneMultipleRHS(const T &input, const MAT &given,
                                       char worh, MAT *othermat) {
     double t2;
-    UINT numThreads = (input.n_cols / ONE_THREAD_MATRIX_SIZE) + 1;
     tic();
-    MAT giventInput(this->k, input.n_cols);
     // This is WtW
     giventGiven = given.t() * given;
     // This is WtA
@@ -37,55 +38,14 @@ class BPPNMF : public NMF<T> {
     // INFO << "matmul ::" << toc() << std::endl;
     t2 = toc();
     INFO << "starting " << worh << ". Prereq for " << worh << " took=" << t2
-         << " NumThreads=" << numThreads << PRINTMATINFO(giventGiven)
+         << PRINTMATINFO(giventGiven)
          << PRINTMATINFO(giventInput) << std::endl;
+    this->m_stop.add_pgrad(*othermat, giventGiven, giventInput, true);
     tic();
-#pragma omp parallel for schedule(dynamic)
-    for (UINT i = 0; i < numThreads; i++) {
-      UINT spanStart = i * ONE_THREAD_MATRIX_SIZE;
-      UINT spanEnd = (i + 1) * ONE_THREAD_MATRIX_SIZE - 1;
-      if (spanEnd > input.n_cols - 1) {
-        spanEnd = input.n_cols - 1;
-      }
-      // if it is exactly divisible, the last iteration is unnecessary.
-      BPPNNLS<MAT, VEC> *subProblem;
-      if (spanStart <= spanEnd) {
-        if (spanStart == spanEnd) {
-          subProblem = new BPPNNLS<MAT, VEC>(
-              giventGiven, (VEC)giventInput.col(spanStart), true);
-        } else {  // if (spanStart < spanEnd)
-          subProblem = new BPPNNLS<MAT, VEC>(
-              giventGiven, (MAT)giventInput.cols(spanStart, spanEnd), true);
-        }
-#ifdef _VERBOSE
-        INFO << "Scheduling " << worh << " start=" << spanStart
-             << ", end=" << spanEnd << ", tid=" << omp_get_thread_num()
-             << std::endl;
-#endif
-        // tic();
-        subProblem->solveNNLS();
-        // t2 = toc();
-#ifdef _VERBOSE
-        INFO << "completed " << worh << " start=" << spanStart
-             << ", end=" << spanEnd << ", tid=" << omp_get_thread_num()
-             << " cpu=" << sched_getcpu() << " time taken=" << t2
-             << " num_iterations()=" << numIter << std::endl;
-#endif
-        if (spanStart == spanEnd) {
-          ROWVEC solVec = subProblem->getSolutionVector().t();
-          (*othermat).row(i) = solVec;
-        } else {  // if (spanStart < spanEnd)
-          (*othermat).rows(spanStart, spanEnd) =
-              subProblem->getSolutionMatrix().t();
-        }
-        subProblem->clear();
-        delete subProblem;
-      }
-    }
+    nnlsPool.solve(giventGiven, giventInput, othermat, true, worh);
     double totalH2 = toc();
-    INFO << worh << " total time taken :" << totalH2 << std::endl;
-    giventGiven.clear();
-    giventInput.clear();
+    INFO << worh << " total time taken :" << totalH2
+         << " chunks=" << nnlsPool.lastChunks() << std::endl;
   }
 
  public:
@@ -200,6 +160,7 @@ class BPPNMF : public NMF<T> {
     INFO << "Starting BPP for num_iterations()=" << this->num_iterations()
          << std::endl;
     while (currentIteration < this->num_iterations()) {
+      this->m_stop.start(currentIteration);
 #ifdef COLLECTSTATS
       this->collectStats(currentIteration);
       this->stats(currentIteration + 1, 0) = currentIteration + 1;
@@ -220,10 +181,12 @@ class BPPNMF : public NMF<T> {
 #endif
       INFO << "completed it=" << currentIteration
            << " time taken = " << totalW2 + totalH2 << std::endl;
-      this->computeObjectiveError();
+      // WtW and WtA of the H update are still around
+      this->computeObjectiveErrorFromWtA(giventInput, giventGiven);
       INFO << "error:it = " << currentIteration
            << " bpperr =" << sqrt(this->objective_err) / this->normA
            << std::endl;
+      if (this->converged(currentIteration)) break;
       currentIteration++;
     }
     this->normalize_by_W();
@@ -244,7 +207,11 @@ class BPPNMF : public NMF<T> {
     updateOtherGivenOneMultipleRHS(this->A, this->W, 'H', &(this->H));
     return this->H;
   }
-  ~BPPNMF() { this->At.clear(); }
+  ~BPPNMF() {
+    this->At.clear();
+    giventGiven.clear();
+    giventInput.clear();
+  }
 };
 
 }  // namespace planc
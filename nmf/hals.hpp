@@ -51,6 +51,7 @@ class HALSNMF : public NMF<T> {
     unsigned int currentIteration = 0;    
     INFO << "computed transpose At=" << PRINTMATINFO(this->At) << std::endl;
     while (currentIteration < this->num_iterations()) {
+      this->m_stop.start(currentIteration);
       tic();
       // update H
       tic();
@@ -59,6 +60,7 @@ class HALSNMF : public NMF<T> {
       INFO << "starting H Prereq for "
            << " took=" << toc() << PRINTMATINFO(WtW) << PRINTMATINFO(WtA)
            << std::endl;
+      this->m_stop.add_pgrad(this->H, WtW, WtA, true);
       // to avoid divide by zero error.
       tic();
       double normConst;
@@ -82,6 +84,7 @@ class HALSNMF : public NMF<T> {
       INFO << "starting W Prereq for "
            << " took=" << toc() << PRINTMATINFO(HtH) << PRINTMATINFO(AH)
            << std::endl;
+      this->m_stop.add_pgrad(this->W, HtH, AH);
       tic();
       VEC Wx;
       for (unsigned int x = 0; x < this->k; x++) {
@@ -97,6 +100,9 @@ class HALSNMF : public NMF<T> {
           this->W.col(x) = Wx;
         }
       }
+      // W*H^T is invariant to normalize_by_W, so the error can reuse
+      // AH and HtH of the current H before the normalization.
+      this->computeObjectiveErrorFromAH(AH, HtH);
       this->normalize_by_W();
 
       INFO << "Completed W (" << currentIteration << "/"
@@ -106,10 +112,10 @@ class HALSNMF : public NMF<T> {
       INFO << "Completed It (" << currentIteration << "/"
            << this->num_iterations() << ")"
            << " time =" << toc() << std::endl;
-      this->computeObjectiveError();
       INFO << "Completed it = " << currentIteration
            << " HALSERR=" << sqrt(this->objective_err) / this->normA
            << std::endl;
+      if (this->converged(currentIteration)) break;
       currentIteration++;
     }
   }
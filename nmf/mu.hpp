@@ -49,6 +49,7 @@ class MUNMF : public NMF<T> {
     unsigned int currentIteration = 0;
     INFO << "computed transpose At=" << PRINTMATINFO(this->At) << std::endl;
     while (currentIteration < this->num_iterations()) {
+      this->m_stop.start(currentIteration);
       tic();
       // update H
       tic();
@@ -57,6 +58,7 @@ class MUNMF : public NMF<T> {
       INFO << "starting H Prereq for "
            << " took=" << toc();
       INFO << PRINTMATINFO(WtW) << PRINTMATINFO(AtW) << std::endl;
+      this->m_stop.add_pgrad(this->H, WtW, AtW);
       // to avoid divide by zero error.
       tic();
       // H = H.*AtW./(WtW_reg*H + epsilon);
@@ -72,6 +74,7 @@ class MUNMF : public NMF<T> {
       INFO << "starting W Prereq for "
            << " took=" << toc() << PRINTMATINFO(HtH) << PRINTMATINFO(AH)
            << std::endl;
+      this->m_stop.add_pgrad(this->W, HtH, AH);
       tic();
       // W = W.*AH./(W*HtH_reg + epsilon);
       this->W = (this->W % AH) / ((this->W * HtH) + EPSILON_1EMINUS16);
@@ -81,9 +84,10 @@ class MUNMF : public NMF<T> {
       INFO << "Completed It (" << currentIteration << "/"
            << this->num_iterations() << ")"
            << " time =" << toc() << std::endl;
-      this->computeObjectiveError();
+      this->computeObjectiveErrorFromAH(AH, HtH);
       INFO << "Completed it = " << currentIteration
            << " MUERR=" << sqrt(this->objective_err) / this->normA << std::endl;
+      if (this->converged(currentIteration)) break;
       currentIteration++;
     }
     this->normalize_by_W();
@@ -12,7 +12,8 @@
 
 template <class NMFTYPE>
 void NMFDriver(int k, UWORD m, UWORD n, std::string AfileName,
-               std::string WfileName, std::string HfileName, int numIt) {
+               std::string WfileName, std::string HfileName, int numIt,
+               const planc::StopCriterion &stop) {
 #ifdef BUILD_SPARSE
   SP_MAT A;
 #else
@@ -44,6 +45,7 @@ void NMFDriver(int k, UWORD m, UWORD n, std::string AfileName,
   MAT W, H;
   NMFTYPE nmfAlgorithm(A, k);
   nmfAlgorithm.num_iterations(numIt);
+  nmfAlgorithm.stop_criterion(stop);
   INFO << "completed constructor" << PRINTMATINFO(A) << std::endl;
   tic();
   nmfAlgorithm.computeNMF();
@@ -80,12 +82,12 @@ void parseCommandLineandCallNMF(int argc, char* argv[]) {
       NMFDriver<planc::MUNMF<SP_MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 #else
       NMFDriver<planc::MUNMF<MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 #endif
       break;
     case HALS:
@@ -93,12 +95,12 @@ void parseCommandLineandCallNMF(int argc, char* argv[]) {
       NMFDriver<planc::HALSNMF<SP_MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 #else
       NMFDriver<planc::HALSNMF<MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 #endif
       break;
     case ANLSBPP:
@@ -106,12 +108,12 @@ void parseCommandLineandCallNMF(int argc, char* argv[]) {
       NMFDriver<planc::BPPNMF<SP_MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 #else
       NMFDriver<planc::BPPNMF<MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 #endif
       break;
     case AOADMM:
@@ -122,13 +124,13 @@ void parseCommandLineandCallNMF(int argc, char* argv[]) {
       NMFDriver<planc::AOADMMNMF<SP_MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 
 #else
       NMFDriver<planc::AOADMMNMF<MAT> >(
           pc.lowrankk(), pc.globalm(), pc.globaln(), pc.input_file_name(),
           pc.output_file_name() + "_w", pc.output_file_name() + "_h",
-          pc.iterations());
+          pc.iterations(), pc.stop_criterion());
 #endif
       break;
     default:
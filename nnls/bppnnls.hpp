@@ -9,6 +9,10 @@
 // #include <lapacke.h>
 // #endif
 #include <assert.h>
+#include <stdint.h>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
 #include "ActiveSetNNLS.h"
 #include "nnls.hpp"
 #include "utils.hpp"
@@ -16,21 +20,31 @@
 #include <algorithm>
 #include <iomanip>
 #include "ActiveSetNNLS.hpp"
-#include "SortBooleanMatrix.hpp"
 
 template <class MATTYPE, class VECTYPE>
 class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
   public:
     BPPNNLS(MATTYPE input, VECTYPE rhs, bool prodSent = false):
         NNLS<MATTYPE, VECTYPE>(input, rhs, prodSent) {
+        cholCacheElems = 0;
     }
     BPPNNLS(MATTYPE input, MATTYPE RHS, bool prodSent = false) :
         NNLS<MATTYPE, VECTYPE>(input, RHS, prodSent) {
+        cholCacheElems = 0;
+    }
+    /*
+     * Workspace of q variables for solveNNLS(AtB, start, end, ...).
+     * One per thread is meant to be reused for many column chunks.
+     */
+    explicit BPPNNLS(UINT q) : NNLS<MATTYPE, VECTYPE>(q) {
+        cholCacheElems = 0;
     }
     int solveNNLS() {
         int rcIterations = 0;
         if (this->r == 1) {
             rcIterations = solveNNLSOneRHS();
+            colIterations.set_size(1);
+            colIterations(0) = rcIterations;
         } else {
             // r must be greater than 1 in this case.
             // we initialized r appropriately in the
@@ -39,7 +53,75 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
         }
         return rcIterations;
     }
+    /*
+     * Solves the columns [start, end] of AtB against the CtC given to
+     * setCtC, reusing the buffers of this workspace. The solution is
+     * written into the same columns of o_X, or into the same rows of o_X
+     * if trans is true.
+     */
+    int solveNNLS(const MATTYPE &AtB, UWORD start, UWORD end, MATTYPE *o_X,
+                  bool trans) {
+        this->setCtB(AtB, start, end);
+        int rcIterations = solveNNLS();
+        if (this->r == 1) {
+            if (trans) {
+                o_X->row(start) = this->x.t();
+            } else {
+                o_X->col(start) = this->x;
+            }
+        } else {
+            if (trans) {
+                o_X->rows(start, end) = this->X.t();
+            } else {
+                o_X->cols(start, end) = this->X;
+            }
+        }
+        return rcIterations;
+    }
+    /*
+     * Number of BPP iterations in which every column of the last
+     * solveNNLS was still infeasible. The columns converge at different
+     * iterations, so this is the cost of each column and not of the call.
+     */
+    const UVEC &columnIterations() const { return colIterations; }
+    /*
+     * Replaces CtC of a workspace. The cached cholesky factors belong
+     * to the old CtC and are dropped.
+     */
+    void setCtC(const MATTYPE &inputMat) {
+        NNLS<MATTYPE, VECTYPE>::setCtC(inputMat);
+        cholCache.clear();
+        cholCacheElems = 0;
+    }
   private:
+    /*
+     * 64 bit mix of the packed passive set.
+     */
+    static uint64_t hashPassSet(const uint64_t *w, UWORD nwords) {
+        uint64_t h = 0x9e3779b97f4a7c15ULL;
+        for (UWORD i = 0; i < nwords; i++) {
+            h ^= w[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        }
+        return h;
+    }
+    struct PassSetHasher {
+        size_t operator()(const std::vector<uint64_t> &key) const {
+            return hashPassSet(&key[0], key.size());
+        }
+    };
+    typedef std::unordered_map<std::vector<uint64_t>, MATTYPE, PassSetHasher>
+        CholCache;
+    // bound on the doubles held by the cholesky cache
+    static const UWORD kMaxCholCacheElems = 1 << 22;
+    CholCache cholCache;
+    UWORD cholCacheElems;
+    // buffers of solveNNLSMultipleRHS kept across the calls
+    MATTYPE YBuf;
+    arma::umat VBuf;
+    arma::umat PassiveSetBuf;
+    STDVEC allIdxsBuf;
+    UVEC colIterations;
+
     /*
      * This implementation is based on Algorithm 1 on Page 6 of paper
      * http://www.cc.gatech.edu/~hpark/papers/SISC_082117RR_Kim_Park.pdf.
@@ -182,12 +264,15 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
     int solveNNLSMultipleRHS() {
         UINT currentIteration = 0;
         UINT MAX_ITERATIONS = this->q * 2;
-        MATTYPE Y = -this->CtB;
+        MATTYPE &Y = this->YBuf;
+        Y = -this->CtB;
         UVEC Fv(this->q * this->r);
         Fv.zeros();
         UVEC Gv(this->q * this->r);
-        arma::umat V(this->q, this->r);
-        STDVEC allIdxs;
+        arma::umat &V = this->VBuf;
+        V.set_size(this->q, this->r);
+        STDVEC &allIdxs = this->allIdxsBuf;
+        allIdxs.clear();
         IVEC alphaZeroIdxs(this->r);
         bool solutionFound = false;
         for (UINT i = 0; i < this->q * this->r; i++) {
@@ -199,6 +284,7 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
         alpha = alpha * 3;
         beta.ones();
         beta = beta * (this->q + 1);
+        colIterations.zeros(this->r);
 #ifdef _VERBOSE
         INFO << "Gv :" << Gv.size() << endl << Gv;
         INFO << "Rank : " << arma::rank(this->CtC) << endl;
@@ -262,6 +348,7 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
             //           nonOptCols.erase(std::unique(nonOptCols.begin(), nonOptCols.end()),
             //                   nonOptCols.end());
             UVEC NonOptCols = find(sum(V) != 0);
+            colIterations(NonOptCols) += 1;
 #ifdef _VERBOSE
             INFO << "NonOptCols:" << NonOptCols.size() << NonOptCols;
 #endif
@@ -312,8 +399,8 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
 #endif
             // solve LSQ with multiple RHS.
             // Step 11 of Algorithm 2.
-            arma::umat PassiveSet(this->q, this->r);
-            PassiveSet.zeros();
+            arma::umat &PassiveSet = this->PassiveSetBuf;
+            PassiveSet.zeros(this->q, this->r);
             PassiveSet(Fv).ones();
             UVEC FvCols = find(sum(PassiveSet) != 0);
             this->X.cols(FvCols) = solveNormalEqComb(this->CtC,
@@ -397,66 +484,96 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
      * M. H. Van Benthem and M. R. Keenan, J. Chemometrics 2004; 18: 441-450
      * Motivated out of implementation from Jingu's solveNormalEqComb.m
      */
-    MATTYPE solveNormalEqComb(MATTYPE AtA, MATTYPE AtB, arma::umat PassSet) {
-        MATTYPE Z;
-        UVEC Pv = find(PassSet != 0);
-        UVEC anyZeros = find(PassSet == 0);
-        if (anyZeros.empty()) {
-            // Everything is the in the passive set.
-            // INFO << "starting empty activeset solve" << endl;
-            // Z = arma::solve(AtA,AtB);
-            // INFO << "exiting empty activeset solve" << endl;
-            Z = solveSymmetricLinearEquations(AtA, AtB);
-        } else {
-            Z.resize(AtB.n_rows, AtB.n_cols);
-            Z.zeros();
-            UINT k1 = PassSet.n_cols;
-            if (k1 == 1) {
-                // INFO << "entry one col pass set" << endl;
-                // Z(Pv)=arma::solve(AtA(Pv,Pv),AtB(Pv));
-                // INFO << "exit one col pass set" << endl;
-                Z(Pv) = solveSymmetricLinearEquations(AtA(Pv, Pv), AtB(Pv));
-            } else {
-                // we have to group passive set columns that are same.
-                // find the correlation matrix of passive set matrix.
-                std::vector<UWORD> sortedIdx, beginIdx;
-                computeCorrelationScore(PassSet, sortedIdx, beginIdx);
-                // UVEC solved(k1);
-                // solved.zeros();
-                // assert(corrPassMat.n_rows==PassSet.n_cols);
-                // assert(corrPassMat.n_cols==PassSet.n_cols);
-                for (UINT i = 1; i < beginIdx.size(); i++) {
-                    // if(!solved(i))
-                    // {
-                    // UVEC samePassiveSetCols=find(corrPassMat.col(i)==1);
-                    UWORD sortedBeginIdx = beginIdx[i - 1];
-                    UWORD sortedEndIdx = beginIdx[i];
-                    UVEC samePassiveSetCols(std::vector<UWORD>
-                                            (sortedIdx.begin() + sortedBeginIdx,
-                                             sortedIdx.begin() + sortedEndIdx));
-                    // solved(samePassiveSetCols).ones();
-                    UVEC currentPassiveSet = find(PassSet.col( sortedIdx[sortedBeginIdx] ) == 1);
+    MATTYPE solveNormalEqComb(const MATTYPE &AtA, const MATTYPE &AtB,
+                              const arma::umat &PassSet) {
+        MATTYPE Z = arma::zeros<MATTYPE>(AtB.n_rows, AtB.n_cols);
+        UWORD k1 = PassSet.n_cols;
+        UWORD nwords = (PassSet.n_rows + 63) / 64;
+        // pack every passive set column into nwords bits
+        std::vector<uint64_t> bits(k1 * nwords, 0);
+        for (UWORD c = 0; c < k1; c++) {
+            uint64_t *w = &bits[c * nwords];
+            for (UWORD i = 0; i < PassSet.n_rows; i++) {
+                if (PassSet(i, c) != 0) w[i / 64] |= (1ULL << (i % 64));
+            }
+        }
+        // group the columns with the same passive set by hash.
+        // groups with the same hash are compared word by word.
+        std::unordered_map<uint64_t, std::vector<UWORD> > buckets;
+        std::vector<std::vector<UWORD> > groupCols;
+        for (UWORD c = 0; c < k1; c++) {
+            const uint64_t *w = &bits[c * nwords];
+            std::vector<UWORD> &bucket = buckets[hashPassSet(w, nwords)];
+            UWORD g = 0;
+            for (; g < bucket.size(); g++) {
+                const uint64_t *gw = &bits[groupCols[bucket[g]][0] * nwords];
+                if (memcmp(w, gw, nwords * sizeof(uint64_t)) == 0) break;
+            }
+            if (g == bucket.size()) {
+                bucket.push_back(groupCols.size());
+                groupCols.push_back(std::vector<UWORD>());
+            }
+            groupCols[bucket[g]].push_back(c);
+        }
+        for (UWORD g = 0; g < groupCols.size(); g++) {
+            UVEC samePassiveSetCols(groupCols[g]);
+            const uint64_t *w = &bits[groupCols[g][0] * nwords];
+            std::vector<uint64_t> key(w, w + nwords);
+            UVEC currentPassiveSet = find(PassSet.col(groupCols[g][0]) != 0);
+            if (currentPassiveSet.empty()) continue;
 #ifdef _VERBOSE
-                    INFO << "samePassiveSetCols:" << endl
-                         <<  samePassiveSetCols;
-                    INFO << "currPassiveSet : " << endl
-                         << currentPassiveSet;
-                    INFO << "AtA:" << endl
-                         << AtA(currentPassiveSet, currentPassiveSet);
-                    INFO << "AtB:" << endl
-                         << AtB(currentPassiveSet, samePassiveSetCols);
+            INFO << "samePassiveSetCols:" << endl << samePassiveSetCols;
+            INFO << "currPassiveSet : " << endl << currentPassiveSet;
 #endif
-                    Z(currentPassiveSet, samePassiveSetCols) =
-                        solveSymmetricLinearEquations(AtA(currentPassiveSet, currentPassiveSet),
-                                                      AtB(currentPassiveSet, samePassiveSetCols));
-                }
+            const MATTYPE *L = cholesky(key, AtA, currentPassiveSet);
+            MATTYPE rhs = AtB(currentPassiveSet, samePassiveSetCols);
+            if (L != NULL) {
+                lapack_int n = L->n_rows;
+                LAPACKE_dpotrs(LAPACK_COL_MAJOR, 'U', n, rhs.n_cols,
+                               L->memptr(), n, rhs.memptr(), n);
+            } else {
+                // AtA(P, P) is singular to working precision. solve falls
+                // back to the least squares solution for this group.
+                rhs = arma::solve(MATTYPE(AtA(currentPassiveSet,
+                                              currentPassiveSet)), rhs);
             }
+            Z(currentPassiveSet, samePassiveSetCols) = rhs;
         }
 #ifdef _VERBOSE
         INFO << "Returning mat Z:" << endl << Z;
 #endif
         return Z;
     }
+    /*
+     * Returns the upper cholesky factor of AtA(P, P) for the packed
+     * passive set key. The factors are cached across the BPP iterations
+     * as long as CtC does not change. Columns tend to move between a few
+     * passive sets, so most of the factorizations are hits. The cache is
+     * dropped when it exceeds kMaxCholCacheElems doubles. Returns NULL
+     * and caches nothing if AtA(P, P) is not positive definite.
+     */
+    const MATTYPE *cholesky(const std::vector<uint64_t> &key,
+                            const MATTYPE &AtA, const UVEC &P) {
+        typename CholCache::iterator it = cholCache.find(key);
+        if (it != cholCache.end()) return &it->second;
+        MATTYPE L = AtA(P, P);
+        lapack_int n = L.n_rows;
+        lapack_int info = LAPACKE_dpotrf(LAPACK_COL_MAJOR, 'U', n,
+                                         L.memptr(), n);
+        if (info != 0) {
+#ifdef _VERBOSE
+            WARN << "dpotrf info = " << (signed int)info
+                 << " for a passive set of " << n << endl;
+#endif
+            return NULL;
+        }
+        if (cholCacheElems + L.n_elem > kMaxCholCacheElems) {
+            cholCache.clear();
+            cholCacheElems = 0;
+        }
+        cholCacheElems += L.n_elem;
+        return &cholCache.insert(std::make_pair(key, L)).first->second;
+    }
     /*
      * This constructs the sets F, G and V based on
      * equation 3.5a and 3.5b. This is also the
@@ -527,27 +644,6 @@ class BPPNNLS : public NNLS<MATTYPE, VECTYPE> {
         }
         return B;
     }
-    /*
-    * Passset is a binary matrix where every column represents
-    * one datapoint. The objective is to returns a low triangular
-    * correlation matrix with 1 if the strings are equal. Zero otherwise
-    */
-    void computeCorrelationScore(arma::umat &PassSet, std::vector<UWORD> &sortedIdx,
-                                 std::vector<UWORD> &beginIndex) {
-        SortBooleanMatrix<arma::umat> sbm(PassSet);
-        sortedIdx = sbm.sortIndex();
-        BooleanArrayComparator<arma::umat> bac(PassSet);
-        uint beginIdx = 0;
-        beginIndex.clear();
-        beginIndex.push_back(beginIdx);
-        for (uint i = 0; i < sortedIdx.size(); i++) {
-            if (i == sortedIdx.size() - 1 || bac(sortedIdx[i], sortedIdx[i + 1]) == true) {
-                beginIdx = i + 1;
-                beginIndex.push_back(beginIdx);
-            }
-        }
-    }
-
     /*
     * Given a matrix, the last column of the matrix will be
     * checked if it reappears again. Every column in the matrix
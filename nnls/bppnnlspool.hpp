@@ -0,0 +1,152 @@
+/* Copyright 2016 Ramakrishnan Kannan */
+
+#ifndef NNLS_BPPNNLSPOOL_HPP_
+#define NNLS_BPPNNLSPOOL_HPP_
+
+#include <omp.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "bppnnls.hpp"
+
+/*
+ * Pool of per thread BPPNNLS workspaces. Solves min ||CX - B||, X >= 0
+ * for all the columns of AtB in chunks of columns scheduled over the
+ * OpenMP threads. Every thread solves its chunks in its own workspace,
+ * so there is no allocation or copy of AtA per chunk. The workspaces
+ * live as long as the pool and are reused across the iterations of
+ * NMF/NTF.
+ *
+ * The chunks are sized by the scheduler below instead of a fixed
+ * number of columns. The BPP iterations of every column, as counted by
+ * BPPNNLS::columnIterations, are remembered per problem id, and in the
+ * next solve of the same problem the columns are split into chunks of
+ * equal estimated cost. A chunk is never smaller than what amortizes
+ * the per chunk overhead for the given k. The chunks are dealt out to
+ * the threads as contiguous ranges and a thread that runs out of work
+ * steals from the tail of the thread with the most remaining chunks.
+ */
+template <class MATTYPE, class VECTYPE>
+class BPPNNLSPool {
+  private:
+    // chunks per thread for the load balance
+    static const UWORD kChunksPerThread = 4;
+    // minimum flops worth (cols * k * k) of a chunk
+    static const UWORD kMinChunkWork = 1 << 16;
+    // upper bound on the columns of a chunk
+    static const UWORD kMaxChunkCols = 4096;
+
+    std::vector<BPPNNLS<MATTYPE, VECTYPE> > workspaces;
+    // measured BPP iterations of every column per problem id
+    std::map<int, std::vector<float> > colCost;
+    UWORD lastNumChunks;
+
+    /*
+     * Splits n columns into chunks of nearly equal cost.
+     * @return begin of every chunk followed by n
+     */
+    std::vector<UWORD> makeChunks(const std::vector<float> &cost, UWORD k,
+                                  UINT numThreads) {
+        UWORD n = cost.size();
+        UWORD kk = (k > 0) ? k * k : 1;
+        UWORD minCols = (kMinChunkWork > kk) ? kMinChunkWork / kk : 1;
+        UWORD maxCols = (minCols > kMaxChunkCols) ? minCols : kMaxChunkCols;
+        UWORD targetChunks = numThreads * kChunksPerThread;
+        double totalCost = 0;
+        for (UWORD j = 0; j < n; j++) totalCost += cost[j];
+        double targetCost = totalCost / targetChunks;
+        std::vector<UWORD> begin;
+        begin.push_back(0);
+        double acc = 0;
+        UWORD cols = 0;
+        for (UWORD j = 0; j < n; j++) {
+            acc += cost[j];
+            cols++;
+            if ((acc >= targetCost && cols >= minCols) || cols >= maxCols) {
+                if (j + 1 < n) begin.push_back(j + 1);
+                acc = 0;
+                cols = 0;
+            }
+        }
+        begin.push_back(n);
+        return begin;
+    }
+
+  public:
+    BPPNNLSPool() : lastNumChunks(0) {}
+    /*
+     * @param[in] AtA is kxk
+     * @param[in] AtB is kxn
+     * @param[out] o_X is kxn or nxk if trans is true
+     * @param[in] trans write the transposed solution
+     * @param[in] problemId identifies the column costs of this problem
+     *            across the calls. Say, W and H or mode of the tensor.
+     */
+    void solve(const MATTYPE &AtA, const MATTYPE &AtB, MATTYPE *o_X,
+               bool trans, int problemId = 0) {
+        UWORD n = AtB.n_cols;
+        if (n == 0) return;
+        UINT numThreads = omp_get_max_threads();
+        if (workspaces.size() != numThreads) {
+            workspaces.assign(numThreads,
+                              BPPNNLS<MATTYPE, VECTYPE>(AtA.n_rows));
+        }
+        std::vector<float> &cost = colCost[problemId];
+        if (cost.size() != n) cost.assign(n, 1.0f);
+        std::vector<UWORD> begin = makeChunks(cost, AtA.n_rows, numThreads);
+        UWORD numChunks = begin.size() - 1;
+        lastNumChunks = numChunks;
+
+        // contiguous range of chunks [head, tail) for every thread
+        std::vector<UWORD> head(numThreads), tail(numThreads);
+        std::vector<omp_lock_t> locks(numThreads);
+        for (UINT t = 0; t < numThreads; t++) {
+            head[t] = (numChunks * t) / numThreads;
+            tail[t] = (numChunks * (t + 1)) / numThreads;
+            omp_init_lock(&locks[t]);
+        }
+#pragma omp parallel num_threads(numThreads)
+        {
+            UINT me = omp_get_thread_num();
+            BPPNNLS<MATTYPE, VECTYPE> &ws = workspaces[me];
+            ws.setCtC(AtA);
+            while (true) {
+                // own work from the front
+                UWORD c = numChunks;
+                omp_set_lock(&locks[me]);
+                if (head[me] < tail[me]) c = head[me]++;
+                omp_unset_lock(&locks[me]);
+                // steal from the back of the most loaded thread
+                while (c == numChunks) {
+                    UINT victim = me;
+                    UWORD most = 0;
+                    for (UINT t = 0; t < numThreads; t++) {
+                        omp_set_lock(&locks[t]);
+                        UWORD left = tail[t] - head[t];
+                        omp_unset_lock(&locks[t]);
+                        if (left > most) {
+                            most = left;
+                            victim = t;
+                        }
+                    }
+                    if (most == 0) break;
+                    omp_set_lock(&locks[victim]);
+                    if (head[victim] < tail[victim]) c = --tail[victim];
+                    omp_unset_lock(&locks[victim]);
+                }
+                if (c == numChunks) break;
+                UWORD spanStart = begin[c];
+                UWORD spanEnd = begin[c + 1] - 1;
+                ws.solveNNLS(AtB, spanStart, spanEnd, o_X, trans);
+                const UVEC &colIters = ws.columnIterations();
+                for (UWORD j = spanStart; j <= spanEnd; j++) {
+                    cost[j] = colIters(j - spanStart) + 1;
+                }
+            }
+        }
+        for (UINT t = 0; t < numThreads; t++) omp_destroy_lock(&locks[t]);
+    }
+    /// number of chunks in the last solve
+    UWORD lastChunks() const { return lastNumChunks; }
+};
+#endif  // NNLS_BPPNNLSPOOL_HPP_
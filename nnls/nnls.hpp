@@ -68,8 +68,44 @@ class NNLS {
 #endif
         this->cleared = false;
     }
+    /*
+     * Empty problem of q variables. Used as a reusable workspace
+     * that is filled with setCtC and setCtB.
+     */
+    explicit NNLS(UINT q) {
+        this->inputProd = true;
+        this->p = 0;
+        this->q = q;
+        this->r = 0;
+        this->cleared = false;
+    }
     ~NNLS() {
     }
+    /*
+     * Replaces CtC. The buffer is reused when the size matches.
+     */
+    void setCtC(const MATTYPE& inputMat) {
+        this->CtC = inputMat;
+        this->q = inputMat.n_rows;
+        this->cleared = false;
+    }
+    /*
+     * Replaces the right hand side with the columns [start, end] of RHS
+     * and zeros the solution. A single column is solved as a vector
+     * exactly as the constructor does. The buffers are reused when the
+     * sizes match, so a workspace never allocates for chunks of the
+     * same size.
+     */
+    void setCtB(const MATTYPE& RHS, UWORD start, UWORD end) {
+        this->r = end - start + 1;
+        if (this->r == 1) {
+            this->Ctb = RHS.col(start);
+            this->x.zeros(this->q);
+        } else {
+            this->CtB = RHS.cols(start, end);
+            this->X.zeros(this->q, this->r);
+        }
+    }
 
     virtual int solveNNLS() = 0;
 
@@ -9,11 +9,15 @@
 // #include <cblas.h>
 #include <mkl.h>
 #include <armadillo>
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include "common/ncpfactors.hpp"
 #include "common/ntf_utils.hpp"
+#include "common/ooctensor.hpp"
+#include "common/stopcriterion.hpp"
 #include "common/tensor.hpp"
-#include "dimtree/ddt.hpp"
+#include "dimtree/bdt.hpp"
 
 namespace planc {
 
@@ -50,13 +54,19 @@ class AUNTF {
   MAT *ncp_krp;
   const algotype m_updalgo;
   planc::Tensor *lowranktensor;
-  DenseDimensionTree *kdt;
+  BinaryDimensionTree *kdt;
   bool m_enable_dim_tree;
+  // streams the tensor from disk instead of m_input_tensor. Not owned.
+  OutOfCoreTensor *m_ooc;
+  // all the modes are updated from the same snapshot of the factors
+  bool m_jacobi;
   // needed for acceleration algorithms.
   bool m_accelerated;
   double m_rel_error;
   double m_normA;
   std::vector<bool> m_stale_mttkrp;
+  // convergence based stopping
+  StopCriterion m_stop;
 
   // Ensure factor is unnormalised when calling this function
   void update_factor_mode(const int &current_mode, const MAT &factor) {
@@ -74,6 +84,135 @@ class AUNTF {
     }
   }
   virtual void accelerate() {}
+  /**
+   * Gram based relative error from the mttkrp and gram_without_one of
+   * the given mode.
+   * ||X - M||^2 = ||X||^2 - 2 <mttkrp, U> + 1^T (S % U^TU) 1 where U is
+   * the unnormalized factor and S the hadamard of the other grams.
+   * Right after the update of the last mode, it reuses the mttkrp and the
+   * gram of that update. This costs O(I_N k^2) instead of reconstructing
+   * the whole tensor.
+   * @param[in] factor_t unnormalized kxI_n factor of the mode
+   * @param[in] mode of the mttkrp and the gram
+   */
+  double computeGramError(const MAT &factor_t, int mode) {
+    double inner_product = arma::accu(ncp_mttkrp_t[mode] % factor_t);
+    double sq_norm_model =
+        arma::accu(gram_without_one % (factor_t * factor_t.t()));
+    // m_normA is the squared norm of the tensor
+    double squared_err =
+        std::max(this->m_normA - 2 * inner_product + sq_norm_model, 0.0);
+    return std::sqrt(squared_err / this->m_normA);
+  }
+  /**
+   * Allocates the krp of the mode on first use. With the dimension tree
+   * the krps are never formed, hence never allocated.
+   */
+  MAT &krp_buffer(int mode) {
+    if (ncp_krp[mode].n_elem == 0) {
+      ncp_krp[mode].zeros(TENSOR_NUMEL / TENSOR_DIM[mode], m_low_rank_k);
+    }
+    return ncp_krp[mode];
+  }
+  /**
+   * Allocates the buffers of the chosen execution path and reports the
+   * memory budget in words of 8 bytes. Without the dimension tree, the
+   * krps of all the modes and, for the error, a full low rank tensor
+   * are needed. With it, only the memoized partial mttkrps of the tree.
+   * Out of core, only the two slab buffers.
+   */
+  void allocate_buffers() {
+    UWORD factor_words = arma::sum(TENSOR_DIM) * m_low_rank_k;
+    UWORD krp_words = 0;
+    UWORD lowrank_words = 0;
+    UWORD tree_words = 0;
+    UWORD slab_words = 0;
+    if (m_ooc != NULL) {
+      slab_words = m_ooc->buffer_words();
+    } else if (m_enable_dim_tree) {
+      // factor copies of the tree and the memoized nodes
+      tree_words = factor_words + kdt->memoized_words();
+    } else {
+#ifndef FUSED_MTTKRP
+      for (int i = 0; i < this->m_input_tensor.modes(); i++) {
+        krp_words += krp_buffer(i).n_elem;
+      }
+#endif
+      if (m_compute_error) {
+        krp_words = std::max(krp_words, krp_buffer(0).n_elem);
+        if (lowranktensor == NULL) {
+          lowranktensor = new planc::Tensor(m_input_tensor.dimensions());
+        }
+        lowrank_words = TENSOR_NUMEL;
+      }
+    }
+    // factors and mttkrps
+    UWORD total_words = TENSOR_NUMEL + 2 * factor_words + krp_words +
+                        lowrank_words + tree_words + slab_words;
+    INFO << "memory budget words::tensor::" << TENSOR_NUMEL
+         << "::factors::" << factor_words << "::mttkrp::" << factor_words
+         << "::krp::" << krp_words << "::lowrank tensor::" << lowrank_words
+         << "::dimension tree::" << tree_words
+         << "::out of core slabs::" << slab_words << "::total::" << total_words
+         << "::MB::" << (total_words * sizeof(double)) / (1024.0 * 1024.0)
+         << std::endl;
+  }
+  /// mttkrp of the mode j with the current factors into ncp_mttkrp_t[j]
+  void compute_mttkrp(int j) {
+    if (m_ooc != NULL) {
+      m_ooc->mttkrp(j, m_ncp_factors, &ncp_mttkrp_t[j]);
+    } else if (this->m_enable_dim_tree) {
+      double multittv_time = 0;
+      double mttkrp_time = 0;
+      kdt->in_order_reuse_MTTKRP(j, ncp_mttkrp_t[j].memptr(), false,
+                                 multittv_time, mttkrp_time);
+    } else {
+#ifdef FUSED_MTTKRP
+      m_ncp_factors.fused_mttkrp(j, m_input_tensor, &ncp_mttkrp_t[j]);
+#else
+      m_ncp_factors.krp_leave_out_one(j, &krp_buffer(j));
+#ifdef NTF_VERBOSE
+      INFO << "krp_leave_out_" << j << std::endl << ncp_krp[j] << std::endl;
+#endif
+      m_input_tensor.mttkrp(j, ncp_krp[j], &ncp_mttkrp_t[j]);
+#endif
+    }
+    this->m_stale_mttkrp[j] = false;
+  }
+  /**
+   * mttkrps of all the stale modes with the current factors. Out of core
+   * and with the in memory tensor, the tensor is traversed only once for
+   * all the modes. The dimension tree computes them one by one.
+   */
+  void compute_all_mttkrps() {
+    int num_modes = this->m_input_tensor.modes();
+    std::vector<MAT *> out(num_modes, static_cast<MAT *>(NULL));
+    for (int j = 0; j < num_modes; j++) {
+      if (this->m_stale_mttkrp[j]) out[j] = &ncp_mttkrp_t[j];
+    }
+    if (m_ooc != NULL) {
+      m_ooc->mttkrp(m_ncp_factors, out);
+    } else if (this->m_enable_dim_tree) {
+      for (int j = 0; j < num_modes; j++) {
+        if (out[j] != NULL) compute_mttkrp(j);
+      }
+    } else {
+      m_ncp_factors.mttkrp_all(m_input_tensor, out);
+    }
+    for (int j = 0; j < num_modes; j++) this->m_stale_mttkrp[j] = false;
+  }
+  /**
+   * Error of the current factors without the krp and the low rank tensor.
+   * The mttkrp of mode 0 comes from the dimension tree or the out of core
+   * tensor and stays valid for the update of mode 0 in the next iteration.
+   */
+  double computeLeanError() {
+    m_ncp_factors.gram_leave_out_one(0, &gram_without_one);
+    if (this->m_stale_mttkrp[0]) compute_mttkrp(0);
+    MAT unnorm_fac_t =
+        (m_ncp_factors.factor(0) * arma::diagmat(m_ncp_factors.lambda())).t();
+    return computeGramError(unnorm_fac_t, 0);
+  }
 
  public:
   AUNTF(const planc::Tensor &i_tensor, const int i_k, algotype i_algo)
@@ -84,14 +223,16 @@ class AUNTF {
     m_ncp_factors.normalize();
     gram_without_one.zeros(i_k, i_k);
     ncp_mttkrp_t = new MAT[i_tensor.modes()];
+    // the krps and the low rank tensor are allocated in computeNTF
+    // only if the execution path needs them.
     ncp_krp = new MAT[i_tensor.modes()];
     for (int i = 0; i < i_tensor.modes(); i++) {
-      UWORD current_size = TENSOR_NUMEL / TENSOR_DIM[i];
-      ncp_krp[i].zeros(current_size, i_k);
       ncp_mttkrp_t[i].zeros(i_k, TENSOR_DIM[i]);
       this->m_stale_mttkrp.push_back(true);
     }
-    lowranktensor = new planc::Tensor(i_tensor.dimensions());
+    lowranktensor = NULL;
+    m_ooc = NULL;
+    m_jacobi = false;
     m_compute_error = false;
     m_num_it = 20;
     m_normA = i_tensor.norm();
@@ -115,16 +256,47 @@ class AUNTF {
   void dim_tree(bool i_dim_tree) {
     this->m_enable_dim_tree = i_dim_tree;
     if (i_dim_tree) {
-      this->kdt = new DenseDimensionTree(m_input_tensor, m_ncp_factors,
-                                         m_input_tensor.modes() / 2);
+      this->kdt = new BinaryDimensionTree(m_input_tensor, m_ncp_factors);
+      INFO << "dimension tree::" << kdt->layout() << "::sweep flops::"
+           << kdt->sweep_flops() << "::memoized words::"
+           << kdt->memoized_words() << std::endl;
     }
   }
+  /**
+   * Streams the tensor from i_ooc instead of the elements of the input
+   * tensor, which then only needs the dimensions. The dimension tree is
+   * not used out of core.
+   */
+  void out_of_core(OutOfCoreTensor *i_ooc) {
+    this->m_ooc = i_ooc;
+    this->m_normA = i_ooc->norm();
+  }
+  /**
+   * Jacobi sweeps. The mttkrps of all the modes are computed from one
+   * traversal of the tensor with the factors of the previous iteration
+   * and then all the factors are updated. It converges differently from
+   * the default Gauss-Seidel sweep, where every mode sees the factors
+   * already updated in the sweep. Meant for HALS and MU on bandwidth
+   * bound tensors.
+   */
+  void jacobi(bool i_jacobi) { this->m_jacobi = i_jacobi; }
   double current_error() const { return this->m_rel_error; }
   void num_it(const int i_n) { this->m_num_it = i_n; }
+  /// Sets the convergence based stopping criterion
+  void stop_criterion(const StopCriterion &i_stop) { this->m_stop = i_stop; }
   void computeNTF() {
+    int num_modes = this->m_input_tensor.modes();
+    allocate_buffers();
     for (m_current_it = 0; m_current_it < m_num_it; m_current_it++) {
       INFO << "iter::" << this->m_current_it << std::endl;
-      for (int j = 0; j < this->m_input_tensor.modes(); j++) {
+      m_stop.start(m_current_it);
+      MAT last_factor;
+      std::vector<MAT> jacobi_factors;
+      if (m_jacobi) {
+        compute_all_mttkrps();
+        jacobi_factors.resize(num_modes);
+      }
+      for (int j = 0; j < num_modes; j++) {
         m_ncp_factors.gram_leave_out_one(j, &gram_without_one);
 #ifdef NTF_VERBOSE
         INFO << "gram_without_" << j << "::" << arma::cond(gram_without_one)
@@ -132,31 +304,43 @@ class AUNTF {
              << gram_without_one << std::endl;
 #endif
         if (this->m_stale_mttkrp[j]) {
-          m_ncp_factors.krp_leave_out_one(j, &ncp_krp[j]);
-#ifdef NTF_VERBOSE
-          INFO << "krp_leave_out_" << j << std::endl << ncp_krp[j] << std::endl;
-#endif
-          if (this->m_enable_dim_tree) {
-            double multittv_time = 0;
-            double mttkrp_time = 0;
-            kdt->in_order_reuse_MTTKRP(j, ncp_mttkrp_t[j].memptr(), false,
-                                       multittv_time, mttkrp_time);
-          } else {
-            m_input_tensor.mttkrp(j, ncp_krp[j], &ncp_mttkrp_t[j]);
-          }
-          this->m_stale_mttkrp[j] = false;
+          compute_mttkrp(j);
 #ifdef NTF_VERBOSE
           INFO << "mttkrp for factor" << j << std::endl
                << ncp_mttkrp_t[j] << std::endl;
 #endif
         }
+        if (m_stop.checking() && m_stop.type() == STOP_PGRAD) {
+          // the current model with the scale in mode j
+          MAT unnorm_factor =
+              m_ncp_factors.factor(j) * arma::diagmat(m_ncp_factors.lambda());
+          m_stop.add_pgrad(unnorm_factor, gram_without_one, ncp_mttkrp_t[j],
+                           true);
+        }
         // MAT factor = update(m_updalgo, gram_without_one, ncp_mttkrp_t[j], j);
         MAT factor = update(j);
+        if (m_stop.checking() && j == num_modes - 1) {
+          // the mttkrp of a jacobi sweep matches only the factors before
+          // the sweep. Its error is the one of the previous iterate.
+          last_factor = m_jacobi ? MAT((m_ncp_factors.factor(j) *
+                                        arma::diagmat(m_ncp_factors.lambda()))
+                                           .t())
+                                 : factor;
+        }
 #ifdef NTF_VERBOSE
         INFO << "iter::" << i << "::factor:: " << j << std::endl
              << factor << std::endl;
 #endif
-        update_factor_mode(j, factor.t());
+        if (m_jacobi) {
+          jacobi_factors[j] = factor;
+        } else {
+          update_factor_mode(j, factor.t());
+        }
+      }
+      if (m_jacobi) {
+        for (int j = 0; j < num_modes; j++) {
+          update_factor_mode(j, jacobi_factors[j].t());
+        }
       }
       if (m_compute_error) {
         double temp_err = computeObjectiveError();
@@ -164,6 +348,24 @@ class AUNTF {
         INFO << "relative_error at it::" << this->m_current_it
              << "::" << temp_err << std::endl;
       }
+      if (m_stop.checking()) {
+        for (int j = 0; j < num_modes; j++) {
+          m_stop.add_factor(j, m_ncp_factors.factor(j));
+        }
+        // the error above may have overwritten gram_without_one
+        double rel_err = 0;
+        if (m_stop.needs_error()) {
+          rel_err = m_compute_error
+                        ? this->m_rel_error
+                        : computeGramError(last_factor, num_modes - 1);
+        }
+        if (m_stop.converged(rel_err)) {
+          INFO << "converged at it::" << this->m_current_it
+               << "::" << m_stop.name() << "::" << m_stop.measure()
+               << std::endl;
+          break;
+        }
+      }
       if (this->m_accelerated) accelerate();
 #ifdef NTF_VERBOSE
       INFO << "ncp factors" << std::endl;
@@ -202,8 +404,13 @@ class AUNTF {
     // MAT lowranktensor(this->m_dimensions[0], krpsize);
     // lowranktensor = this->ncp_factors[0] * trans(krpleavingzero);
 
+    // the dimension tree never forms the krp nor the low rank tensor.
+    if (m_enable_dim_tree || m_ooc != NULL) return computeLeanError();
     // compute current low rank tensor as above.
-    m_ncp_factors.krp_leave_out_one(0, &ncp_krp[0]);
+    m_ncp_factors.krp_leave_out_one(0, &krp_buffer(0));
+    if (lowranktensor == NULL) {
+      lowranktensor = new planc::Tensor(m_input_tensor.dimensions());
+    }
     // cblas_dgemm_(const CBLAS_LAYOUT Layout,
     //              const CBLAS_TRANSPOSE transa,
     //              const CBLAS_TRANSPOSE transb,
@@ -4,6 +4,7 @@
 #include <iostream>
 #include "common/ncpfactors.hpp"
 #include "common/ntf_utils.hpp"
+#include "common/ooctensor.hpp"
 #include "common/parsecommandline.hpp"
 #include "common/tensor.hpp"
 #include "common/utils.h"
@@ -23,22 +24,49 @@ class NTFDriver {
   void callNTF(planc::ParseCommandLine pc) {
     int test_modes = pc.num_modes();
     UVEC dimensions(test_modes);
-    Tensor my_tensor(pc.dimensions());
+    Tensor my_tensor;
     std::string rand_prefix("rand_");
     std::string filename = pc.input_file_name();
     std::cout << "Input filename = " << filename << std::endl;
-    if (!filename.empty() &&
-        filename.compare(0, rand_prefix.size(), rand_prefix) != 0) {
-      my_tensor.read(pc.input_file_name());
+    OutOfCoreTensor *ooc = NULL;
+    bool from_file = !filename.empty() &&
+                     filename.compare(0, rand_prefix.size(), rand_prefix) != 0;
+    if (from_file && pc.out_of_core() > 0) {
+      // only the dimensions are in memory. the elements are streamed.
+      ooc = new OutOfCoreTensor(
+          filename, static_cast<UWORD>(pc.out_of_core()) * 1024 * 1024);
+      Tensor shape_tensor(ooc->dimensions(),
+                          arma::zeros<UVEC>(ooc->modes()), true);
+      my_tensor.swap(shape_tensor);
+    } else if (from_file) {
+      // don't allocate a random tensor just to throw it away.
+      if (pc.mmap_input() > 0) {
+        my_tensor.read_mmap(filename, pc.mmap_input() > 1);
+      } else {
+        my_tensor.read(filename);
+      }
+#ifdef NTF_VERBOSE
       my_tensor.print();
+#endif
+    } else {
+      Tensor rand_tensor(pc.dimensions());
+      my_tensor.swap(rand_tensor);
     }
     NTFTYPE ntfsolver(my_tensor, pc.lowrankk(), pc.lucalgo());
     ntfsolver.num_it(pc.iterations());
+    ntfsolver.stop_criterion(pc.stop_criterion());
     ntfsolver.compute_error(pc.compute_error());
-    if (pc.dim_tree()) {
+    ntfsolver.jacobi(pc.jacobi());
+    if (ooc != NULL) {
+      ntfsolver.out_of_core(ooc);
+      if (pc.dim_tree()) {
+        INFO << "dimension tree is not used out of core" << std::endl;
+      }
+    } else if (pc.dim_tree()) {
       ntfsolver.dim_tree(true);
     }
     ntfsolver.computeNTF();
+    delete ooc;
     // ntfsolver.ncp_factors().print();
   }
   NTFDriver() {}
@@ -0,0 +1,244 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <cinttypes>
+#include "writecsc.h"
+
+// Partitions a sparse matrix on a rowProcCount x colProcCount grid such that
+// every part gets nearly the same number of nonzeros. The parts keep the
+// uniform sizes of partition-uniform, that is, rowCount / rowProcCount rows
+// and colCount / colProcCount columns, so that the output can be read by
+// distnmf as is. Only the rows and the columns are permuted:
+//
+// 1. Rows are assigned to the row blocks heaviest first, always to the
+//    lightest row block that has room left (LPT with a capacity).
+// 2. Columns are assigned heaviest first to the column block that minimizes
+//    the heaviest part in that column block after adding the column, using
+//    the number of nonzeros of the column in every row block.
+//
+// The rows and the columns that don't fit into the uniform blocks are the
+// lightest ones and are dropped as partition-uniform drops the last ones.
+// Besides the per part files, [matrix-file-name]_rowmap and _colmap give the
+// zero based permuted index of every original row and column, or -1 if it
+// was dropped. Row i of the distributed W is the original row r with
+// rowmap[r] == i, the same for the columns and H. DistIO reads the maps
+// and writes W and H back in the original order.
+
+typedef std::pair<uint64_t, int> LoadBlock;
+
+static void printImbalance(const char *name, const std::vector<uint64_t> &partNnz) {
+  uint64_t maxNnz = 0, sumNnz = 0;
+  for (size_t i = 0; i < partNnz.size(); i++) {
+    maxNnz = std::max(maxNnz, partNnz[i]);
+    sumNnz += partNnz[i];
+  }
+  double avgNnz = static_cast<double>(sumNnz) / partNnz.size();
+  printf("%s::max part nnz::%ju::avg part nnz::%.1lf::imbalance::%.3lf\n", name,
+         maxNnz, avgNnz, avgNnz > 0 ? maxNnz / avgNnz : 1.0);
+}
+
+int main(int argc, char **argv) {
+  printf("partition-balanced began.\n");
+  if (argc < 4) {
+    printf("Usage: partition-balanced [matrix-file-name] [row-proc-count] [col-proc-count] [bin]\n");
+    return 0;
+  }
+  int rowProcCount = atoi(argv[2]);
+  int colProcCount = atoi(argv[3]);
+  // parts are binary CSC for planc::load_sp_mat instead of text triplets
+  bool binary = argc > 4 && std::string(argv[4]) == "bin";
+  int procCount = rowProcCount * colProcCount;
+  printf("Creating a %d x %d nonzero balanced partition.\n", rowProcCount, colProcCount);
+
+  FILE *file = fopen(argv[1], "r");
+  if (file == NULL) {
+    printf("Unable to open file %s.\n", argv[1]);
+    return 0;
+  }
+  int order;
+  uint64_t nnz;
+  uint64_t rowCount, colCount;
+  fscanf(file, " %d %" SCNu64, &order, &nnz);
+  fscanf(file, "%" SCNu64, &rowCount);
+  fscanf(file, "%" SCNu64, &colCount);
+  printf("order::%d::nnz::%ju::rowcount::%ju::colcount::%ju\n", order, nnz, rowCount, colCount);
+  uint64_t rowsPerProc = rowCount / rowProcCount;
+  uint64_t colsPerProc = colCount / colProcCount;
+  printf("Assigning %ju rows and %ju columns per part.\n", rowsPerProc, colsPerProc);
+
+  printf("Reading nonzeros...\n");
+  std::vector<uint64_t> rowIdxs(nnz), colIdxs(nnz);
+  std::vector<double> vals(nnz);
+  std::vector<uint64_t> rowNnz(rowCount, 0), colNnz(colCount, 0);
+  for (uint64_t i = 0; i < nnz; i++) {
+    fscanf(file, "%" SCNu64, &rowIdxs[i]);
+    fscanf(file, "%" SCNu64, &colIdxs[i]);
+    fscanf(file, "%lf", &vals[i]);
+    rowIdxs[i]--; colIdxs[i]--;
+    rowNnz[rowIdxs[i]]++;
+    colNnz[colIdxs[i]]++;
+  }
+  fclose(file);
+
+  {
+    // what partition-uniform would give
+    std::vector<uint64_t> partNnz(procCount, 0);
+    for (uint64_t i = 0; i < nnz; i++) {
+      uint64_t procRowIdx = rowIdxs[i] / rowsPerProc;
+      uint64_t procColIdx = colIdxs[i] / colsPerProc;
+      if (procRowIdx >= (uint64_t)rowProcCount || procColIdx >= (uint64_t)colProcCount) {
+        continue;  // Prune matrix
+      }
+      partNnz[procRowIdx * colProcCount + procColIdx]++;
+    }
+    printImbalance("uniform", partNnz);
+  }
+
+  printf("Assigning rows...\n");
+  std::vector<uint64_t> rowOrder(rowCount);
+  for (uint64_t i = 0; i < rowCount; i++) { rowOrder[i] = i; }
+  std::stable_sort(rowOrder.begin(), rowOrder.end(),
+                   [&](uint64_t a, uint64_t b) { return rowNnz[a] > rowNnz[b]; });
+  std::vector<int64_t> rowMap(rowCount, -1);
+  std::vector<int> rowBlock(rowCount, -1);
+  {
+    std::priority_queue<LoadBlock, std::vector<LoadBlock>, std::greater<LoadBlock> > lightest;
+    std::vector<uint64_t> filled(rowProcCount, 0);
+    for (int b = 0; b < rowProcCount; b++) { lightest.push(LoadBlock(0, b)); }
+    for (uint64_t i = 0; i < rowCount && !lightest.empty(); i++) {
+      LoadBlock top = lightest.top();
+      lightest.pop();
+      uint64_t r = rowOrder[i];
+      int b = top.second;
+      rowBlock[r] = b;
+      rowMap[r] = b * rowsPerProc + filled[b]++;
+      if (filled[b] < rowsPerProc) { lightest.push(LoadBlock(top.first + rowNnz[r], b)); }
+    }
+  }
+
+  printf("Assigning columns...\n");
+  // nonzeros of every column bucketed by column
+  std::vector<uint64_t> colPtr(colCount + 1, 0);
+  for (uint64_t i = 0; i < nnz; i++) { colPtr[colIdxs[i] + 1]++; }
+  for (uint64_t j = 0; j < colCount; j++) { colPtr[j + 1] += colPtr[j]; }
+  std::vector<uint64_t> colEntries(nnz);
+  {
+    std::vector<uint64_t> next(colPtr.begin(), colPtr.end() - 1);
+    for (uint64_t i = 0; i < nnz; i++) { colEntries[next[colIdxs[i]]++] = i; }
+  }
+  std::vector<uint64_t> colOrder(colCount);
+  for (uint64_t j = 0; j < colCount; j++) { colOrder[j] = j; }
+  std::stable_sort(colOrder.begin(), colOrder.end(),
+                   [&](uint64_t a, uint64_t b) { return colNnz[a] > colNnz[b]; });
+  std::vector<int64_t> colMap(colCount, -1);
+  // partLoad[rowblock * colProcCount + colblock]
+  std::vector<uint64_t> partLoad(procCount, 0);
+  std::vector<uint64_t> blockMax(colProcCount, 0);
+  std::vector<uint64_t> filled(colProcCount, 0);
+  std::vector<uint64_t> cnt(rowProcCount, 0);
+  std::vector<int> touched;
+  for (uint64_t jj = 0; jj < colCount; jj++) {
+    uint64_t c = colOrder[jj];
+    touched.clear();
+    for (uint64_t e = colPtr[c]; e < colPtr[c + 1]; e++) {
+      int b = rowBlock[rowIdxs[colEntries[e]]];
+      if (b < 0) { continue; }
+      if (cnt[b] == 0) { touched.push_back(b); }
+      cnt[b]++;
+    }
+    int best = -1;
+    uint64_t bestMax = 0, bestSum = 0;
+    for (int cb = 0; cb < colProcCount; cb++) {
+      if (filled[cb] == colsPerProc) { continue; }
+      uint64_t newMax = blockMax[cb], newSum = 0;
+      for (size_t t = 0; t < touched.size(); t++) {
+        uint64_t load = partLoad[touched[t] * colProcCount + cb] + cnt[touched[t]];
+        newMax = std::max(newMax, load);
+        newSum += load;
+      }
+      if (best < 0 || newMax < bestMax || (newMax == bestMax && newSum < bestSum)) {
+        best = cb;
+        bestMax = newMax;
+        bestSum = newSum;
+      }
+    }
+    if (best >= 0) {
+      colMap[c] = best * colsPerProc + filled[best]++;
+      for (size_t t = 0; t < touched.size(); t++) {
+        partLoad[touched[t] * colProcCount + best] += cnt[touched[t]];
+      }
+      blockMax[best] = bestMax;
+    }
+    for (size_t t = 0; t < touched.size(); t++) { cnt[touched[t]] = 0; }
+  }
+
+  printf("Partitioning nonzeros...\n");
+  std::vector< std::vector<uint64_t> > procRowIdxs(procCount);
+  std::vector< std::vector<uint64_t> > procColIdxs(procCount);
+  std::vector< std::vector<double> > procVals(procCount);
+  std::vector<uint64_t> partNnz(procCount, 0);
+  uint64_t dropped = 0;
+  for (uint64_t i = 0; i < nnz; i++) {
+    int64_t newRow = rowMap[rowIdxs[i]];
+    int64_t newCol = colMap[colIdxs[i]];
+    if (newRow < 0 || newCol < 0) { dropped++; continue; }  // Prune matrix
+    uint64_t procIdx = (newRow / rowsPerProc) * colProcCount + newCol / colsPerProc;
+    procRowIdxs[procIdx].push_back(newRow % rowsPerProc);
+    procColIdxs[procIdx].push_back(newCol % colsPerProc);
+    procVals[procIdx].push_back(vals[i]);
+    partNnz[procIdx]++;
+  }
+  printImbalance("balanced", partNnz);
+  printf("Dropped %ju nonzeros of the rows and columns beyond the uniform blocks.\n", dropped);
+
+  for (int i = 0; i < procCount; i++) {
+    printf("Writing the matrix for part %d...\n", i);
+    std::string outFileName(argv[1]);
+    outFileName += std::to_string(i);
+    if (binary) {
+      if (!writeBinaryCsc(outFileName.c_str(), rowsPerProc, colsPerProc,
+                          procRowIdxs[i], procColIdxs[i], procVals[i])) {
+        printf("Unable to write file %s.\n", outFileName.c_str());
+        return 1;
+      }
+      continue;
+    }
+    file = fopen(outFileName.c_str(), "w");
+    if (file == NULL) {
+      printf("Unable to open file %s.\n", outFileName.c_str());
+      return 0;
+    }
+    auto &curRowIdxs = procRowIdxs[i];
+    auto &curColIdxs = procColIdxs[i];
+    auto &curVals = procVals[i];
+    for (uint64_t j = 0; j < curRowIdxs.size(); j++) {
+      fprintf(file, "%" PRIu64 " %" PRIu64 " %e\n", curRowIdxs[j], curColIdxs[j], curVals[j]);
+    }
+    fclose(file);
+  }
+
+  printf("Writing the index maps...\n");
+  const char *suffix[2] = {"_rowmap", "_colmap"};
+  std::vector<int64_t> *maps[2] = {&rowMap, &colMap};
+  for (int m = 0; m < 2; m++) {
+    std::string mapFileName(argv[1]);
+    mapFileName += suffix[m];
+    file = fopen(mapFileName.c_str(), "w");
+    if (file == NULL) {
+      printf("Unable to open file %s.\n", mapFileName.c_str());
+      return 0;
+    }
+    for (size_t j = 0; j < maps[m]->size(); j++) {
+      fprintf(file, "%" PRId64 "\n", (*maps[m])[j]);
+    }
+    fclose(file);
+  }
+
+  printf("partition-balanced finished.\n");
+  return 0;
+}
@@ -5,15 +5,18 @@
 #include <string>
 #include <iostream>
 #include <cinttypes>
+#include "writecsc.h"
 
 int main(int argc, char **argv) {
   printf("partition-uniform began.\n");
   if (argc < 4) {
-    printf("Usage: partition-uniform [matrix-file-name] [row-proc-count] [col-proc-count]\n");
+    printf("Usage: partition-uniform [matrix-file-name] [row-proc-count] [col-proc-count] [bin]\n");
     return 0;
   }
   int rowProcCount = atoi(argv[2]);
   int colProcCount = atoi(argv[3]);
+  // parts are binary CSC for planc::load_sp_mat instead of text triplets
+  bool binary = argc > 4 && std::string(argv[4]) == "bin";
   int procCount = rowProcCount * colProcCount;
   printf("Creating a %d x %d uniform partition.\n", rowProcCount, colProcCount);
 
@@ -62,6 +65,14 @@ int main(int argc, char **argv) {
     printf("Writing the matrix for part %d...\n", i);
     std::string outFileName(argv[1]);
     outFileName += std::to_string(i);
+    if (binary) {
+      if (!writeBinaryCsc(outFileName.c_str(), rowsPerProc, colsPerProc,
+                          procRowIdxs[i], procColIdxs[i], procVals[i])) {
+        printf("Unable to write file %s.\n", outFileName.c_str());
+        return 1;
+      }
+      continue;
+    }
     file = fopen(outFileName.c_str(), "w");
     if (file == NULL) {
       printf("Unable to open file %s.\n", outFileName.c_str());
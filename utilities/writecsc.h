@@ -0,0 +1,66 @@
+#ifndef UTILITIES_WRITECSC_H_
+#define UTILITIES_WRITECSC_H_
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Writes the zero based triplets of one part in the binary CSC format of
+// planc::load_sp_mat (common/spmatio.hpp), so that distnmf reads the part
+// without parsing text. All integers are uint64 and values are double:
+//   char[8] "PLANCCSC", n_rows, n_cols, nnz,
+//   col_ptrs[n_cols + 1], row_indices[nnz], values[nnz]
+// The rows of every column are sorted and duplicate entries are summed,
+// as the text loader does. Returns false on any I/O error.
+static bool writeBinaryCsc(const char *fileName, uint64_t rowCount, uint64_t colCount,
+                           const std::vector<uint64_t> &rowIdxs,
+                           const std::vector<uint64_t> &colIdxs,
+                           const std::vector<double> &vals) {
+  uint64_t nnz = rowIdxs.size();
+  std::vector<uint64_t> colPtr(colCount + 1, 0);
+  for (uint64_t i = 0; i < nnz; i++) { colPtr[colIdxs[i] + 1]++; }
+  for (uint64_t j = 0; j < colCount; j++) { colPtr[j + 1] += colPtr[j]; }
+  std::vector<std::pair<uint64_t, double> > entries(nnz);
+  {
+    std::vector<uint64_t> next(colPtr.begin(), colPtr.end() - 1);
+    for (uint64_t i = 0; i < nnz; i++) {
+      entries[next[colIdxs[i]]++] = std::make_pair(rowIdxs[i], vals[i]);
+    }
+  }
+  // sort every column by row and sum the duplicates in place
+  std::vector<uint64_t> outPtr(colCount + 1, 0);
+  uint64_t outNnz = 0;
+  for (uint64_t j = 0; j < colCount; j++) {
+    std::sort(entries.begin() + colPtr[j], entries.begin() + colPtr[j + 1]);
+    for (uint64_t e = colPtr[j]; e < colPtr[j + 1]; e++) {
+      if (outNnz > outPtr[j] && entries[outNnz - 1].first == entries[e].first) {
+        entries[outNnz - 1].second += entries[e].second;
+      } else {
+        entries[outNnz++] = entries[e];
+      }
+    }
+    outPtr[j + 1] = outNnz;
+  }
+  std::vector<uint64_t> outRows(outNnz);
+  std::vector<double> outVals(outNnz);
+  for (uint64_t e = 0; e < outNnz; e++) {
+    outRows[e] = entries[e].first;
+    outVals[e] = entries[e].second;
+  }
+
+  FILE *file = fopen(fileName, "wb");
+  if (file == NULL) { return false; }
+  uint64_t header[3] = {rowCount, colCount, outNnz};
+  bool ok = fwrite("PLANCCSC", 1, 8, file) == 8 &&
+            fwrite(header, sizeof(uint64_t), 3, file) == 3 &&
+            fwrite(&outPtr[0], sizeof(uint64_t), colCount + 1, file) == colCount + 1 &&
+            fwrite(outRows.data(), sizeof(uint64_t), outNnz, file) == outNnz &&
+            fwrite(outVals.data(), sizeof(double), outNnz, file) == outNnz;
+  ok = (fclose(file) == 0) && ok;
+  return ok;
+}
+
+#endif  // UTILITIES_WRITECSC_H_